@@ -21,55 +21,418 @@ SOFTWARE.
  */
 
 #include <string.h>
-#include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
 
-#include <Arduino.h>
+/*
+ * Delimiters are found with SSE2, or AVX2 where the processor supports
+ * it.  Define SCPI_NO_SIMD to use the portable scalar loop instead.
+ */
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(SCPI_NO_SIMD)
+#define SCPI_SIMD
+#include <immintrin.h>
+#endif
 
 #include "scpiparser.h"
 
+
 #ifdef __cplusplus
 
   extern "C" {
-  
+
+#endif
+
+static void
+scpi_feed_reset(struct scpi_parser_context* ctx);
+
+static void
+scpi_header_cache_reset(struct scpi_parser_context* ctx);
+
+static void
+scpi_output_reset(struct scpi_parser_context* ctx);
+
+static int
+scpi_numeric_keyword(const char* str, size_t length, const char* keyword, size_t short_length);
+
+static void*
+scpi_default_allocate(void* opaque, size_t size)
+{
+	return malloc(size);
+}
+
+static void
+scpi_default_release(void* opaque, void* pointer)
+{
+	free(pointer);
+}
+
+/* The functions from which arenas obtain their blocks. */
+static scpi_allocate_t scpi_allocate = scpi_default_allocate;
+static scpi_release_t scpi_release = scpi_default_release;
+static void* scpi_allocator_opaque = NULL;
+
+void
+scpi_set_allocator(scpi_allocate_t allocate, scpi_release_t release, void* opaque)
+{
+	scpi_allocate = allocate != NULL ? allocate : scpi_default_allocate;
+	scpi_release = release != NULL ? release : scpi_default_release;
+	scpi_allocator_opaque = opaque;
+}
+
+/*
+ * A block of an arena.  The data follows the header, which is padded so
+ * that the data is aligned for any type.
+ */
+struct scpi_arena_block
+{
+	struct scpi_arena_block* next;
+	
+	union
+	{
+		long	l;
+		double	d;
+		void*	p;
+	} data[1];
+};
+
+#define SCPI_ARENA_HEADER_SIZE offsetof(struct scpi_arena_block, data)
+#define SCPI_ARENA_ALIGNMENT sizeof(((struct scpi_arena_block*)0)->data[0])
+
+static void
+scpi_arena_init(struct scpi_arena* arena)
+{
+	arena->blocks = NULL;
+	arena->used = 0;
+	arena->size = 0;
+	arena->generation = 0;
+}
+
+/*
+ * Allocate memory from an arena, taking a new block if the current one is
+ * full.  An object too large for a block is given a block of its own,
+ * which is placed behind the current one so that its space is not lost.
+ */
+static void*
+scpi_arena_allocate(struct scpi_arena* arena, size_t size)
+{
+	struct scpi_arena_block* block;
+	size_t block_size;
+	void* pointer;
+	
+	size = (size + SCPI_ARENA_ALIGNMENT-1) / SCPI_ARENA_ALIGNMENT * SCPI_ARENA_ALIGNMENT;
+	
+	if(arena->blocks != NULL && arena->size - arena->used >= size)
+	{
+		pointer = (char*)arena->blocks + SCPI_ARENA_HEADER_SIZE + arena->used;
+		arena->used += size;
+		return pointer;
+	}
+	
+	block_size = size > SCPI_ARENA_BLOCK_SIZE ? size : SCPI_ARENA_BLOCK_SIZE;
+	block = (struct scpi_arena_block*)scpi_allocate(scpi_allocator_opaque,
+													SCPI_ARENA_HEADER_SIZE + block_size);
+	if(block == NULL)
+	{
+		return NULL;
+	}
+	
+	if(block_size > SCPI_ARENA_BLOCK_SIZE && arena->blocks != NULL)
+	{
+		block->next = arena->blocks->next;
+		arena->blocks->next = block;
+	}
+	else
+	{
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->size = block_size;
+		arena->used = size;
+	}
+	
+	return (char*)block + SCPI_ARENA_HEADER_SIZE;
+}
+
+/*
+ * Release every block of an arena.
+ */
+static void
+scpi_arena_release(struct scpi_arena* arena)
+{
+	struct scpi_arena_block* block;
+	
+	while(arena->blocks != NULL)
+	{
+		block = arena->blocks;
+		arena->blocks = block->next;
+		scpi_release(scpi_allocator_opaque, block);
+	}
+	
+	scpi_arena_init(arena);
+}
+
+/*
+ * Empty the error queue.
+ */
+static void
+scpi_error_queue_reset(struct scpi_parser_context* ctx)
+{
+#if SCPI_ERROR_QUEUE_ATOMIC
+	size_t i;
+
+	for(i = 0; i < SCPI_ERROR_QUEUE_LENGTH; i++)
+	{
+		ctx->error_queue[i].sequence = i;
+		ctx->error_queue[i].overflow = 2*i;
+	}
+	ctx->error_queue_head = 0;
+	ctx->error_queue_tail = 0;
+#else
+	ctx->error_queue_start = 0;
+	ctx->error_queue_count = 0;
 #endif
+}
 
 static scpi_error_t
 system_error(struct scpi_parser_context* ctx, struct scpi_token* command)
 {
-	struct scpi_error* error = scpi_pop_error(ctx);
+	char response[SCPI_ERROR_LENGTH];
+	size_t length;
+
+	length = scpi_format_error(response, sizeof(response), scpi_pop_error(ctx));
+	scpi_write(ctx, response, length);
+
+	return SCPI_SUCCESS;
+}
+
+/*
+ * FORMat[:DATA] ASCii | INTeger[,16] | REAL[,32]
+ */
+static scpi_error_t
+format_data(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	struct scpi_parameter_iterator params;
+	struct scpi_token type;
+	struct scpi_token length;
+	struct scpi_numeric_fixed bits;
+	scpi_data_format_t format;
+	int32_t size;
+
+	scpi_parameter_iterator_init(&params, command->value, command->length);
+	if(!scpi_next_parameter(&params, &type))
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_MISSING_PARAMETER);
+		return SCPI_SUCCESS;
+	}
+
+	if(scpi_numeric_keyword(type.value, type.length, "ASCII", 3))
+	{
+		format = SCPI_DATA_ASCII;
+		size = 0;
+	}
+	else if(scpi_numeric_keyword(type.value, type.length, "INTEGER", 3))
+	{
+		format = SCPI_DATA_INTEGER;
+		size = 16;
+	}
+	else if(scpi_numeric_keyword(type.value, type.length, "REAL", 4))
+	{
+		format = SCPI_DATA_REAL;
+		size = 32;
+	}
+	else
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_ILLEGAL_PARAMETER);
+		return SCPI_SUCCESS;
+	}
+
+	/* The length of ASCii data is the number of digits, which is not fixed. */
+	if(scpi_next_parameter(&params, &length))
+	{
+		bits = scpi_parse_numeric_fixed(length.value, length.length, 0, size, size, size);
+		if(bits.status != SCPI_NUMERIC_SUCCESS || bits.unit_id != SCPI_UNIT_NONE)
+		{
+			scpi_queue_error(ctx, SCPI_ERROR_NUMERIC_DATA);
+			return SCPI_SUCCESS;
+		}
+		else if(format != SCPI_DATA_ASCII && bits.value != size)
+		{
+			scpi_queue_error(ctx, SCPI_ERROR_ILLEGAL_PARAMETER);
+			return SCPI_SUCCESS;
+		}
+	}
+
+	if(scpi_next_parameter(&params, &length))
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_PARAMETER_NOT_ALLOWED);
+		return SCPI_SUCCESS;
+	}
+
+	ctx->format_data = (unsigned char)format;
+	return SCPI_SUCCESS;
+}
+
+static scpi_error_t
+format_data_query(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	switch(ctx->format_data)
+	{
+		case SCPI_DATA_INTEGER:
+			scpi_write_string(ctx, "INT,16");
+			break;
+
+		case SCPI_DATA_REAL:
+			scpi_write_string(ctx, "REAL,32");
+			break;
+
+		default:
+			scpi_write_string(ctx, "ASC");
+			break;
+	}
+
+	return SCPI_SUCCESS;
+}
+
+/*
+ * FORMat:BORDer NORMal | SWAPped
+ */
+static scpi_error_t
+format_border(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	struct scpi_parameter_iterator params;
+	struct scpi_token order;
+	struct scpi_token extra;
+
+	scpi_parameter_iterator_init(&params, command->value, command->length);
+	if(!scpi_next_parameter(&params, &order))
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_MISSING_PARAMETER);
+	}
+	else if(scpi_next_parameter(&params, &extra))
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_PARAMETER_NOT_ALLOWED);
+	}
+	else if(scpi_numeric_keyword(order.value, order.length, "NORMAL", 4))
+	{
+		ctx->format_swapped = 0;
+	}
+	else if(scpi_numeric_keyword(order.value, order.length, "SWAPPED", 4))
+	{
+		ctx->format_swapped = 1;
+	}
+	else
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_ILLEGAL_PARAMETER);
+	}
+
+	return SCPI_SUCCESS;
+}
+
+static scpi_error_t
+format_border_query(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	scpi_write_string(ctx, ctx->format_swapped ? "SWAP" : "NORM");
+	return SCPI_SUCCESS;
+}
+
+/*
+ * *ESR?, which reads and clears the standard event status register.
+ */
+static scpi_error_t
+event_status_query(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	scpi_write_fixed(ctx, ctx->event_status, 0);
+	ctx->event_status = 0;
 	
-	Serial.print(error->id);
-        Serial.print(",\"");
-        Serial.write((const uint8_t*)error->description, error->length);
-	Serial.println("\"");
+	return SCPI_SUCCESS;
+}
 
-	scpi_free_tokens(command);
+/*
+ * *OPC, which sets the Operation Complete event once nothing is pending.
+ */
+static scpi_error_t
+operation_complete(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	if(ctx->operations_pending == 0)
+	{
+		ctx->event_status |= SCPI_EVENT_OPERATION_COMPLETE;
+	}
+	else
+	{
+		ctx->operation_complete_armed = 1;
+	}
+	
 	return SCPI_SUCCESS;
 }
 
-void
-scpi_init(struct scpi_parser_context* ctx)
+/*
+ * *OPC?, which responds with 1 once nothing is pending.
+ */
+static scpi_error_t
+operation_complete_query(struct scpi_parser_context* ctx, struct scpi_token* command)
 {
+	if(ctx->operations_pending == 0)
+	{
+		scpi_write_string(ctx, "1");
+	}
+	else
+	{
+		ctx->operation_wait = SCPI_WAIT_OPC_QUERY;
+	}
+	
+	return SCPI_SUCCESS;
+}
+
+/*
+ * *WAI, which holds back the following commands until nothing is pending.
+ */
+static scpi_error_t
+wait_to_continue(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	if(ctx->operations_pending != 0)
+	{
+		ctx->operation_wait = SCPI_WAIT_WAI;
+	}
+	
+	return SCPI_SUCCESS;
+}
+
+/*
+ * Allocate the root of a command tree from an arena, and register the
+ * SYSTem:ERRor and FORMat subtrees beneath it.
+ */
+static struct scpi_command*
+scpi_build_tree(struct scpi_arena* arena)
+{
+	struct scpi_command* root;
 	struct scpi_command* system;
 	struct scpi_command* error;
+	struct scpi_command* format;
+	
+	scpi_arena_init(arena);
 	
-	ctx->command_tree = (struct scpi_command*)malloc(sizeof(struct scpi_command));
+	root = (struct scpi_command*)scpi_arena_allocate(arena, sizeof(struct scpi_command));
 	
-	ctx->command_tree->long_name = NULL;
-	ctx->command_tree->long_name_length = 0;
+	root->long_name = NULL;
+	root->long_name_length = 0;
 	
-	ctx->command_tree->short_name = NULL;
-	ctx->command_tree->short_name_length = 0;
+	root->short_name = NULL;
+	root->short_name_length = 0;
 	
-	ctx->command_tree->callback = NULL;
-	ctx->command_tree->next = NULL;
-	ctx->command_tree->children = NULL;
+	root->callback = NULL;
+	root->block_callback = NULL;
+	root->user_data = NULL;
+	root->children_index = NULL;
+	root->next = NULL;
+	root->children = NULL;
+	root->arena = arena;
 	
 	system = scpi_register_command(
-				ctx->command_tree, SCPI_CL_CHILD, "SYSTEM", 6,
-												  "SYST", 4, NULL);
+				root, SCPI_CL_CHILD, "SYSTEM", 6,
+									 "SYST", 4, NULL);
 												  
 	error = scpi_register_command(
 				system, SCPI_CL_CHILD, "ERROR", 5,
@@ -82,14 +445,169 @@ scpi_init(struct scpi_parser_context* ctx)
 	scpi_register_command(
 				error, SCPI_CL_CHILD, "NEXT?", 5, "NEXT?", 5, system_error);
 	
-	ctx->error_queue_head = NULL;
-	ctx->error_queue_tail = NULL;
+	/* DATA is the default node of FORMat, and so may be left out. */
+	format = scpi_register_command(
+				root, SCPI_CL_CHILD, "FORMAT", 6,
+									 "FORM", 4, format_data);
+	
+	scpi_register_command(format, SCPI_CL_CHILD, "DATA", 4, "DATA", 4, format_data);
+	scpi_register_command(format, SCPI_CL_CHILD, "DATA?", 5, "DATA?", 5, format_data_query);
+	scpi_register_command(format, SCPI_CL_CHILD, "BORDER", 6, "BORD", 4, format_border);
+	scpi_register_command(format, SCPI_CL_CHILD, "BORDER?", 7, "BORD?", 5, format_border_query);
+	
+	scpi_register_command(root, SCPI_CL_SAMELEVEL, "*ESR?", 5, "*ESR?", 5, event_status_query);
+	scpi_register_command(root, SCPI_CL_SAMELEVEL, "*OPC", 4, "*OPC", 4, operation_complete);
+	scpi_register_command(root, SCPI_CL_SAMELEVEL, "*OPC?", 5, "*OPC?", 5,
+							operation_complete_query);
+	scpi_register_command(root, SCPI_CL_SAMELEVEL, "*WAI", 4, "*WAI", 4, wait_to_continue);
+	
+	return root;
+}
+
+/*
+ * Reset everything that belongs to the session of a context, rather than
+ * to its tree.
+ */
+static void
+scpi_session_reset(struct scpi_parser_context* ctx)
+{
+	ctx->output = NULL;
+	ctx->output_opaque = NULL;
+	ctx->format_data = SCPI_DATA_ASCII;
+	ctx->format_swapped = 0;
+	ctx->router = NULL;
+	
+	ctx->operations_pending = 0;
+	ctx->operation_wait = SCPI_WAIT_NONE;
+	ctx->operation_flush = 0;
+	ctx->operation_complete_armed = 0;
+	ctx->event_status = 0;
+	ctx->operation_position = NULL;
+	
+	scpi_error_queue_reset(ctx);
+	
+	scpi_feed_reset(ctx);
+	scpi_header_cache_reset(ctx);
+	scpi_output_reset(ctx);
+}
+
+void
+scpi_init(struct scpi_parser_context* ctx)
+{
+	ctx->command_tree = scpi_build_tree(&ctx->arena);
+	ctx->command_tree_in_flash = 0;
+	ctx->command_tree_shared = 0;
+	ctx->command_matcher = NULL;
+	
+	scpi_session_reset(ctx);
+}
+
+void
+scpi_destroy(struct scpi_parser_context* ctx)
+{
+	scpi_arena_release(&ctx->arena);
+	
+	ctx->command_tree = NULL;
+	scpi_error_queue_reset(ctx);
+}
+
+/*
+ * The SYSTem:ERRor subtree, for inclusion in constant command trees.
+ */
+SCPI_COMMAND(scpi_system_error_next_command, "NEXT?", "NEXT?", system_error, NULL, NULL);
+SCPI_COMMAND(scpi_system_error_query_command, "ERROR?", "ERR?", system_error, NULL, NULL);
+SCPI_COMMAND(scpi_system_error_command, "ERROR", "ERR", NULL,
+				&scpi_system_error_next_command, &scpi_system_error_query_command);
+SCPI_COMMAND(scpi_system_command, "SYSTEM", "SYST", NULL, &scpi_system_error_command, NULL);
+
+/*
+ * The FORMat subtree, which is followed by the SYSTem subtree.
+ */
+SCPI_COMMAND(scpi_format_border_query_command, "BORDER?", "BORD?", format_border_query,
+				NULL, NULL);
+SCPI_COMMAND(scpi_format_border_command, "BORDER", "BORD", format_border,
+				NULL, &scpi_format_border_query_command);
+SCPI_COMMAND(scpi_format_data_query_command, "DATA?", "DATA?", format_data_query,
+				NULL, &scpi_format_border_command);
+SCPI_COMMAND(scpi_format_data_command, "DATA", "DATA", format_data,
+				NULL, &scpi_format_data_query_command);
+SCPI_COMMAND(scpi_format_command, "FORMAT", "FORM", format_data,
+				&scpi_format_data_command, &scpi_system_command);
+
+/*
+ * The common commands for overlapped operations.
+ */
+SCPI_COMMAND(scpi_wai_command, "*WAI", "*WAI", wait_to_continue, NULL, NULL);
+SCPI_COMMAND(scpi_opc_query_command, "*OPC?", "*OPC?", operation_complete_query,
+				NULL, &scpi_wai_command);
+SCPI_COMMAND(scpi_opc_command, "*OPC", "*OPC", operation_complete,
+				NULL, &scpi_opc_query_command);
+SCPI_COMMAND(scpi_esr_query_command, "*ESR?", "*ESR?", event_status_query,
+				NULL, &scpi_opc_command);
+
+void
+scpi_init_const(struct scpi_parser_context* ctx, const struct scpi_command* command_tree)
+{
+	ctx->command_tree = (struct scpi_command*)command_tree;
+	ctx->command_tree_in_flash = 1;
+	ctx->command_tree_shared = 0;
+	ctx->command_matcher = NULL;
+	
+	scpi_arena_init(&ctx->arena);
+	
+	scpi_session_reset(ctx);
+}
+
+void
+scpi_tree_init(struct scpi_tree* tree)
+{
+	tree->command_tree = scpi_build_tree(&tree->arena);
+	tree->command_tree_in_flash = 0;
+	tree->command_matcher = NULL;
+}
+
+void
+scpi_tree_init_const(struct scpi_tree* tree, const struct scpi_command* command_tree)
+{
+	tree->command_tree = (struct scpi_command*)command_tree;
+	tree->command_tree_in_flash = 1;
+	tree->command_matcher = NULL;
+	
+	scpi_arena_init(&tree->arena);
+}
+
+void
+scpi_tree_set_command_matcher(struct scpi_tree* tree, scpi_command_matcher_t matcher)
+{
+	tree->command_matcher = matcher;
+}
+
+void
+scpi_tree_destroy(struct scpi_tree* tree)
+{
+	scpi_arena_release(&tree->arena);
+	
+	tree->command_tree = NULL;
+}
+
+void
+scpi_init_session(struct scpi_parser_context* ctx, const struct scpi_tree* tree)
+{
+	/* The context only refers to the tree, which it never writes. */
+	ctx->command_tree = tree->command_tree;
+	ctx->command_tree_in_flash = tree->command_tree_in_flash;
+	ctx->command_tree_shared = 1;
+	ctx->command_matcher = tree->command_matcher;
+	
+	scpi_arena_init(&ctx->arena);
+	
+	scpi_session_reset(ctx);
 }
 
 struct scpi_token*
 scpi_parse_string(const char* str, size_t length)
 {
-	int i;
+	size_t i;
 	
 	struct scpi_token* head;
 	struct scpi_token* tail;
@@ -169,576 +687,4441 @@ scpi_parse_string(const char* str, size_t length)
 	return head;
 }
 
-struct scpi_command*
-scpi_register_command(struct scpi_command* parent, scpi_command_location_t location,
-						const char* long_name,  size_t long_name_length,
-						const char* short_name, size_t short_name_length,
-						command_callback_t callback)
+/*
+ * As isspace in the C locale, but without the function call.
+ */
+static int
+scpi_isspace(char c)
 {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/*
+ * As isdigit, isupper and isalpha in the C locale.
+ */
+static int
+scpi_isdigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static int
+scpi_isupper(char c)
+{
+	return c >= 'A' && c <= 'Z';
+}
+
+static int
+scpi_isalpha(char c)
+{
+	return scpi_isupper(c) || (c >= 'a' && c <= 'z');
+}
+
+#ifdef SCPI_SIMD
+
+/*
+ * Compare sixteen bytes against four delimiters, returning a bitmask
+ * with one bit set for each matching byte.
+ */
+static unsigned int
+scpi_match_sse2(const char* str, char a, char b, char c, char d)
+{
+	__m128i chunk;
+	__m128i matches;
 	
-	struct scpi_command* current_command;
-	
-	if(location == SCPI_CL_CHILD)
-	{
-		current_command = parent->children;
-	}
-	else
-	{
-		current_command = parent;
-	}
-	
-	if(current_command == NULL)
+	chunk = _mm_loadu_si128((const __m128i*)str);
+	matches = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(a)),
+							 _mm_cmpeq_epi8(chunk, _mm_set1_epi8(b))),
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)),
+							 _mm_cmpeq_epi8(chunk, _mm_set1_epi8(d))));
+	
+	return (unsigned int)_mm_movemask_epi8(matches);
+}
+
+/*
+ * As scpi_match_sse2, but for thirty-two bytes.
+ */
+__attribute__((target("avx2")))
+static unsigned int
+scpi_match_avx2(const char* str, char a, char b, char c, char d)
+{
+	__m256i chunk;
+	__m256i matches;
+	
+	chunk = _mm256_loadu_si256((const __m256i*)str);
+	matches = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(a)),
+								_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(b))),
+				_mm256_or_si256(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c)),
+								_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(d))));
+	
+	return (unsigned int)_mm256_movemask_epi8(matches);
+}
+
+/*
+ * Find the delimiters amongst the first thirty-two bytes of a string,
+ * returning a bitmask with one bit set for each.
+ */
+static unsigned int
+scpi_match_block(const char* str, size_t length, char a, char b, char c, char d)
+{
+	size_t i;
+	unsigned int mask;
+	
+	/*
+	 * A remainder of sixteen bytes or more is covered by two overlapping
+	 * loads, the second ending at the end of str; bytes that are in both
+	 * simply set the same bit twice.
+	 */
+	if(length >= 16 && length < 32)
 	{
-		parent->children = (struct scpi_command*)malloc(sizeof(struct scpi_command));
-		current_command = parent->children;
+		return scpi_match_sse2(str, a, b, c, d)
+				| (scpi_match_sse2(str+length-16, a, b, c, d) << (length-16));
 	}
-	else
+	
+	/*
+	 * A shorter remainder is searched one byte at a time, which is quicker
+	 * than copying it and avoids reading past the end of str.
+	 */
+	if(length < 16)
 	{
-		while(current_command->next != NULL)
+		mask = 0;
+		for(i = 0; i < length; i++)
 		{
-			current_command = current_command->next;
+			if(str[i] == a || str[i] == b || str[i] == c || str[i] == d)
+			{
+				mask |= 1u << i;
+			}
 		}
 		
-		current_command->next = (struct scpi_command*)malloc(sizeof(struct scpi_command));
-		current_command = current_command->next;
+		return mask;
 	}
 	
-	current_command->next = NULL;
-	current_command->children = NULL;
-	
-	current_command->long_name = long_name;
-	current_command->long_name_length = long_name_length;
-	
-	current_command->short_name = short_name;
-	current_command->short_name_length = short_name_length;
-	
-	current_command->callback = callback;
+	if(__builtin_cpu_supports("avx2"))
+	{
+		return scpi_match_avx2(str, a, b, c, d);
+	}
 	
-	return current_command;
+	return scpi_match_sse2(str, a, b, c, d) | (scpi_match_sse2(str+16, a, b, c, d) << 16);
 }
 
-struct scpi_command*
-scpi_find_command(struct scpi_parser_context* ctx,
-					const struct scpi_token* parsed_string)
+#endif
+
+/*
+ * Find the first occurrence of any of a, b, c, or d in a string, returning
+ * length if there is none.
+ */
+static size_t
+scpi_scan(const char* str, size_t length, char a, char b, char c, char d)
 {
-	struct scpi_command* root;
-	const struct scpi_token* current_token;
-	struct scpi_command* current_command;
+	size_t i;
 	
-	root = ctx->command_tree;
-	current_token = parsed_string;
-	current_command = root;
-
+#ifdef SCPI_SIMD
+	unsigned int mask;
 	
-	while(current_token != NULL && current_token->type == 0)
+	for(i = 0; i < length; i += 32)
 	{
-	
-		int found_token = 0;
-		while(current_command != NULL)
+		mask = scpi_match_block(str+i, length-i, a, b, c, d);
+		if(mask != 0)
 		{
-			
-			if((current_token->length == current_command->long_name_length
-					&& !memcmp(current_token->value, current_command->long_name, current_token->length))
-				|| (current_token->length == current_command->short_name_length
-					&& !memcmp(current_token->value, current_command->short_name, current_token->length)))
-			{
-				/* We have found the token. */
-				current_token = current_token->next;
-				
-				if(current_token == NULL || current_token->type != 0)
-				{
-					return current_command;
-				}
-				else
-				{
-					found_token = 1;
-					current_command = current_command->children;
-					break;
-				}
-			}
-			else
-			{
-				current_command = current_command->next;
-			}
+			return i+__builtin_ctz(mask);
 		}
-		
-		if(!found_token)
+	}
+	
+	return length;
+#else
+	for(i = 0; i < length; i++)
+	{
+		if(str[i] == a || str[i] == b || str[i] == c || str[i] == d)
 		{
-			return NULL;
+			break;
 		}
 	}
 	
-	return NULL;
+	return i;
+#endif
 }
 
-scpi_error_t
-scpi_execute_command(struct scpi_parser_context* ctx, const char* command_string, size_t length)
+/*
+ * Find the delimiters in a string one after another.  The state between
+ * calls is held in *block and *mask, which must initially be zero.
+ *
+ * With SIMD, a bitmask of the delimiters in each thirty-two byte block is
+ * kept in *mask, and *block is the offset of the following block, so that
+ * closely-spaced delimiters do not cause the same bytes to be reread.
+ *
+ * Returns the position of the next delimiter, or length if there are none.
+ */
+static size_t
+scpi_next_delimiter(const char* str, size_t length, size_t* block, unsigned long* mask,
+						char a, char b, char c, char d)
 {
-	struct scpi_command* command;
-	struct scpi_token* parsed_command;
-	
-	parsed_command = scpi_parse_string(command_string, length);
+#ifdef SCPI_SIMD
+	size_t position;
 	
-	command = scpi_find_command(ctx, parsed_command);
-	if(command == NULL)
+	while(*mask == 0)
 	{
-		return SCPI_COMMAND_NOT_FOUND;
+		if(*block >= length)
+		{
+			return length;
+		}
+		
+		*mask = scpi_match_block(str+*block, length-*block, a, b, c, d);
+		*block += 32;
 	}
 	
-	if(command->callback == NULL)
+	position = *block-32+__builtin_ctzl(*mask);
+	*mask &= *mask-1;
+	
+	return position;
+#else
+	size_t position;
+	
+	if(*block >= length)
 	{
-		return SCPI_NO_CALLBACK;
+		return length;
 	}
 	
+	position = *block+scpi_scan(str+*block, length-*block, a, b, c, d);
+	*block = position+1;
 	
-	return command->callback(ctx, parsed_command);
+	return position;
+#endif
 }
 
-void
-scpi_free_some_tokens(struct scpi_token* start, struct scpi_token* end)
+scpi_error_t
+scpi_tokenize(const char* str, size_t length,
+				struct scpi_token_span* spans, size_t capacity, size_t* count)
 {
-	struct scpi_token* prev;
-	while(start != NULL && start != end)
+	size_t i;
+	size_t token_start;
+	size_t header_length;
+	size_t n;
+	size_t block;
+	unsigned long mask;
+	
+	n = 0;
+	token_start = 0;
+	
+	/*
+	 * Ignore trailing whitespace, such as a carriage return, when looking
+	 * for the end of the header.  It is left in the parameters, as it may
+	 * be part of a block, and is removed by scpi_next_parameter.
+	 */
+	header_length = length;
+	while(header_length > 0 && scpi_isspace(str[header_length-1]))
 	{
-		prev = start;
-		start = start->next;
-		
-		free((void*)prev);
+		header_length--;
 	}
-}
-
-void
-scpi_free_tokens(struct scpi_token* start)
-{
-	scpi_free_some_tokens(start, NULL);
-}
-
-struct scpi_numeric
-scpi_parse_numeric(const char* str, size_t length, float default_value, float min_value, float max_value)
-{
-	int i;
-	float mantissa;
-	int state;
-	int sign;
-	int point_position;
-	int exponent;
-	int exponent_sign;
-	long exponent_multiplier;
-	float value;
-	const char* unit_start;
-	const char* unit_end;
-	struct scpi_numeric retval;
 	
-	exponent = 0;
-	exponent_sign = 0;
-	point_position = 0;
-	sign = 0;
-	state = 0;
-	mantissa = 0;
-	exponent_multiplier = 1;
-	unit_start = NULL;
-	unit_end = NULL;
-
-	for(i = 0; i < length; i++)
+	while(token_start < header_length && scpi_isspace(str[token_start]))
 	{
-		if(state == 0)
-		{
-			/* Remove leading whitespace */			
-			if(isspace(str[i]))
-			{
-				continue;
-			}
-                        else if(length-i >= 7 && str[i]   == 'D' && str[i+1] == 'E' && str[i+2] == 'F'
-                                              && str[i+3] == 'A' && str[i+4] == 'U' && str[i+5] == 'L'
-                                              && str[i+6] == 'T')
-                        {
-                                /* The user has asked for the default value. */
-                                retval.value = default_value;
-                                retval.unit = NULL;
-                                retval.length = 0;
-                                
-                                return retval;
-                        }
-                        else if(length-i >= 3 && str[i] == 'M' && str[i+1] == 'A' && str[i+2] == 'X')
-                        {
-                                /* The user has asked for the maximum value. */
-                                retval.value = max_value;
-                                retval.unit = NULL;
-                                retval.length = 0;
-                                return retval;
-                        }
-                        else if(length-i >= 3 && str[i] == 'M' && str[i+1] == 'I' && str[i+2] == 'N')
-                        {
-                                /* The user has asked for the minimum value. */
-                                retval.value = min_value;
-                                retval.unit = NULL;
-                                retval.length = 0;
-                                return retval;
-                        }
-			else if(str[i] == '+' || str[i] == '-')
-			{
-				/* We have hit a +/- */
-				state = 1;
-			}
-			else if(isdigit(str[i]))
-			{
-				/* We have reached the number itself. */
-				state = 2;
-			}
-			else
-			{
-				state = -1;
-				continue;
-			}
-		}
-		
-		if(state == 1)
-		{
-			/* Set the sign. */
-			if(str[i] == '+')
-			{
-				sign = 0;
-			}
-			else
-			{
-				sign = 1;
-			}
-			
-			state = 2;
-			continue;
-		}
+		token_start++;
+	}
+	
+	block = token_start;
+	mask = 0;
+	while(1)
+	{
+		i = scpi_next_delimiter(str, header_length, &block, &mask, ':', ' ', '\t', '\t');
 		
-		if(state == 2 || state == 3)
+		if(n == capacity)
 		{
-			if(isdigit(str[i]))
-			{
-				/* Start accumulating digits. */
-				mantissa = (10*mantissa) + (float)(str[i] - 0x30);
-				
-				if(state == 3)
-				{
-					/* We are past the decimal point, so reposition it. */
-					point_position++;
-				}
-			}
-			else if(str[i] == '.')
-			{
-				state = 3;
-				continue;
-			}
-			else if(str[i] == 'e')
-			{
-				state = 4;
-				continue;
-			}
-			else
-			{
-				state = 6;
-			}
+			*count = n;
+			return SCPI_TOO_MANY_TOKENS;
 		}
 		
-		if(state == 4)
-		{
-			/* We are now looking at the exponent sign. */
-			if(str[i] == '+' || str[i] == '-')
-			{
-				if(str[i] == '-')
-				{
-					exponent_sign = 1;
-				}
-			}
-			else if(isdigit(str[i]))
-			{
-				state = 5;
-			}
-			else
-			{
-				state = -1;
-			}
-		}
+		spans[n].type = SCPI_TT_HEADER;
+		spans[n].offset = token_start;
+		spans[n].length = i-token_start;
+		n++;
 		
-		if(state == 5)
-		{
-			
-			if(isdigit(str[i]))
-			{
-				exponent = (exponent*10) + (int)(str[i] - 0x30);
-				continue;
-			}
-			else
-			{
-				state = 6;
-			}
-		}
+		token_start = i+1;
 		
-		if(state == 6)
+		if(i == header_length || str[i] != ':')
 		{
-		
-			/* Remove spaces between the number and its units. */
-			if(isspace(str[i]))
-			{
-				continue;
-			}
-			else
-			{
-				state = 7;
-			}
-		
+			break;
 		}
-		
-		if(state == 7)
+	}
+	
+	/* Everything after the header is left unsplit. */
+	while(token_start < length && scpi_isspace(str[token_start]))
+	{
+		token_start++;
+	}
+	
+	if(token_start < length)
+	{
+		if(n == capacity)
 		{
-			/* The unit itself---first the multiplier. */
-			switch(str[i])
-			{
-				case 'y':
-					exponent -= 24;
-                                        state = 8;
-                                        continue;
-					break;
-				case 'z':
-					exponent -= 21;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'a':
-					exponent -= 18;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'f':
-					exponent -= 15;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'p':
-					exponent -= 12;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'n':
-					exponent -= 9;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'u':
-					exponent -= 6;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'm':
-					exponent -= 3;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'c':
-					exponent -= 2;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'd':
-					exponent -= 1;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'D':
-					exponent += 1;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'C':
-					exponent += 2;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'k':
-					exponent += 3;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'M':
-					exponent += 6;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'G':
-					exponent += 9;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'T':
-					exponent += 12;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'P':
-					exponent += 15;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'E':
-					exponent += 18;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'Z':
-					exponent += 21;
-					state = 8;
-                                        continue;
-                                        break;
-				case 'Y':
-					exponent += 24;
-					state = 8;
-                                        continue;
-                                        break;
-				
-				default:
-				
-					if(isupper(str[i]))
-					{
-						state = 8;
-					}
-					else
-					{
-						state = -1;
-                                                continue;
-					}
-			}
-
+			*count = n;
+			return SCPI_TOO_MANY_TOKENS;
 		}
 		
-		if(state == 8)
-		{
-			/* The unit proper. */
-			if(isalpha(str[i]))
-			{
-				if(unit_start == NULL)
-				{
-					unit_start = str+i;
-				}
-				state = 9;
-			}
-			else
-			{
-                                if(unit_start != NULL)
-                                {
-				        unit_end = str+i;
-                                }
-                                else
-                                {
-                                        unit_end = NULL;
-                                }
-			
-				state = -1;
-			}
-		}
+		spans[n].type = SCPI_TT_PARAMETERS;
+		spans[n].offset = token_start;
+		spans[n].length = length-token_start;
+		n++;
 	}
+	
+	*count = n;
+	return SCPI_SUCCESS;
+}
 
-        if(unit_start != NULL && unit_end == NULL)
-        {
-          unit_end = str+length-1;
-        }
+/*
+ * Check whether str starts with an arbitrary block parameter, i.e.
+ * #<n><length><data> or #0<data>, finding the position and length of the
+ * data if so.  An indefinite-length block runs to the end of the string.
+ *
+ * Returns zero if there is no complete block at the start of str.
+ */
+static int
+scpi_parse_block(const char* str, size_t length, size_t* data_start, size_t* data_length)
+{
+	size_t digits;
+	size_t i;
+	size_t n;
 	
-	value = (float)mantissa;
+	if(length < 2 || str[0] != '#' || str[1] < '0' || str[1] > '9')
+	{
+		return 0;
+	}
 	
-	if(exponent_sign != 0)
+	digits = str[1] - '0';
+	if(length < 2+digits)
 	{
-		exponent = -exponent;
+		return 0;
 	}
 	
-	exponent -= point_position;
-	if(exponent > 0)
+	n = 0;
+	for(i = 2; i < 2+digits; i++)
 	{
-		for(i = 0; i < exponent; i++)
+		if(str[i] < '0' || str[i] > '9')
 		{
-			exponent_multiplier *= 10;
+			return 0;
 		}
 		
-		value *= exponent_multiplier;
-	}
-	else
-	{
-		for(i = exponent; i < 0; i++)
+		n = 10*n + (str[i] - '0');
+		
+		if(n > length)
 		{
-			exponent_multiplier *= 10;
+			return 0;
 		}
-		
-		value /= exponent_multiplier;
-	}
-	
-	if(sign != 0)
-	{
-		value = -value;
 	}
 	
-	retval.value  = value;
-	retval.unit   = unit_start;
-	
-	if(unit_start == NULL)
+	if(digits == 0)
 	{
-		retval.length = 0;
+		n = length-2;
 	}
-	else
+	else if(n > length-i)
 	{
-		retval.length = unit_end - unit_start + 1;
+		return 0;
 	}
 	
-	
-	return retval;
+	*data_start = i;
+	*data_length = n;
+	return 1;
 }
 
 void
-scpi_queue_error(struct scpi_parser_context* ctx, struct scpi_error error)
+scpi_parameter_iterator_init(struct scpi_parameter_iterator* iterator,
+								const char* str, size_t length)
 {
-	struct scpi_error* new_error;
-	
-	new_error = (struct scpi_error*)malloc(sizeof(struct scpi_error));
-	new_error->id = error.id;
-	new_error->description = error.description;
-	new_error->length = error.length;
-	
-	new_error->next = NULL;
+	iterator->str = str;
+	iterator->length = length;
+	iterator->position = 0;
+	iterator->block = 0;
+	iterator->mask = 0;
+}
+
+int
+scpi_next_parameter(struct scpi_parameter_iterator* iterator,
+						struct scpi_token* parameter)
+{
+	size_t start;
+	size_t end;
+	size_t data_start;
+	size_t data_length;
+	size_t i;
 	
-	if(ctx->error_queue_head != NULL)
+	start = iterator->position;
+	if(start >= iterator->length)
 	{
-		ctx->error_queue_tail->next = new_error;
+		return 0;
 	}
-	else
+	
+	while(start < iterator->length && scpi_isspace(iterator->str[start]))
 	{
-		ctx->error_queue_head = new_error;
+		start++;
 	}
 	
-	ctx->error_queue_tail = new_error;
-}
-
-struct scpi_error*
-scpi_pop_error(struct scpi_parser_context* ctx)
-{
-	if(ctx->error_queue_head == NULL)
+	if(scpi_parse_block(iterator->str+start, iterator->length-start, &data_start, &data_length))
 	{
-		struct scpi_error* success;
+		/* Commas within the block must not be mistaken for separators. */
+		iterator->block = start+data_start+data_length;
+		iterator->mask = 0;
 		
-		success = (struct scpi_error*)malloc(sizeof(struct scpi_error));
-		success->id = 0;
-		success->description = "No error";
-		success->length = 8;
+		end = scpi_next_delimiter(iterator->str, iterator->length,
+									&iterator->block, &iterator->mask, ',', ',', ',', ',');
 		
-		return success;
+		/* Only whitespace may follow the block in its parameter. */
+		for(i = start+data_start+data_length; i < end && scpi_isspace(iterator->str[i]); i++);
+		
+		if(i == end)
+		{
+			iterator->position = end+1;
+			
+			parameter->type = SCPI_TT_BLOCK;
+			parameter->value = iterator->str+start+data_start;
+			parameter->length = data_length;
+			parameter->next = NULL;
+			
+			return 1;
+		}
 	}
 	else
 	{
-		struct scpi_error* retval;
-
-		retval = ctx->error_queue_head;
-		ctx->error_queue_head = retval->next;
-		
-		if(ctx->error_queue_head == NULL)
-{
-			ctx->error_queue_tail = NULL;
-		}
-		
-		return retval;
+		end = scpi_next_delimiter(iterator->str, iterator->length,
+									&iterator->block, &iterator->mask, ',', ',', ',', ',');
 	}
+	
+	/* Skip past the comma, so that the next call starts at the next value. */
+	iterator->position = end+1;
+	
+	while(end > start && scpi_isspace(iterator->str[end-1]))
+	{
+		end--;
+	}
+	
+	parameter->type = SCPI_TT_PARAMETERS;
+	parameter->value = iterator->str+start;
+	parameter->length = end-start;
+	parameter->next = NULL;
+	
+	return 1;
+}
+
+/*
+ * Convert a lower-case letter to upper case, leaving anything else alone.
+ */
+static char
+scpi_fold_char(char c)
+{
+	if(c >= 'a' && c <= 'z')
+	{
+		return c - ('a'-'A');
+	}
+	
+	return c;
+}
+
+/*
+ * Convert the lower-case letters in a word to upper case, a byte at a time
+ * in parallel.  Adding 0x80-'a' to the low seven bits of a byte sets its
+ * top bit if it is at least 'a', and similarly for 'z', so the lower-case
+ * letters are found without any carries between bytes.
+ */
+static unsigned long
+scpi_fold_word(unsigned long word)
+{
+	const unsigned long ones = ~0UL / 255;
+	const unsigned long high = ones * 0x80;
+	unsigned long low;
+	unsigned long lower;
+	
+	low = word & ~high;
+	lower = (low + ones*(0x80-'a')) & ~(low + ones*(0x80-'z'-1)) & ~word & high;
+	
+	return word ^ (lower >> 2);
+}
+
+/*
+ * Compare a mnemonic against a name that is already in upper case,
+ * ignoring the case of the mnemonic.  The bytes are compared a word at a
+ * time, and a partial word at the end is handled by comparing the last
+ * whole word again, overlapping the one before it, rather than reading
+ * past the end of the mnemonic.
+ */
+static int
+scpi_mnemonic_equal(const char* name, const char* folded, size_t length)
+{
+	unsigned long a;
+	unsigned long b;
+	size_t i;
+	
+	if(length >= sizeof(unsigned long))
+	{
+		for(i = 0; i+sizeof(unsigned long) < length; i += sizeof(unsigned long))
+		{
+			memcpy(&a, name+i, sizeof(unsigned long));
+			memcpy(&b, folded+i, sizeof(unsigned long));
+			if(scpi_fold_word(a) != b)
+			{
+				return 0;
+			}
+		}
+		
+		memcpy(&a, name+length-sizeof(unsigned long), sizeof(unsigned long));
+		memcpy(&b, folded+length-sizeof(unsigned long), sizeof(unsigned long));
+		return scpi_fold_word(a) == b;
+	}
+	
+	if(length >= 4)
+	{
+		/* Compare the first and last four bytes, which may overlap. */
+		a = 0;
+		b = 0;
+		memcpy(&a, name, 4);
+		memcpy(&b, folded, 4);
+		if(scpi_fold_word(a) != b)
+		{
+			return 0;
+		}
+		
+		memcpy(&a, name+length-4, 4);
+		memcpy(&b, folded+length-4, 4);
+		return scpi_fold_word(a) == b;
+	}
+	
+	for(i = 0; i < length; i++)
+	{
+		if(scpi_fold_char(name[i]) != folded[i])
+		{
+			return 0;
+		}
+	}
+	
+	return 1;
+}
+
+/*
+ * Return a name in upper case, so that mnemonics can be compared against
+ * it without folding both sides.  A name already in upper case is used
+ * as it is; otherwise an upper-case copy is made in the arena.
+ */
+static const char*
+scpi_fold_name(struct scpi_arena* arena, const char* name, size_t length)
+{
+	char* folded;
+	size_t i;
+	
+	for(i = 0; i < length && scpi_fold_char(name[i]) == name[i]; i++)
+	{
+	}
+	
+	if(i == length)
+	{
+		return name;
+	}
+	
+	folded = (char*)scpi_arena_allocate(arena, length);
+	if(folded == NULL)
+	{
+		return name;
+	}
+	
+	for(i = 0; i < length; i++)
+	{
+		folded[i] = scpi_fold_char(name[i]);
+	}
+	
+	return folded;
+}
+
+struct scpi_command*
+scpi_register_command(struct scpi_command* parent, scpi_command_location_t location,
+						const char* long_name,  size_t long_name_length,
+						const char* short_name, size_t short_name_length,
+						command_callback_t callback)
+{
+	
+	struct scpi_command* current_command;
+	struct scpi_command* new_command;
+	
+	new_command = (struct scpi_command*)scpi_arena_allocate(parent->arena,
+															sizeof(struct scpi_command));
+	if(new_command == NULL)
+	{
+		return NULL;
+	}
+	
+	if(location == SCPI_CL_CHILD)
+	{
+		current_command = parent->children;
+	}
+	else
+	{
+		current_command = parent;
+	}
+	
+	if(current_command == NULL)
+	{
+		parent->children = new_command;
+	}
+	else
+	{
+		while(current_command->next != NULL)
+		{
+			current_command = current_command->next;
+		}
+		
+		current_command->next = new_command;
+	}
+	
+	current_command = new_command;
+	
+	current_command->next = NULL;
+	current_command->children = NULL;
+	current_command->arena = parent->arena;
+	
+	current_command->long_name = scpi_fold_name(parent->arena, long_name, long_name_length);
+	current_command->long_name_length = long_name_length;
+	
+	current_command->short_name = scpi_fold_name(parent->arena, short_name, short_name_length);
+	current_command->short_name_length = short_name_length;
+	
+	current_command->callback = callback;
+	current_command->block_callback = NULL;
+	current_command->user_data = NULL;
+	current_command->children_index = NULL;
+	
+	parent->arena->generation++;
+	
+	return current_command;
+}
+
+void
+scpi_set_block_callback(struct scpi_command* command, block_callback_t callback)
+{
+	command->block_callback = callback;
+}
+
+void
+scpi_set_user_data(struct scpi_command* command, void* user_data)
+{
+	command->user_data = user_data;
+}
+
+/*
+ * Read the fields of a command.  On AVR, a constant command tree is kept in
+ * program memory, which can only be read with the pgm_read_* functions.
+ */
+static struct scpi_command*
+scpi_command_next(struct scpi_parser_context* ctx, const struct scpi_command* command)
+{
+#ifdef __AVR__
+	if(ctx->command_tree_in_flash)
+	{
+		return (struct scpi_command*)pgm_read_word(&command->next);
+	}
+#endif
+	return command->next;
+}
+
+static struct scpi_command*
+scpi_command_children(struct scpi_parser_context* ctx, const struct scpi_command* command)
+{
+#ifdef __AVR__
+	if(ctx->command_tree_in_flash)
+	{
+		return (struct scpi_command*)pgm_read_word(&command->children);
+	}
+#endif
+	return command->children;
+}
+
+static command_callback_t
+scpi_command_callback(struct scpi_parser_context* ctx, const struct scpi_command* command)
+{
+#ifdef __AVR__
+	if(ctx->command_tree_in_flash)
+	{
+		return (command_callback_t)pgm_read_word(&command->callback);
+	}
+#endif
+	return command->callback;
+}
+
+static block_callback_t
+scpi_command_block_callback(struct scpi_parser_context* ctx, const struct scpi_command* command)
+{
+#ifdef __AVR__
+	if(ctx->command_tree_in_flash)
+	{
+		return (block_callback_t)pgm_read_word(&command->block_callback);
+	}
+#endif
+	return command->block_callback;
+}
+
+static void*
+scpi_command_user_data(struct scpi_parser_context* ctx, const struct scpi_command* command)
+{
+#ifdef __AVR__
+	if(ctx->command_tree_in_flash)
+	{
+		return (void*)pgm_read_word(&command->user_data);
+	}
+#endif
+	return command->user_data;
+}
+
+/*
+ * Read one byte of a command's name.
+ */
+static char
+scpi_name_char(struct scpi_parser_context* ctx, const char* command_name, size_t i)
+{
+#ifdef __AVR__
+	if(ctx->command_tree_in_flash)
+	{
+		return pgm_read_byte(command_name+i);
+	}
+#endif
+	return command_name[i];
+}
+
+/*
+ * Compare the start of a mnemonic against the start of a command's name.
+ */
+static int
+scpi_name_equal(struct scpi_parser_context* ctx, const char* name,
+				const char* command_name, size_t length)
+{
+#ifdef __AVR__
+	if(ctx->command_tree_in_flash)
+	{
+		return !strncasecmp_P(name, command_name, length);
+	}
+#endif
+	return scpi_mnemonic_equal(name, command_name, length);
+}
+
+/*
+ * Compare a mnemonic against one of the names of a command, ignoring case.
+ * If the name ends in a numeric suffix, then the number given in the
+ * mnemonic is stored in *suffix.
+ */
+static int
+scpi_name_matches(struct scpi_parser_context* ctx, const char* name, size_t length,
+					const char* const* command_name_field,
+					const size_t* command_name_length_field, unsigned long* suffix)
+{
+	const char* command_name;
+	size_t command_name_length;
+	size_t prefix;
+	size_t tail;
+	size_t i;
+	unsigned long value;
+	
+#ifdef __AVR__
+	if(ctx->command_tree_in_flash)
+	{
+		command_name = (const char*)pgm_read_word(command_name_field);
+		command_name_length = pgm_read_word(command_name_length_field);
+	}
+	else
+#endif
+	{
+		command_name = *command_name_field;
+		command_name_length = *command_name_length_field;
+	}
+	
+	if(length == command_name_length && scpi_name_equal(ctx, name, command_name, length))
+	{
+		return 1;
+	}
+	
+	/* Otherwise, look for a suffix, #, that may be followed by a question mark. */
+	if(command_name_length == 0)
+	{
+		return 0;
+	}
+	
+	tail = scpi_name_char(ctx, command_name, command_name_length-1) == '?';
+	if(command_name_length < tail+1
+		|| scpi_name_char(ctx, command_name, command_name_length-tail-1) != '#')
+	{
+		return 0;
+	}
+	
+	prefix = command_name_length-tail-1;
+	if(length < prefix+tail || (tail && name[length-1] != '?')
+		|| !scpi_name_equal(ctx, name, command_name, prefix))
+	{
+		return 0;
+	}
+	
+	/* The suffix is at most nine digits, so that it cannot overflow. */
+	if(length-tail-prefix > 9)
+	{
+		return 0;
+	}
+	
+	value = 1;
+	if(length-tail > prefix)
+	{
+		value = 0;
+		for(i = prefix; i < length-tail; i++)
+		{
+			if(name[i] < '0' || name[i] > '9')
+			{
+				return 0;
+			}
+			
+			value = value*10 + (name[i]-'0');
+		}
+	}
+	
+	*suffix = value;
+	return 1;
+}
+
+/*
+ * Compare a mnemonic against both of the names of a command.
+ */
+static int
+scpi_command_matches(struct scpi_parser_context* ctx, const struct scpi_command* command,
+						const char* name, size_t length, unsigned long* suffix)
+{
+	return scpi_name_matches(ctx, name, length, &command->long_name,
+								&command->long_name_length, suffix)
+		|| scpi_name_matches(ctx, name, length, &command->short_name,
+								&command->short_name_length, suffix);
+}
+
+/*
+ * Search a list of sibling commands for one matching a mnemonic.
+ */
+static struct scpi_command*
+scpi_match_sibling(struct scpi_parser_context* ctx, struct scpi_command* current_command,
+					const char* name, size_t length, unsigned long* suffix)
+{
+	while(current_command != NULL)
+	{
+		if(scpi_command_matches(ctx, current_command, name, length, suffix))
+		{
+			return current_command;
+		}
+		
+		current_command = scpi_command_next(ctx, current_command);
+	}
+	
+	return NULL;
+}
+
+/*
+ * Hash a mnemonic for a command index (FNV-1a).  A hash may be built up
+ * from several pieces by passing the result of one call to the next,
+ * starting from SCPI_HASH_BASIS.
+ */
+#define SCPI_HASH_BASIS 2166136261UL
+
+static unsigned long
+scpi_hash_update(unsigned long hash, const char* name, size_t length)
+{
+	size_t i;
+	
+	for(i = 0; i < length; i++)
+	{
+		hash = (hash ^ (unsigned char)scpi_fold_char(name[i])) * 16777619UL;
+	}
+	
+	return hash;
+}
+
+static size_t
+scpi_hash_mnemonic(const char* name, size_t length)
+{
+	return (size_t)scpi_hash_update(SCPI_HASH_BASIS, name, length);
+}
+
+/*
+ * Hash a mnemonic as though its numeric suffix, if any, were written as #,
+ * so that VOLT2? has the same hash as the command name VOLT#?.
+ */
+static size_t
+scpi_hash_suffixed(const char* name, size_t length)
+{
+	size_t end;
+	size_t digits;
+	unsigned long hash;
+	
+	end = length;
+	if(end > 0 && name[end-1] == '?')
+	{
+		end--;
+	}
+	
+	for(digits = end; digits > 0 && name[digits-1] >= '0' && name[digits-1] <= '9'; digits--);
+	
+	hash = scpi_hash_update(SCPI_HASH_BASIS, name, digits);
+	hash = scpi_hash_update(hash, "#", 1);
+	hash = scpi_hash_update(hash, name+end, length-end);
+	
+	return (size_t)hash;
+}
+
+/*
+ * Add a command to an index under one of its names.
+ */
+static void
+scpi_index_insert(struct scpi_command_index* index, struct scpi_command* command,
+					const char* name, size_t length)
+{
+	size_t slot;
+	
+	slot = scpi_hash_mnemonic(name, length) & index->mask;
+	while(index->slots[slot] != NULL)
+	{
+		slot = (slot+1) & index->mask;
+	}
+	
+	index->slots[slot] = command;
+}
+
+/*
+ * Build the index of a command's children, and those of its descendants.
+ */
+static void
+scpi_index_children(struct scpi_command* parent)
+{
+	struct scpi_command* child;
+	struct scpi_command_index* index;
+	size_t count;
+	size_t size;
+	
+	parent->children_index = NULL;
+	
+	count = 0;
+	for(child = parent->children; child != NULL; child = child->next)
+	{
+		scpi_index_children(child);
+		count++;
+	}
+	
+	if(count < SCPI_INDEX_MIN_SIBLINGS)
+	{
+		return;
+	}
+	
+	/* Each command takes two slots; keep the table at most half full. */
+	size = 1;
+	while(size < 4*count)
+	{
+		size *= 2;
+	}
+	
+	index = (struct scpi_command_index*)scpi_arena_allocate(parent->arena,
+								sizeof(struct scpi_command_index) + size*sizeof(struct scpi_command*));
+	if(index == NULL)
+	{
+		return;
+	}
+	
+	index->mask = size-1;
+	index->slots = (struct scpi_command**)(index+1);
+	memset(index->slots, 0, size*sizeof(struct scpi_command*));
+	
+	for(child = parent->children; child != NULL; child = child->next)
+	{
+		scpi_index_insert(index, child, child->long_name, child->long_name_length);
+		scpi_index_insert(index, child, child->short_name, child->short_name_length);
+		index->last = child;
+	}
+	
+	parent->children_index = index;
+}
+
+void
+scpi_finalize_tree(struct scpi_parser_context* ctx)
+{
+	if(!ctx->command_tree_in_flash && !ctx->command_tree_shared)
+	{
+		scpi_index_children(ctx->command_tree);
+	}
+}
+
+void
+scpi_tree_finalize(struct scpi_tree* tree)
+{
+	if(!tree->command_tree_in_flash)
+	{
+		scpi_index_children(tree->command_tree);
+	}
+}
+
+void
+scpi_set_command_matcher(struct scpi_parser_context* ctx, scpi_command_matcher_t matcher)
+{
+	ctx->command_matcher = matcher;
+	scpi_header_cache_reset(ctx);
+}
+
+/*
+ * Search the children of a command for one matching a mnemonic, using
+ * the context's matcher or the index if there is one.  The common
+ * commands are searched if parent is NULL.
+ */
+static struct scpi_command*
+scpi_match_child(struct scpi_parser_context* ctx, struct scpi_command* parent,
+					const char* name, size_t length, unsigned long* suffix)
+{
+	struct scpi_command_index* index;
+	struct scpi_command* candidate;
+	const struct scpi_command* command;
+	size_t slot;
+	size_t attempt;
+	
+	if(ctx->command_matcher != NULL
+		&& ctx->command_matcher(parent, name, length, &command, suffix))
+	{
+		return (struct scpi_command*)command;
+	}
+	
+	if(parent == NULL)
+	{
+		/* Common commands sit beside the root. */
+		return scpi_match_sibling(ctx, ctx->command_tree, name, length, suffix);
+	}
+	
+	if(ctx->command_tree_in_flash || parent->children_index == NULL)
+	{
+		return scpi_match_sibling(ctx, scpi_command_children(ctx, parent), name, length, suffix);
+	}
+	
+	/* Try the mnemonic as it is, and then as a command with a numeric suffix. */
+	index = parent->children_index;
+	for(attempt = 0; attempt < 2; attempt++)
+	{
+		if(attempt == 0)
+		{
+			slot = scpi_hash_mnemonic(name, length) & index->mask;
+		}
+		else
+		{
+			slot = scpi_hash_suffixed(name, length) & index->mask;
+		}
+		
+		while((candidate = index->slots[slot]) != NULL)
+		{
+			if(scpi_command_matches(ctx, candidate, name, length, suffix))
+			{
+				return candidate;
+			}
+			
+			slot = (slot+1) & index->mask;
+		}
+	}
+	
+	/* Commands registered since the index was built follow the last one. */
+	return scpi_match_sibling(ctx, index->last->next, name, length, suffix);
+}
+
+/*
+ * Resolve one mnemonic of a header.
+ *
+ * The command found so far is held in *command, which is NULL before the
+ * first mnemonic.  The node beneath which it was found is held in *parent,
+ * or NULL for a common command, which does not move the tree position.
+ * If the mnemonic has a numeric suffix, then it is stored in *suffix.
+ *
+ * Returns zero if the mnemonic could not be found.
+ */
+static int
+scpi_resolve_mnemonic(struct scpi_parser_context* ctx, struct scpi_command* position,
+						struct scpi_command** parent, struct scpi_command** command,
+						const char* name, size_t length, unsigned long* suffix)
+{
+	if(*command == NULL)
+	{
+		if(length == 0)
+		{
+			/* A leading colon returns to the root of the tree. */
+			*parent = ctx->command_tree;
+			*command = ctx->command_tree;
+			return 1;
+		}
+		else if(name[0] == '*')
+		{
+			*parent = NULL;
+			*command = scpi_match_child(ctx, NULL, name, length, suffix);
+			return *command != NULL;
+		}
+		
+		/* Anything else is relative to the current tree position. */
+		*parent = position;
+	}
+	else
+	{
+		*parent = *command;
+	}
+	
+	*command = scpi_match_child(ctx, *parent, name, length, suffix);
+	return *command != NULL;
+}
+
+struct scpi_command*
+scpi_find_command(struct scpi_parser_context* ctx,
+					const struct scpi_token* parsed_string)
+{
+	const struct scpi_token* current_token;
+	struct scpi_command* parent;
+	struct scpi_command* current_command;
+	unsigned long suffix;
+	
+	current_command = NULL;
+	
+	for(current_token = parsed_string;
+		current_token != NULL && current_token->type == SCPI_TT_HEADER;
+		current_token = current_token->next)
+	{
+		if(!scpi_resolve_mnemonic(ctx, ctx->command_tree, &parent, &current_command,
+									current_token->value, current_token->length, &suffix))
+		{
+			return NULL;
+		}
+	}
+	
+	if(current_command == ctx->command_tree)
+	{
+		return NULL;
+	}
+	
+	return current_command;
+}
+
+/*
+ * As scpi_find_command, but for tokens produced by scpi_tokenize, and
+ * resolving relative headers against *position.  On success, *position
+ * is moved to the level of the command found, and *suffix is set to the
+ * last numeric suffix in the header, or 1 if there is none.
+ */
+static struct scpi_command*
+scpi_find_command_spans(struct scpi_parser_context* ctx, struct scpi_command** position,
+							const char* str, const struct scpi_token_span* spans, size_t count,
+							unsigned long* suffix)
+{
+	size_t i;
+	struct scpi_command* parent;
+	struct scpi_command* current_command;
+	
+	current_command = NULL;
+	*suffix = 1;
+	
+	for(i = 0; i < count && spans[i].type == SCPI_TT_HEADER; i++)
+	{
+		if(!scpi_resolve_mnemonic(ctx, *position, &parent, &current_command,
+									str+spans[i].offset, spans[i].length, suffix))
+		{
+			return NULL;
+		}
+	}
+	
+	if(current_command == NULL || current_command == ctx->command_tree)
+	{
+		return NULL;
+	}
+	
+	if(parent != NULL)
+	{
+		*position = parent;
+	}
+	
+	return current_command;
+}
+
+#if SCPI_HEADER_CACHE_SIZE > 0
+/*
+ * Find the generation of the arena that holds a context's command tree.
+ * A constant tree has no arena, and never changes.
+ */
+static unsigned long
+scpi_tree_generation(const struct scpi_parser_context* ctx)
+{
+	if(ctx->command_tree_in_flash || ctx->command_tree == NULL)
+	{
+		return 0;
+	}
+	
+	return ctx->command_tree->arena->generation;
+}
+#endif
+
+/*
+ * Forget all of the headers in the cache.
+ */
+static void
+scpi_header_cache_reset(struct scpi_parser_context* ctx)
+{
+#if SCPI_HEADER_CACHE_SIZE > 0
+	size_t i;
+	
+	for(i = 0; i < SCPI_HEADER_CACHE_SIZE; i++)
+	{
+		ctx->header_cache[i].command = NULL;
+	}
+	
+	ctx->header_cache_next = 0;
+	ctx->header_cache_generation = scpi_tree_generation(ctx);
+#endif
+	ctx->header_cache_hits = 0;
+	ctx->header_cache_misses = 0;
+}
+
+/*
+ * Look up a header in the cache.  On success, the command is returned and
+ * *position is moved as scpi_find_command_spans would move it.
+ */
+static struct scpi_command*
+scpi_header_cache_find(struct scpi_parser_context* ctx, struct scpi_command** position,
+						const char* header, size_t length, size_t hash, unsigned long* suffix)
+{
+#if SCPI_HEADER_CACHE_SIZE > 0
+	struct scpi_header_cache_entry* entry;
+	size_t i;
+	
+	if(ctx->header_cache_generation != scpi_tree_generation(ctx))
+	{
+		for(i = 0; i < SCPI_HEADER_CACHE_SIZE; i++)
+		{
+			ctx->header_cache[i].command = NULL;
+		}
+		
+		ctx->header_cache_generation = scpi_tree_generation(ctx);
+	}
+	
+	for(i = 0; i < SCPI_HEADER_CACHE_SIZE; i++)
+	{
+		entry = &ctx->header_cache[i];
+		if(entry->command != NULL && entry->hash == hash && entry->length == length
+			&& entry->position == *position && !memcmp(entry->header, header, length))
+		{
+			*position = entry->new_position;
+			*suffix = entry->suffix;
+			ctx->header_cache_hits++;
+			return entry->command;
+		}
+	}
+#endif
+	
+	ctx->header_cache_misses++;
+	return NULL;
+}
+
+/*
+ * Remember the command that a header resolved to from a tree position,
+ * and the position that it moved to, replacing the oldest entry.
+ */
+static void
+scpi_header_cache_insert(struct scpi_parser_context* ctx, struct scpi_command* position,
+							const char* header, size_t length, size_t hash,
+							struct scpi_command* command, struct scpi_command* new_position,
+							unsigned long suffix)
+{
+#if SCPI_HEADER_CACHE_SIZE > 0
+	struct scpi_header_cache_entry* entry;
+	
+	if(length > SCPI_HEADER_CACHE_LENGTH)
+	{
+		return;
+	}
+	
+	entry = &ctx->header_cache[ctx->header_cache_next];
+	ctx->header_cache_next = (ctx->header_cache_next+1) % SCPI_HEADER_CACHE_SIZE;
+	
+	entry->hash = hash;
+	entry->length = length;
+	memcpy(entry->header, header, length);
+	
+	entry->position = position;
+	entry->command = command;
+	entry->new_position = new_position;
+	entry->suffix = suffix;
+#endif
+}
+
+/*
+ * Check that every parameter in a list that starts as a block, with # and
+ * a digit, is a complete block followed by nothing but whitespace.
+ */
+static int
+scpi_check_blocks(const char* parameters, size_t length)
+{
+	struct scpi_parameter_iterator params;
+	struct scpi_token arg;
+	
+	if(length == 0 || memchr(parameters, '#', length) == NULL)
+	{
+		return 1;
+	}
+	
+	scpi_parameter_iterator_init(&params, parameters, length);
+	while(scpi_next_parameter(&params, &arg))
+	{
+		if(arg.type != SCPI_TT_BLOCK && arg.length >= 2 && arg.value[0] == '#'
+			&& scpi_isdigit(arg.value[1]))
+		{
+			return 0;
+		}
+	}
+	
+	return 1;
+}
+
+/*
+ * Call a command's callback with the given numeric suffix and parameter list.
+ */
+static scpi_error_t
+scpi_dispatch(struct scpi_parser_context* ctx, struct scpi_command* command,
+				unsigned long suffix, const char* parameters, size_t length)
+{
+	struct scpi_token token;
+	command_callback_t callback;
+	scpi_error_t error;
+	
+	if(command == NULL)
+	{
+		return SCPI_COMMAND_NOT_FOUND;
+	}
+	
+	callback = scpi_command_callback(ctx, command);
+	if(callback == NULL)
+	{
+		return SCPI_NO_CALLBACK;
+	}
+	
+	/* The callback is not given a block that it would only misread. */
+	if(!scpi_check_blocks(parameters, length))
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_BLOCK_DATA);
+		return SCPI_SUCCESS;
+	}
+	
+	token.type = SCPI_TT_PARAMETERS;
+	token.value = parameters;
+	token.length = length;
+	token.next = NULL;
+	
+	ctx->user_data = scpi_command_user_data(ctx, command);
+	ctx->suffix = suffix;
+	ctx->output_unit = 0;
+	
+	/* An operation left running is counted until scpi_complete is called. */
+	error = callback(ctx, &token);
+	if(error == SCPI_PENDING)
+	{
+		if(ctx->operations_pending == SCPI_MAX_PENDING)
+		{
+			scpi_queue_error(ctx, SCPI_ERROR_EXECUTION);
+		}
+		else
+		{
+			ctx->operations_pending++;
+		}
+		
+		error = SCPI_SUCCESS;
+	}
+	
+	return error;
+}
+
+/*
+ * Find the end of the message unit starting at str, i.e. the first
+ * semicolon that is not part of a string or block parameter.
+ */
+static size_t
+scpi_message_unit_length(const char* str, size_t length)
+{
+	size_t i;
+	size_t data_start;
+	size_t data_length;
+	
+	i = 0;
+	while(1)
+	{
+		i += scpi_scan(str+i, length-i, ';', '"', '\'', '#');
+		if(i == length || str[i] == ';')
+		{
+			return i;
+		}
+		
+		if(str[i] == '#')
+		{
+			/* Skip over the block, if this is one. */
+			if(scpi_parse_block(str+i, length-i, &data_start, &data_length))
+			{
+				i += data_start+data_length;
+			}
+			else
+			{
+				i++;
+			}
+			
+			continue;
+		}
+		
+		/* Skip over the quoted string. */
+		i++;
+		i += scpi_scan(str+i, length-i, str[i-1], str[i-1], str[i-1], str[i-1]);
+		if(i == length)
+		{
+			return i;
+		}
+		
+		i++;
+	}
+}
+
+scpi_error_t
+scpi_execute_command(struct scpi_parser_context* ctx, const char* command_string, size_t length)
+{
+	scpi_error_t error;
+	size_t consumed;
+	
+	error = scpi_execute_command_partial(ctx, command_string, length, &consumed);
+	
+	/*
+	 * Nobody will execute the rest of the string, so say that it was lost
+	 * and end the message when the wait is over.
+	 */
+	if(error == SCPI_PENDING && consumed < length)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_EXECUTION);
+		if(ctx->operation_position != NULL)
+		{
+			ctx->operation_position = NULL;
+			ctx->operation_flush = 1;
+		}
+	}
+	
+	return error;
+}
+
+scpi_error_t
+scpi_execute_command_partial(struct scpi_parser_context* ctx, const char* command_string,
+								size_t length, size_t* consumed)
+{
+	struct scpi_command* position;
+	struct scpi_command* old_position;
+	struct scpi_command* command;
+	struct scpi_token_span spans[SCPI_MAX_TOKENS];
+	size_t span_count;
+	size_t unit_length;
+	size_t header_end;
+	size_t parameters;
+	size_t hash;
+	size_t i;
+	unsigned long suffix;
+	scpi_error_t error;
+	
+	*consumed = 0;
+	if(ctx->operation_wait != SCPI_WAIT_NONE)
+	{
+		return SCPI_PENDING;
+	}
+	
+	/*
+	 * Every program message starts at the root of the tree, unless this is
+	 * the rest of one that had to wait.
+	 */
+	position = ctx->operation_position != NULL ? ctx->operation_position : ctx->command_tree;
+	ctx->operation_position = NULL;
+	error = SCPI_SUCCESS;
+	
+	while(length > 0)
+	{
+		unit_length = scpi_message_unit_length(command_string, length);
+		
+		/* Skip empty message units. */
+		for(i = 0; i < unit_length && scpi_isspace(command_string[i]); i++);
+		
+		if(i < unit_length)
+		{
+			/* Find the header as scpi_tokenize would, ignoring trailing whitespace. */
+			for(header_end = unit_length; scpi_isspace(command_string[header_end-1]); header_end--);
+			header_end = i+scpi_scan(command_string+i, header_end-i, ' ', '\t', '\t', '\t');
+			
+			for(parameters = header_end;
+				parameters < unit_length && scpi_isspace(command_string[parameters]);
+				parameters++);
+			
+			hash = scpi_hash_mnemonic(command_string+i, header_end-i);
+			command = scpi_header_cache_find(ctx, &position, command_string+i, header_end-i,
+												hash, &suffix);
+			if(command == NULL)
+			{
+				error = scpi_tokenize(command_string, unit_length, spans, SCPI_MAX_TOKENS, &span_count);
+				if(error != SCPI_SUCCESS)
+				{
+					break;
+				}
+				
+				old_position = position;
+				command = scpi_find_command_spans(ctx, &position, command_string, spans, span_count,
+													&suffix);
+				if(command != NULL)
+				{
+					scpi_header_cache_insert(ctx, old_position, command_string+i, header_end-i,
+												hash, command, position, suffix);
+				}
+			}
+			
+			error = scpi_dispatch(ctx, command, suffix, command_string+parameters,
+									unit_length-parameters);
+			
+			/* The rest of the message is abandoned after an error. */
+			if(error != SCPI_SUCCESS)
+			{
+				break;
+			}
+			
+			/*
+			 * The string cannot be kept until *WAI or *OPC? is satisfied, so
+			 * the caller is told where the commands after it begin.  If there
+			 * are any, the responses are held for them, and they carry on
+			 * from the same place in the tree.
+			 */
+			if(ctx->operation_wait != SCPI_WAIT_NONE)
+			{
+				for(i = unit_length; i < length && (command_string[i] == ';'
+						|| scpi_isspace(command_string[i])); i++);
+				
+				*consumed += i;
+				if(i < length)
+				{
+					ctx->operation_position = position;
+				}
+				else
+				{
+					ctx->operation_flush = 1;
+				}
+				return SCPI_PENDING;
+			}
+		}
+		
+		if(unit_length < length)
+		{
+			unit_length++;
+		}
+		
+		command_string += unit_length;
+		length -= unit_length;
+		*consumed += unit_length;
+	}
+	
+	/* A string abandoned after an error has still been dealt with. */
+	*consumed += length;
+	scpi_flush(ctx);
+	
+	return error;
+}
+
+/* The value of input_block_remaining for a #0 block. */
+#define SCPI_BLOCK_INDEFINITE ((unsigned long)-1)
+
+/*
+ * Prepare to receive a new message unit.
+ */
+static void
+scpi_feed_reset_unit(struct scpi_parser_context* ctx)
+{
+	ctx->input_state = SCPI_IS_HEADER;
+	ctx->input_command = NULL;
+	ctx->input_parent = NULL;
+	ctx->input_suffix = 1;
+	ctx->input_quote = 0;
+	ctx->input_length = 0;
+}
+
+/*
+ * Prepare to receive a new program message.
+ */
+static void
+scpi_feed_reset(struct scpi_parser_context* ctx)
+{
+	scpi_feed_reset_unit(ctx);
+	ctx->input_error = SCPI_SUCCESS;
+	ctx->input_position = ctx->command_tree;
+}
+
+/*
+ * Look up the mnemonic in the input buffer beneath the command found so far.
+ */
+static void
+scpi_feed_mnemonic(struct scpi_parser_context* ctx)
+{
+	if(!scpi_resolve_mnemonic(ctx, ctx->input_position, &ctx->input_parent,
+								&ctx->input_command, ctx->input_buffer, ctx->input_length,
+								&ctx->input_suffix))
+	{
+		ctx->input_state = SCPI_IS_DISCARD;
+		ctx->input_error = SCPI_COMMAND_NOT_FOUND;
+	}
+	
+	ctx->input_length = 0;
+}
+
+/*
+ * Execute the message unit that has been received.
+ */
+static scpi_error_t
+scpi_feed_execute(struct scpi_parser_context* ctx)
+{
+	scpi_error_t error;
+	
+	if(ctx->input_state == SCPI_IS_HEADER)
+	{
+		/* An empty message unit does nothing. */
+		if(ctx->input_command == NULL && ctx->input_length == 0)
+		{
+			return SCPI_SUCCESS;
+		}
+		
+		scpi_feed_mnemonic(ctx);
+	}
+	
+	if(ctx->input_state == SCPI_IS_DISCARD)
+	{
+		return ctx->input_error;
+	}
+	
+	if(ctx->input_command == ctx->command_tree)
+	{
+		return SCPI_COMMAND_NOT_FOUND;
+	}
+	
+	error = scpi_dispatch(ctx, ctx->input_command, ctx->input_suffix,
+							ctx->input_buffer, ctx->input_length);
+	
+	if(error == SCPI_SUCCESS && ctx->input_parent != NULL)
+	{
+		ctx->input_position = ctx->input_parent;
+	}
+	
+	return error;
+}
+
+/*
+ * Execute the message unit that has been received, and prepare for the
+ * next one.  The rest of the message is abandoned after an error.
+ */
+static void
+scpi_feed_end_unit(struct scpi_parser_context* ctx)
+{
+	scpi_error_t error;
+	
+	error = scpi_feed_execute(ctx);
+	scpi_feed_reset_unit(ctx);
+	
+	if(error != SCPI_SUCCESS)
+	{
+		ctx->input_state = SCPI_IS_DISCARD;
+		ctx->input_error = error;
+	}
+}
+
+/*
+ * Add a byte to the input buffer, abandoning the message if it is full.
+ */
+static void
+scpi_feed_append(struct scpi_parser_context* ctx, char c)
+{
+	if(ctx->input_length == SCPI_INPUT_BUFFER_LENGTH)
+	{
+		ctx->input_state = SCPI_IS_DISCARD;
+		ctx->input_error = SCPI_BUFFER_OVERFLOW;
+		return;
+	}
+	
+	ctx->input_buffer[ctx->input_length++] = c;
+}
+
+/*
+ * Check whether the next byte of input starts a new parameter.
+ */
+static int
+scpi_feed_at_parameter_start(struct scpi_parser_context* ctx)
+{
+	size_t i;
+	
+	i = ctx->input_length;
+	while(i > 0 && scpi_isspace(ctx->input_buffer[i-1]))
+	{
+		i--;
+	}
+	
+	return i == 0 || ctx->input_buffer[i-1] == ',';
+}
+
+/*
+ * Pass the part of the current block that is in the input buffer to the
+ * command's block callback, and remove it from the buffer.
+ */
+static void
+scpi_feed_flush_block(struct scpi_parser_context* ctx)
+{
+	scpi_error_t error;
+	
+	error = scpi_command_block_callback(ctx, ctx->input_command)(
+				ctx, ctx->input_buffer+ctx->input_block_data,
+				ctx->input_length-ctx->input_block_data);
+	
+	ctx->input_length = ctx->input_block_data;
+	ctx->input_block_streamed = 1;
+	
+	if(error != SCPI_SUCCESS)
+	{
+		ctx->input_error = error;
+	}
+}
+
+/*
+ * Finish receiving a block.  A block that was passed to the block callback
+ * is replaced by an empty one, #10, so that the parameter list is intact.
+ */
+static void
+scpi_feed_end_block(struct scpi_parser_context* ctx)
+{
+	if(ctx->input_error == SCPI_SUCCESS && ctx->input_block_streamed)
+	{
+		scpi_feed_flush_block(ctx);
+		
+		ctx->input_length = ctx->input_block_start;
+		scpi_feed_append(ctx, '#');
+		scpi_feed_append(ctx, '1');
+		scpi_feed_append(ctx, '0');
+	}
+	
+	if(ctx->input_error != SCPI_SUCCESS)
+	{
+		ctx->input_state = SCPI_IS_DISCARD;
+	}
+	else
+	{
+		ctx->input_state = SCPI_IS_PARAMETERS;
+	}
+}
+
+/*
+ * Receive a byte of block data.  If the buffer is full, then the block is
+ * passed to the command's block callback if it has one.  Otherwise, the
+ * rest of the block is counted but not stored, and the message abandoned.
+ */
+static void
+scpi_feed_block_data(struct scpi_parser_context* ctx, char c)
+{
+	if(ctx->input_error == SCPI_SUCCESS && ctx->input_length == SCPI_INPUT_BUFFER_LENGTH)
+	{
+		if(scpi_command_block_callback(ctx, ctx->input_command) != NULL
+			&& ctx->input_block_data < SCPI_INPUT_BUFFER_LENGTH)
+		{
+			scpi_feed_flush_block(ctx);
+		}
+		else
+		{
+			ctx->input_error = SCPI_BUFFER_OVERFLOW;
+		}
+	}
+	
+	if(ctx->input_error == SCPI_SUCCESS)
+	{
+		ctx->input_buffer[ctx->input_length++] = c;
+	}
+	
+	if(ctx->input_block_remaining != SCPI_BLOCK_INDEFINITE)
+	{
+		ctx->input_block_remaining--;
+		if(ctx->input_block_remaining == 0)
+		{
+			scpi_feed_end_block(ctx);
+		}
+	}
+}
+
+scpi_error_t
+scpi_feed(struct scpi_parser_context* ctx, char c)
+{
+	scpi_error_t error;
+	
+	/* Input is left unread while *WAI or *OPC? waits. */
+	if(ctx->operation_wait != SCPI_WAIT_NONE)
+	{
+		return SCPI_PENDING;
+	}
+	
+	/* A definite-length block may contain any byte, including newlines. */
+	if(ctx->input_state == SCPI_IS_BLOCK_DATA
+		&& ctx->input_block_remaining != SCPI_BLOCK_INDEFINITE)
+	{
+		scpi_feed_block_data(ctx, c);
+		return SCPI_INCOMPLETE;
+	}
+	
+	if(c == '\n')
+	{
+		if(ctx->input_state == SCPI_IS_BLOCK_DATA)
+		{
+			scpi_feed_end_block(ctx);
+		}
+		
+		error = scpi_feed_execute(ctx);
+		scpi_feed_reset(ctx);
+		
+		/* The responses are held back until *WAI or *OPC? is satisfied. */
+		if(ctx->operation_wait != SCPI_WAIT_NONE)
+		{
+			ctx->operation_flush = 1;
+		}
+		else
+		{
+			scpi_flush(ctx);
+		}
+		
+		return error;
+	}
+	
+	switch(ctx->input_state)
+	{
+		case SCPI_IS_HEADER:
+			if(c == ';')
+			{
+				scpi_feed_end_unit(ctx);
+				return SCPI_INCOMPLETE;
+			}
+			else if(scpi_isspace(c)
+					&& ctx->input_command == NULL && ctx->input_length == 0)
+			{
+				/* Remove whitespace before the header. */
+				return SCPI_INCOMPLETE;
+			}
+			else if(c == ':' || scpi_isspace(c))
+			{
+				scpi_feed_mnemonic(ctx);
+				
+				if(c != ':' && ctx->input_state == SCPI_IS_HEADER)
+				{
+					ctx->input_state = SCPI_IS_PARAMETERS;
+				}
+				
+				return SCPI_INCOMPLETE;
+			}
+			break;
+		
+		case SCPI_IS_PARAMETERS:
+			if(ctx->input_quote != 0)
+			{
+				if(c == ctx->input_quote)
+				{
+					ctx->input_quote = 0;
+				}
+			}
+			else if(c == '"' || c == '\'')
+			{
+				ctx->input_quote = c;
+			}
+			else if(c == ';')
+			{
+				scpi_feed_end_unit(ctx);
+				return SCPI_INCOMPLETE;
+			}
+			else if(ctx->input_length == 0 && scpi_isspace(c))
+			{
+				/* Remove leading whitespace. */
+				return SCPI_INCOMPLETE;
+			}
+			else if(c == '#' && scpi_feed_at_parameter_start(ctx))
+			{
+				/* This may be a block, or a non-decimal number such as #H1F. */
+				ctx->input_state = SCPI_IS_BLOCK_DIGITS;
+				ctx->input_block_start = ctx->input_length;
+			}
+			break;
+		
+		case SCPI_IS_BLOCK_DIGITS:
+			if(c < '0' || c > '9')
+			{
+				ctx->input_state = SCPI_IS_PARAMETERS;
+				return scpi_feed(ctx, c);
+			}
+			
+			scpi_feed_append(ctx, c);
+			if(ctx->input_state == SCPI_IS_DISCARD)
+			{
+				return SCPI_INCOMPLETE;
+			}
+			
+			ctx->input_block_data = ctx->input_length;
+			ctx->input_block_remaining = 0;
+			ctx->input_block_streamed = 0;
+			
+			if(c == '0')
+			{
+				ctx->input_block_remaining = SCPI_BLOCK_INDEFINITE;
+				ctx->input_state = SCPI_IS_BLOCK_DATA;
+			}
+			else
+			{
+				ctx->input_state = SCPI_IS_BLOCK_LENGTH;
+			}
+			
+			return SCPI_INCOMPLETE;
+		
+		case SCPI_IS_BLOCK_LENGTH:
+			if(c < '0' || c > '9')
+			{
+				ctx->input_state = SCPI_IS_PARAMETERS;
+				return scpi_feed(ctx, c);
+			}
+			
+			scpi_feed_append(ctx, c);
+			
+			ctx->input_block_remaining = 10*ctx->input_block_remaining + (c - '0');
+			ctx->input_block_data = ctx->input_length;
+			
+			/* The number of length digits is given by the digit after the #. */
+			if(ctx->input_state == SCPI_IS_BLOCK_LENGTH
+				&& ctx->input_length - ctx->input_block_start - 2
+					== (size_t)(ctx->input_buffer[ctx->input_block_start+1] - '0'))
+			{
+				if(ctx->input_block_remaining == 0)
+				{
+					ctx->input_state = SCPI_IS_PARAMETERS;
+				}
+				else
+				{
+					ctx->input_state = SCPI_IS_BLOCK_DATA;
+				}
+			}
+			
+			return SCPI_INCOMPLETE;
+		
+		case SCPI_IS_BLOCK_DATA:
+			scpi_feed_block_data(ctx, c);
+			return SCPI_INCOMPLETE;
+		
+		case SCPI_IS_DISCARD:
+			return SCPI_INCOMPLETE;
+	}
+	
+	scpi_feed_append(ctx, c);
+	return SCPI_INCOMPLETE;
+}
+
+void
+scpi_complete(struct scpi_parser_context* ctx)
+{
+	if(ctx->operations_pending == 0)
+	{
+		return;
+	}
+	
+	ctx->operations_pending--;
+	if(ctx->operations_pending != 0)
+	{
+		return;
+	}
+	
+	if(ctx->operation_complete_armed)
+	{
+		ctx->event_status |= SCPI_EVENT_OPERATION_COMPLETE;
+		ctx->operation_complete_armed = 0;
+	}
+	
+	/* The response of *OPC? follows those before it in the message. */
+	if(ctx->operation_wait == SCPI_WAIT_OPC_QUERY)
+	{
+		ctx->output_unit = 0;
+		scpi_write_string(ctx, "1");
+	}
+	
+	ctx->operation_wait = SCPI_WAIT_NONE;
+	
+	if(ctx->operation_flush)
+	{
+		ctx->operation_flush = 0;
+		scpi_flush(ctx);
+	}
+}
+
+void
+scpi_free_some_tokens(struct scpi_token* start, struct scpi_token* end)
+{
+	struct scpi_token* prev;
+	while(start != NULL && start != end)
+	{
+		prev = start;
+		start = start->next;
+		
+		free((void*)prev);
+	}
+}
+
+void
+scpi_free_tokens(struct scpi_token* start)
+{
+	scpi_free_some_tokens(start, NULL);
+}
+
+/*
+ * Significant digits kept in the 64-bit mantissa, and in the exact
+ * comparison that settles numbers too close to halfway between two
+ * floats.  Digits beyond the latter can only break a tie.
+ */
+#define SCPI_NUMERIC_DIGITS       19
+#define SCPI_NUMERIC_EXACT_DIGITS 120
+
+/* Exponents are saturated here; anything larger overflows regardless. */
+#define SCPI_NUMERIC_EXPONENT_LIMIT 10000L
+
+/*
+ * The most that the truncated mantissa can fall short of the true one,
+ * in units of its last place.  Results within this of halfway are
+ * checked exactly.
+ */
+#define SCPI_NUMERIC_ERROR 32
+
+/*
+ * The bits that a bignum needs for the exact comparison.  It is only made
+ * for a number no less than about half the smallest subnormal, 2^-150,
+ * which is more than 10^-46, with its digits cut to
+ * SCPI_NUMERIC_EXACT_DIGITS.  A negative power of ten is moved to the
+ * midpoint, of at most 25 bits, as a power of five of at most
+ * SCPI_NUMERIC_EXACT_DIGITS+46, each factor of five taking under 2.322
+ * bits.  Once the powers of two are cancelled, the two sides differ by
+ * less than a factor of two, so the one that is shifted grows by at most
+ * a bit beyond the other.  For 120 digits this is 413 bits, or 13 limbs,
+ * and the decimal side alone is no more than 399 bits.
+ *
+ * Two bignums are on the stack while a number is checked, which is 108
+ * bytes on AVR; it is only done for the rare number within
+ * SCPI_NUMERIC_ERROR of halfway between two floats.
+ */
+#define SCPI_BIGNUM_BITS (25 + ((SCPI_NUMERIC_EXACT_DIGITS + 46) * 2322L + 999) / 1000 + 2)
+#define SCPI_BIGNUM_LIMBS ((SCPI_BIGNUM_BITS + 31) / 32)
+
+#if (SCPI_NUMERIC_EXACT_DIGITS * 3322L + 999) / 1000 + 2 > SCPI_BIGNUM_LIMBS * 32
+#error "SCPI_BIGNUM_LIMBS is too small for SCPI_NUMERIC_EXACT_DIGITS digits"
+#endif
+
+/*
+ * A power of ten, as a 64-bit mantissa between 2^63 and 2^64 split into
+ * two words, and a binary exponent.
+ */
+struct scpi_power_of_ten
+{
+	uint32_t high;
+	uint32_t low;
+	short    exponent;
+};
+
+/*
+ * 10^k is the product of scpi_pow10_small[k mod 16] and
+ * scpi_pow10_large[k div 16 + 5], for k between -80 and 47.  The small
+ * powers are exact, as are the large ones for k of 0 and 16; the rest
+ * are truncated.
+ */
+static const struct scpi_power_of_ten scpi_pow10_small[16] SCPI_PROGMEM = {
+	{ 0x80000000UL, 0x00000000UL,  -63 },  /* 1e0 */
+	{ 0xa0000000UL, 0x00000000UL,  -60 },  /* 1e1 */
+	{ 0xc8000000UL, 0x00000000UL,  -57 },  /* 1e2 */
+	{ 0xfa000000UL, 0x00000000UL,  -54 },  /* 1e3 */
+	{ 0x9c400000UL, 0x00000000UL,  -50 },  /* 1e4 */
+	{ 0xc3500000UL, 0x00000000UL,  -47 },  /* 1e5 */
+	{ 0xf4240000UL, 0x00000000UL,  -44 },  /* 1e6 */
+	{ 0x98968000UL, 0x00000000UL,  -40 },  /* 1e7 */
+	{ 0xbebc2000UL, 0x00000000UL,  -37 },  /* 1e8 */
+	{ 0xee6b2800UL, 0x00000000UL,  -34 },  /* 1e9 */
+	{ 0x9502f900UL, 0x00000000UL,  -30 },  /* 1e10 */
+	{ 0xba43b740UL, 0x00000000UL,  -27 },  /* 1e11 */
+	{ 0xe8d4a510UL, 0x00000000UL,  -24 },  /* 1e12 */
+	{ 0x9184e72aUL, 0x00000000UL,  -20 },  /* 1e13 */
+	{ 0xb5e620f4UL, 0x80000000UL,  -17 },  /* 1e14 */
+	{ 0xe35fa931UL, 0xa0000000UL,  -14 }   /* 1e15 */
+};
+
+static const struct scpi_power_of_ten scpi_pow10_large[8] SCPI_PROGMEM = {
+	{ 0x97c560baUL, 0x6b0919a5UL, -329 },  /* 1e-80 */
+	{ 0xa87fea27UL, 0xa539e9a5UL, -276 },  /* 1e-64 */
+	{ 0xbb127c53UL, 0xb17ec159UL, -223 },  /* 1e-48 */
+	{ 0xcfb11eadUL, 0x453994baUL, -170 },  /* 1e-32 */
+	{ 0xe69594beUL, 0xc44de15bUL, -117 },  /* 1e-16 */
+	{ 0x80000000UL, 0x00000000UL,  -63 },  /* 1e0 */
+	{ 0x8e1bc9bfUL, 0x04000000UL,  -10 },  /* 1e16 */
+	{ 0x9dc5ada8UL, 0x2b70b59dUL,   43 }   /* 1e32 */
+};
+
+/* Powers of ten that are exact as floats. */
+static const float scpi_pow10_float[11] SCPI_PROGMEM = {
+	1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+/*
+ * Copy an entry out of a table, which on the AVR is in program memory.
+ */
+static void
+scpi_read_table(void* destination, const void* source, size_t size)
+{
+#ifdef __AVR__
+	memcpy_P(destination, source, size);
+#else
+	memcpy(destination, source, size);
+#endif
+}
+
+/*
+ * Multiply two mantissas between 2^63 and 2^64, returning the top 64
+ * bits of the product, shifted left by one if that is needed to set the
+ * top bit.  The binary exponent is increased to match, and *exact
+ * cleared if any of the bits discarded were set.
+ */
+static uint64_t
+scpi_multiply_mantissas(uint64_t a, uint64_t b, int* exponent, int* exact)
+{
+	uint64_t a_high, a_low, b_high, b_low;
+	uint64_t low_low, low_high, high_low, high_high;
+	uint64_t middle, high, low;
+
+	a_high = a >> 32;
+	a_low  = a & 0xFFFFFFFFUL;
+	b_high = b >> 32;
+	b_low  = b & 0xFFFFFFFFUL;
+
+	low_low   = a_low * b_low;
+	low_high  = a_low * b_high;
+	high_low  = a_high * b_low;
+	high_high = a_high * b_high;
+
+	middle = (low_low >> 32) + (low_high & 0xFFFFFFFFUL) + (high_low & 0xFFFFFFFFUL);
+	high = high_high + (low_high >> 32) + (high_low >> 32) + (middle >> 32);
+	low = (middle << 32) | (low_low & 0xFFFFFFFFUL);
+
+	if((high >> 63) == 0)
+	{
+		high = (high << 1) | (low >> 63);
+		low <<= 1;
+		*exponent += 63;
+	}
+	else
+	{
+		*exponent += 64;
+	}
+
+	if(low != 0)
+	{
+		*exact = 0;
+	}
+
+	return high;
+}
+
+/*
+ * An unsigned integer of up to SCPI_BIGNUM_LIMBS 32-bit limbs, least
+ * significant first.  The bound on SCPI_BIGNUM_LIMBS means that the
+ * arithmetic below never carries out of the last limb; the checks there
+ * only keep a mistake in it from writing past the array.
+ */
+struct scpi_bignum
+{
+	size_t   length;
+	uint32_t limbs[SCPI_BIGNUM_LIMBS];
+};
+
+/*
+ * Set n to n*factor + addend.
+ */
+static void
+scpi_bignum_multiply_add(struct scpi_bignum* n, uint32_t factor, uint32_t addend)
+{
+	size_t i;
+	uint64_t carry;
+
+	carry = addend;
+	for(i = 0; i < n->length; i++)
+	{
+		carry += (uint64_t)n->limbs[i] * factor;
+		n->limbs[i] = (uint32_t)carry;
+		carry >>= 32;
+	}
+
+	if(carry != 0 && n->length < SCPI_BIGNUM_LIMBS)
+	{
+		n->limbs[n->length++] = (uint32_t)carry;
+	}
+}
+
+/*
+ * Set n to n*5^power.
+ */
+static void
+scpi_bignum_multiply_pow5(struct scpi_bignum* n, long power)
+{
+	uint32_t factor;
+
+	/* 5^13 is the largest power of five that fits in 32 bits. */
+	for(; power >= 13; power -= 13)
+	{
+		scpi_bignum_multiply_add(n, 1220703125UL, 0);
+	}
+
+	for(factor = 1; power > 0; power--)
+	{
+		factor *= 5;
+	}
+	scpi_bignum_multiply_add(n, factor, 0);
+}
+
+/*
+ * Set n to n*2^bits.
+ */
+static void
+scpi_bignum_shift(struct scpi_bignum* n, long bits)
+{
+	size_t words;
+	unsigned int shift;
+	size_t i;
+
+	words = (size_t)(bits / 32);
+	shift = (unsigned int)(bits % 32);
+
+	if(n->length == 0)
+	{
+		return;
+	}
+
+	if(shift != 0)
+	{
+		if((n->limbs[n->length-1] >> (32 - shift)) != 0 && n->length < SCPI_BIGNUM_LIMBS)
+		{
+			n->limbs[n->length++] = 0;
+		}
+		for(i = n->length - 1; i > 0; i--)
+		{
+			n->limbs[i] = (n->limbs[i] << shift) | (n->limbs[i-1] >> (32 - shift));
+		}
+		n->limbs[0] <<= shift;
+	}
+
+	if(words != 0)
+	{
+		if(n->length + words > SCPI_BIGNUM_LIMBS)
+		{
+			words = SCPI_BIGNUM_LIMBS - n->length;
+		}
+		memmove(n->limbs + words, n->limbs, n->length * sizeof(uint32_t));
+		memset(n->limbs, 0, words * sizeof(uint32_t));
+		n->length += words;
+	}
+}
+
+/*
+ * Compare two bignums, returning a negative, zero, or positive value as
+ * a is less than, equal to, or greater than b.
+ */
+static int
+scpi_bignum_compare(const struct scpi_bignum* a, const struct scpi_bignum* b)
+{
+	size_t i;
+
+	if(a->length != b->length)
+	{
+		return a->length < b->length ? -1 : 1;
+	}
+
+	for(i = a->length; i > 0; i--)
+	{
+		if(a->limbs[i-1] != b->limbs[i-1])
+		{
+			return a->limbs[i-1] < b->limbs[i-1] ? -1 : 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Compare the decimal number given by some digits, possibly with a
+ * point, and a power of ten with midpoint*2^binary_exponent, exactly.
+ * Returns a negative, zero, or positive value as the decimal number is
+ * less than, equal to, or greater than the other.
+ */
+static int
+scpi_numeric_compare(const char* digits, size_t length, long exponent,
+                     uint32_t midpoint, long binary_exponent)
+{
+	struct scpi_bignum decimal;
+	struct scpi_bignum binary;
+	size_t i;
+	size_t significant;
+	int point;
+	int sticky;
+	int result;
+
+	decimal.length = 0;
+	significant = 0;
+	point = 0;
+	sticky = 0;
+
+	for(i = 0; i < length; i++)
+	{
+		if(digits[i] == '.')
+		{
+			point = 1;
+		}
+		else if(significant == 0 && digits[i] == '0')
+		{
+			exponent -= point;
+		}
+		else if(significant < SCPI_NUMERIC_EXACT_DIGITS)
+		{
+			if(decimal.length == 0)
+			{
+				decimal.length = 1;
+				decimal.limbs[0] = 0;
+			}
+			scpi_bignum_multiply_add(&decimal, 10, (uint32_t)(digits[i] - '0'));
+			significant++;
+			exponent -= point;
+		}
+		else
+		{
+			exponent += !point;
+			sticky |= digits[i] != '0';
+		}
+	}
+
+	binary.length = 1;
+	binary.limbs[0] = midpoint;
+
+	/* Cancel the common power of two out of 10^exponent. */
+	if(exponent >= 0)
+	{
+		scpi_bignum_multiply_pow5(&decimal, exponent);
+	}
+	else
+	{
+		scpi_bignum_multiply_pow5(&binary, -exponent);
+	}
+	binary_exponent -= exponent;
+
+	if(binary_exponent >= 0)
+	{
+		scpi_bignum_shift(&binary, binary_exponent);
+	}
+	else
+	{
+		scpi_bignum_shift(&decimal, -binary_exponent);
+	}
+
+	result = scpi_bignum_compare(&decimal, &binary);
+	if(result == 0 && sticky)
+	{
+		result = 1;
+	}
+
+	return result;
+}
+
+/*
+ * Convert mantissa*10^power to the nearest float, rounding halfway cases
+ * to even.  Sticky is set if nonzero digits were dropped from the
+ * mantissa; the digits themselves and the power of ten they are scaled
+ * by are used to round exactly when that is too close to call.  Sets
+ * *overflow if the result is out of range.
+ */
+static float
+scpi_numeric_to_float(uint64_t mantissa, long power, int sticky,
+                      const char* digits, size_t length, long exponent,
+                      int* overflow)
+{
+	struct scpi_power_of_ten small, large;
+	uint64_t product;
+	uint32_t kept;
+	uint64_t remainder, half;
+	int binary_exponent;
+	int shift;
+	int exact;
+	int round_up;
+	int comparison;
+	float scale;
+	double value;
+
+	if(mantissa == 0)
+	{
+		return 0.0f;
+	}
+
+	/* Both factors are exact, so IEEE arithmetic rounds correctly. */
+	if(!sticky && mantissa <= (1UL << 24) && power >= -10 && power <= 10)
+	{
+		scpi_read_table(&scale, &scpi_pow10_float[power < 0 ? -power : power], sizeof(float));
+		return power < 0 ? (float)mantissa / scale : (float)mantissa * scale;
+	}
+
+	/* The mantissa has at most 19 digits. */
+	if(power + SCPI_NUMERIC_DIGITS < -46)
+	{
+		return 0.0f;
+	}
+	if(power > 39)
+	{
+		*overflow = 1;
+		return 0.0f;
+	}
+
+	binary_exponent = 0;
+	while((mantissa >> 63) == 0)
+	{
+		mantissa <<= 1;
+		binary_exponent--;
+	}
+
+	scpi_read_table(&small, &scpi_pow10_small[(power + 80) % 16], sizeof(small));
+	scpi_read_table(&large, &scpi_pow10_large[(power + 80) / 16], sizeof(large));
+
+	exact = !sticky && (power + 80) / 16 >= 5 && (power + 80) / 16 <= 6;
+	binary_exponent += small.exponent + large.exponent;
+
+	product = scpi_multiply_mantissas(((uint64_t)small.high << 32) | small.low,
+	                                  ((uint64_t)large.high << 32) | large.low,
+	                                  &binary_exponent, &exact);
+	product = scpi_multiply_mantissas(mantissa, product, &binary_exponent, &exact);
+
+	/*
+	 * The value is now product*2^binary_exponent.  Keep 24 bits, or
+	 * fewer for subnormals.
+	 */
+	if(binary_exponent + 63 > 127)
+	{
+		*overflow = 1;
+		return 0.0f;
+	}
+	shift = 40;
+	if(binary_exponent + 63 < -126)
+	{
+		shift += -126 - (binary_exponent + 63);
+	}
+	/*
+	 * Below half the smallest subnormal the result is zero, unless the
+	 * truncated product has only just fallen short of it.
+	 */
+	if(shift > 65 || (shift == 65 && product < ~(uint64_t)0 - SCPI_NUMERIC_ERROR))
+	{
+		return 0.0f;
+	}
+
+	if(shift == 65)
+	{
+		comparison = scpi_numeric_compare(digits, length, exponent, 1, -150);
+		return comparison > 0 ? (float)ldexp(1.0, -149) : 0.0f;
+	}
+
+	if(shift == 64)
+	{
+		kept = 0;
+		remainder = product;
+	}
+	else
+	{
+		kept = (uint32_t)(product >> shift);
+		remainder = product & (((uint64_t)1 << shift) - 1);
+	}
+	half = (uint64_t)1 << (shift - 1);
+
+	if(remainder > half)
+	{
+		round_up = 1;
+	}
+	else if(exact)
+	{
+		round_up = remainder == half && (kept & 1);
+	}
+	else if(remainder + SCPI_NUMERIC_ERROR <= half)
+	{
+		round_up = 0;
+	}
+	else
+	{
+		comparison = scpi_numeric_compare(digits, length, exponent, 2*kept + 1,
+		                                  (long)binary_exponent + shift - 1);
+		round_up = comparison > 0 || (comparison == 0 && (kept & 1));
+	}
+
+	value = ldexp((double)(kept + round_up), binary_exponent + shift);
+	if(value > FLT_MAX)
+	{
+		*overflow = 1;
+		return 0.0f;
+	}
+
+	return (float)value;
+}
+
+/*
+ * Check whether a string is one of the keywords accepted in place of a
+ * number, in its short or long form and in either case, followed by
+ * nothing but whitespace.
+ */
+static int
+scpi_numeric_keyword(const char* str, size_t length, const char* keyword, size_t short_length)
+{
+	size_t i;
+
+	for(i = 0; i < length && scpi_isalpha(str[i]); i++)
+	{
+		if(keyword[i] == '\0' || scpi_fold_char(str[i]) != keyword[i])
+		{
+			return 0;
+		}
+	}
+
+	if(i != short_length && keyword[i] != '\0')
+	{
+		return 0;
+	}
+
+	for(; i < length; i++)
+	{
+		if(!scpi_isspace(str[i]))
+		{
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Find the power of ten for the suffix multiplier at the start of a
+ * suffix, in either case, returning the number of letters it takes or
+ * zero if there is none.  These are the multipliers of IEEE 488.2, in
+ * which M is milli and mega is MA; the two-letter forms EX, PE and MA
+ * are only taken when a unit follows them, so that MA alone is a
+ * milliampere.
+ */
+static size_t
+scpi_si_prefix(const char* suffix, size_t length, long* exponent)
+{
+	char first;
+	char second;
+
+	first = scpi_fold_char(suffix[0]);
+	if(length > 2)
+	{
+		second = scpi_fold_char(suffix[1]);
+		if(first == 'E' && second == 'X') { *exponent =  18; return 2; }
+		if(first == 'P' && second == 'E') { *exponent =  15; return 2; }
+		if(first == 'M' && second == 'A') { *exponent =   6; return 2; }
+	}
+
+	switch(first)
+	{
+		case 'T': *exponent =  12; return 1;
+		case 'G': *exponent =   9; return 1;
+		case 'K': *exponent =   3; return 1;
+		case 'M': *exponent =  -3; return 1;
+		case 'U': *exponent =  -6; return 1;
+		case 'N': *exponent =  -9; return 1;
+		case 'P': *exponent = -12; return 1;
+		case 'F': *exponent = -15; return 1;
+		case 'A': *exponent = -18; return 1;
+		default:  return 0;
+	}
+}
+
+/* The keywords that may stand in for a number. */
+#define SCPI_NUMERIC_NUMBER  0
+#define SCPI_NUMERIC_DEFAULT 1
+#define SCPI_NUMERIC_MAXIMUM 2
+#define SCPI_NUMERIC_MINIMUM 3
+
+/*
+ * A numeric string split into its parts: the first SCPI_NUMERIC_DIGITS
+ * significant digits as an integer, the power of ten by which they must
+ * be scaled, and where the digits and unit are.  The keyword is one of
+ * SCPI_NUMERIC_NUMBER, SCPI_NUMERIC_DEFAULT, and so on.
+ */
+struct scpi_numeric_parts
+{
+	int keyword;
+	uint64_t mantissa;
+	long scale;
+	long exponent;
+	int negative;
+	int sticky;
+	const char* digits;
+	size_t digits_length;
+	const char* unit;
+	size_t unit_length;
+	scpi_unit_t unit_id;
+};
+
+/*
+ * The units that are recognised, in upper case, each in the slot that
+ * scpi_find_unit hashes its name to.  The multipliers in the hash were
+ * found by search; adding a unit means searching again, for a pair that
+ * leaves every unit in a slot of its own.
+ */
+struct scpi_unit_entry
+{
+	char          name[4];
+	unsigned char length;
+	unsigned char unit;
+};
+
+#define SCPI_UNIT_SLOTS 32
+
+static const struct scpi_unit_entry scpi_units[SCPI_UNIT_SLOTS] SCPI_PROGMEM = {
+	{ "S",   1, SCPI_UNIT_SECOND },
+	{ "RAD", 3, SCPI_UNIT_RADIAN },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "CEL", 3, SCPI_UNIT_CELSIUS },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "A",   1, SCPI_UNIT_AMPERE },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "DBM", 3, SCPI_UNIT_DBM },
+	{ "OHM", 3, SCPI_UNIT_OHM },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "HZ",  2, SCPI_UNIT_HERTZ },
+	{ "V",   1, SCPI_UNIT_VOLT },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "DB",  2, SCPI_UNIT_DECIBEL },
+	{ "J",   1, SCPI_UNIT_JOULE },
+	{ "W",   1, SCPI_UNIT_WATT },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "K",   1, SCPI_UNIT_KELVIN },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "PCT", 3, SCPI_UNIT_PERCENT },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "DEG", 3, SCPI_UNIT_DEGREE },
+	{ "",    0, SCPI_UNIT_NONE },
+	{ "F",   1, SCPI_UNIT_FARAD }
+};
+
+/*
+ * Look a unit up in scpi_units, in either case, returning SCPI_UNIT_NONE
+ * if it is not there.
+ */
+static scpi_unit_t
+scpi_find_unit(const char* name, size_t length)
+{
+	struct scpi_unit_entry entry;
+	size_t i;
+	unsigned int hash;
+
+	if(length == 0 || length > sizeof(entry.name))
+	{
+		return SCPI_UNIT_NONE;
+	}
+
+	hash = 3*(unsigned char)scpi_fold_char(name[0])
+	     + 2*(unsigned char)scpi_fold_char(name[length-1]) + (unsigned int)length;
+	scpi_read_table(&entry, &scpi_units[hash % SCPI_UNIT_SLOTS], sizeof(entry));
+
+	if(entry.length != length)
+	{
+		return SCPI_UNIT_NONE;
+	}
+
+	for(i = 0; i < length; i++)
+	{
+		if(scpi_fold_char(name[i]) != entry.name[i])
+		{
+			return SCPI_UNIT_NONE;
+		}
+	}
+
+	return (scpi_unit_t)entry.unit;
+}
+
+/*
+ * Work out what the letters after a number mean, ignoring case.  A
+ * suffix that is a unit in its own right, such as PCT or dBm, is taken
+ * as that, and a multiplier is only split off when the rest is a known
+ * unit, so that an unknown unit such as NT is passed on whole.  A
+ * multiplier alone is a multiplier, and K alone is kilo rather than
+ * kelvin.  As in IEEE 488.2, MHZ and MOHM are the exceptions to M being
+ * milli: they are megahertz and megohm, which may also be written MAHZ
+ * and MAOHM.
+ */
+static scpi_numeric_status_t
+scpi_resolve_suffix(const char* suffix, size_t length, struct scpi_numeric_parts* parts)
+{
+	long prefix;
+	size_t prefix_length;
+	scpi_unit_t unit;
+
+	parts->unit_id = SCPI_UNIT_NONE;
+	if(length == 0)
+	{
+		return SCPI_NUMERIC_SUCCESS;
+	}
+
+	if(!scpi_isalpha(suffix[0]))
+	{
+		return SCPI_NUMERIC_SUFFIX;
+	}
+
+	if(length > 1 && scpi_fold_char(suffix[0]) == 'M')
+	{
+		unit = scpi_find_unit(suffix+1, length-1);
+		if(unit == SCPI_UNIT_HERTZ || unit == SCPI_UNIT_OHM)
+		{
+			parts->exponent += 6;
+			parts->unit_id     = unit;
+			parts->unit        = suffix+1;
+			parts->unit_length = length-1;
+			return SCPI_NUMERIC_SUCCESS;
+		}
+	}
+
+	unit = length == 1 && scpi_fold_char(suffix[0]) == 'K' ? SCPI_UNIT_NONE
+	     : scpi_find_unit(suffix, length);
+	if(unit == SCPI_UNIT_NONE)
+	{
+		prefix_length = scpi_si_prefix(suffix, length, &prefix);
+		if(prefix_length == length)
+		{
+			parts->exponent += prefix;
+			return SCPI_NUMERIC_SUCCESS;
+		}
+
+		if(prefix_length != 0)
+		{
+			unit = scpi_find_unit(suffix+prefix_length, length-prefix_length);
+			if(unit != SCPI_UNIT_NONE)
+			{
+				parts->exponent += prefix;
+				suffix += prefix_length;
+				length -= prefix_length;
+			}
+		}
+
+		if(unit == SCPI_UNIT_NONE)
+		{
+			unit = SCPI_UNIT_UNKNOWN;
+		}
+	}
+
+	parts->unit_id     = unit;
+	parts->unit        = suffix;
+	parts->unit_length = length;
+
+	return SCPI_NUMERIC_SUCCESS;
+}
+
+/*
+ * Split a numeric string into its parts, or find the keyword that it
+ * is.  The exponent includes the SI prefix, while the scale also
+ * accounts for the position of the decimal point.
+ */
+static scpi_numeric_status_t
+scpi_split_numeric(const char* str, size_t length, struct scpi_numeric_parts* parts)
+{
+	size_t i;
+	size_t j;
+	size_t digit_count;
+	size_t significant;
+	size_t unit_start;
+	uint64_t mantissa;
+	long scale;
+	int exponent_negative;
+	int point;
+	int sticky;
+
+	parts->keyword = SCPI_NUMERIC_NUMBER;
+	parts->unit = NULL;
+	parts->unit_length = 0;
+	parts->unit_id = SCPI_UNIT_NONE;
+
+	/* Remove leading whitespace. */
+	for(i = 0; i < length && scpi_isspace(str[i]); i++);
+
+	if(i == length)
+	{
+		return SCPI_NUMERIC_EMPTY;
+	}
+
+	if(scpi_isalpha(str[i]))
+	{
+		if(scpi_numeric_keyword(str+i, length-i, "DEFAULT", 3))
+		{
+			parts->keyword = SCPI_NUMERIC_DEFAULT;
+		}
+		else if(scpi_numeric_keyword(str+i, length-i, "MAXIMUM", 3))
+		{
+			parts->keyword = SCPI_NUMERIC_MAXIMUM;
+		}
+		else if(scpi_numeric_keyword(str+i, length-i, "MINIMUM", 3))
+		{
+			parts->keyword = SCPI_NUMERIC_MINIMUM;
+		}
+		else
+		{
+			return SCPI_NUMERIC_INVALID;
+		}
+
+		return SCPI_NUMERIC_SUCCESS;
+	}
+
+	parts->negative = 0;
+	if(str[i] == '+' || str[i] == '-')
+	{
+		parts->negative = str[i] == '-';
+		i++;
+	}
+
+	/*
+	 * Accumulate the first SCPI_NUMERIC_DIGITS significant digits, and
+	 * note whether any of the rest are nonzero.
+	 */
+	mantissa = 0;
+	scale = 0;
+	sticky = 0;
+	digit_count = 0;
+	significant = 0;
+	point = 0;
+	parts->digits = str+i;
+
+	for(; i < length; i++)
+	{
+		if(str[i] == '.' && !point)
+		{
+			point = 1;
+			continue;
+		}
+		else if(!scpi_isdigit(str[i]))
+		{
+			break;
+		}
+
+		digit_count++;
+		if(significant == 0 && str[i] == '0')
+		{
+			scale -= point;
+		}
+		else if(significant < SCPI_NUMERIC_DIGITS)
+		{
+			mantissa = 10*mantissa + (uint64_t)(str[i] - '0');
+			significant++;
+			scale -= point;
+		}
+		else
+		{
+			scale += !point;
+			sticky |= str[i] != '0';
+		}
+	}
+
+	parts->mantissa = mantissa;
+	parts->scale = scale;
+	parts->sticky = sticky;
+	parts->digits_length = (size_t)(str+i - parts->digits);
+
+	if(digit_count == 0)
+	{
+		return SCPI_NUMERIC_INVALID;
+	}
+
+	/*
+	 * An exponent must have digits.  Otherwise an E starts the suffix,
+	 * as in EX for exa.
+	 */
+	parts->exponent = 0;
+	if(i < length && (str[i] == 'e' || str[i] == 'E'))
+	{
+		j = i+1;
+		exponent_negative = 0;
+		if(j < length && (str[j] == '+' || str[j] == '-'))
+		{
+			exponent_negative = str[j] == '-';
+			j++;
+		}
+
+		if(j < length && scpi_isdigit(str[j]))
+		{
+			for(; j < length && scpi_isdigit(str[j]); j++)
+			{
+				if(parts->exponent < SCPI_NUMERIC_EXPONENT_LIMIT)
+				{
+					parts->exponent = 10*parts->exponent + (str[j] - '0');
+				}
+			}
+
+			if(exponent_negative)
+			{
+				parts->exponent = -parts->exponent;
+			}
+
+			i = j;
+		}
+	}
+
+	/* Remove spaces between the number and its units. */
+	for(; i < length && scpi_isspace(str[i]); i++);
+
+	/* The unit, with any multiplier. */
+	unit_start = i;
+	for(; i < length && scpi_isalpha(str[i]); i++);
+
+	if(scpi_resolve_suffix(str + unit_start, i - unit_start, parts) != SCPI_NUMERIC_SUCCESS)
+	{
+		return SCPI_NUMERIC_SUFFIX;
+	}
+
+	/* Nothing but whitespace may follow. */
+	for(; i < length && scpi_isspace(str[i]); i++);
+
+	if(i < length)
+	{
+		parts->unit        = NULL;
+		parts->unit_length = 0;
+		parts->unit_id     = SCPI_UNIT_NONE;
+		return SCPI_NUMERIC_INVALID;
+	}
+
+	parts->scale += parts->exponent;
+
+	return SCPI_NUMERIC_SUCCESS;
+}
+
+/*
+ * Find the float value of a number split by scpi_split_numeric.
+ */
+static scpi_numeric_status_t
+scpi_numeric_float(const struct scpi_numeric_parts* parts, float default_value,
+                   float min_value, float max_value, float* value)
+{
+	int overflow;
+
+	switch(parts->keyword)
+	{
+		case SCPI_NUMERIC_DEFAULT:
+			*value = default_value;
+			return SCPI_NUMERIC_SUCCESS;
+		case SCPI_NUMERIC_MAXIMUM:
+			*value = max_value;
+			return SCPI_NUMERIC_SUCCESS;
+		case SCPI_NUMERIC_MINIMUM:
+			*value = min_value;
+			return SCPI_NUMERIC_SUCCESS;
+	}
+
+	overflow = 0;
+	*value = scpi_numeric_to_float(parts->mantissa, parts->scale, parts->sticky,
+	                               parts->digits, parts->digits_length,
+	                               parts->exponent, &overflow);
+
+	if(overflow)
+	{
+		*value = (float)HUGE_VAL;
+	}
+
+	if(parts->negative)
+	{
+		*value = -*value;
+	}
+
+	return overflow ? SCPI_NUMERIC_OVERFLOW : SCPI_NUMERIC_SUCCESS;
+}
+
+/*
+ * Find the fixed-point value of a number split by scpi_split_numeric.
+ */
+static scpi_numeric_status_t
+scpi_numeric_fixed(const struct scpi_numeric_parts* parts, int places, int32_t default_value,
+                   int32_t min_value, int32_t max_value, int32_t* value)
+{
+	uint64_t mantissa;
+	uint64_t limit;
+	long power;
+	int dropped;
+	int sticky;
+	scpi_numeric_status_t status;
+
+	switch(parts->keyword)
+	{
+		case SCPI_NUMERIC_DEFAULT:
+			*value = default_value;
+			return SCPI_NUMERIC_SUCCESS;
+		case SCPI_NUMERIC_MAXIMUM:
+			*value = max_value;
+			return SCPI_NUMERIC_SUCCESS;
+		case SCPI_NUMERIC_MINIMUM:
+			*value = min_value;
+			return SCPI_NUMERIC_SUCCESS;
+	}
+
+	/* The magnitude of INT32_MIN is one more than that of INT32_MAX. */
+	limit = parts->negative ? (uint64_t)2147483648UL : (uint64_t)2147483647UL;
+	mantissa = parts->mantissa;
+	power = parts->scale + places;
+	sticky = parts->sticky;
+
+	if(power >= 0)
+	{
+		/* Digits dropped from the mantissa can only make it larger. */
+		for(; mantissa != 0 && mantissa <= limit && power > 0; power--)
+		{
+			mantissa *= 10;
+		}
+	}
+	else
+	{
+		/* Round to nearest, with ties to even, as the float parser does. */
+		dropped = 0;
+		for(; mantissa != 0 && power < 0; power++)
+		{
+			sticky |= dropped != 0;
+			dropped = (int)(mantissa % 10);
+			mantissa /= 10;
+		}
+
+		if(power < 0)
+		{
+			sticky |= dropped != 0;
+			dropped = 0;
+		}
+
+		if(dropped > 5 || (dropped == 5 && (sticky || (mantissa & 1))))
+		{
+			mantissa++;
+		}
+	}
+
+	status = SCPI_NUMERIC_SUCCESS;
+	if(mantissa > limit)
+	{
+		mantissa = limit;
+		status = SCPI_NUMERIC_OVERFLOW;
+	}
+
+	*value = parts->negative ? (int32_t)-(int64_t)mantissa : (int32_t)mantissa;
+
+	return status;
+}
+
+struct scpi_numeric
+scpi_parse_numeric(const char* str, size_t length, float default_value, float min_value, float max_value)
+{
+	struct scpi_numeric_parts parts;
+	struct scpi_numeric retval;
+
+	retval.value  = 0.0f;
+	retval.status = scpi_split_numeric(str, length, &parts);
+	retval.unit   = parts.unit;
+	retval.length = parts.unit_length;
+	retval.unit_id = parts.unit_id;
+
+	if(retval.status == SCPI_NUMERIC_SUCCESS)
+	{
+		retval.status = scpi_numeric_float(&parts, default_value, min_value, max_value,
+		                                   &retval.value);
+	}
+
+	return retval;
+}
+
+struct scpi_numeric_fixed
+scpi_parse_numeric_fixed(const char* str, size_t length, int places,
+                         int32_t default_value, int32_t min_value, int32_t max_value)
+{
+	struct scpi_numeric_parts parts;
+	struct scpi_numeric_fixed retval;
+
+	retval.value  = 0;
+	retval.status = scpi_split_numeric(str, length, &parts);
+	retval.unit   = parts.unit;
+	retval.length = parts.unit_length;
+	retval.unit_id = parts.unit_id;
+
+	if(retval.status == SCPI_NUMERIC_SUCCESS)
+	{
+		retval.status = scpi_numeric_fixed(&parts, places, default_value, min_value, max_value,
+		                                   &retval.value);
+	}
+
+	return retval;
+}
+
+/*
+ * Split the next element of a numeric list, for scpi_parse_numeric_list
+ * and scpi_parse_numeric_list_fixed.  Returns zero at the end of the
+ * list, or if the element is malformed or there is no room for it, in
+ * which case list->status and list->element say why and where.  Every
+ * number must have the unit of the first, which *numbers, the count of
+ * numbers so far as opposed to keywords, tells apart.  Units that are
+ * not recognised are compared by name.
+ */
+static int
+scpi_next_numeric_element(struct scpi_numeric_list* list, struct scpi_parameter_iterator* params,
+                          size_t capacity, struct scpi_numeric_parts* parts, size_t* numbers)
+{
+	struct scpi_token element;
+
+	if(!scpi_next_parameter(params, &element))
+	{
+		list->element = NULL;
+		list->element_length = 0;
+		return 0;
+	}
+
+	list->element = element.value;
+	list->element_length = element.length;
+
+	if(list->count == capacity)
+	{
+		list->status = SCPI_NUMERIC_TOO_MANY;
+		return 0;
+	}
+
+	if(element.type == SCPI_TT_BLOCK)
+	{
+		list->status = SCPI_NUMERIC_INVALID;
+		return 0;
+	}
+
+	list->status = scpi_split_numeric(element.value, element.length, parts);
+	if(list->status != SCPI_NUMERIC_SUCCESS)
+	{
+		return 0;
+	}
+
+	if(parts->keyword != SCPI_NUMERIC_NUMBER)
+	{
+		return 1;
+	}
+
+	if(*numbers == 0)
+	{
+		list->unit = parts->unit;
+		list->length = parts->unit_length;
+		list->unit_id = parts->unit_id;
+	}
+	else if(parts->unit_id != list->unit_id || (parts->unit_id == SCPI_UNIT_UNKNOWN
+	        && (parts->unit_length != list->length
+	            || memcmp(parts->unit, list->unit, list->length) != 0)))
+	{
+		list->status = SCPI_NUMERIC_SUFFIX;
+		return 0;
+	}
+
+	(*numbers)++;
+	return 1;
+}
+
+/*
+ * Prepare to parse a numeric list.  A list of nothing but whitespace has
+ * no elements, rather than one empty one.
+ */
+static void
+scpi_numeric_list_init(struct scpi_numeric_list* list, struct scpi_parameter_iterator* params,
+                       const char* str, size_t length)
+{
+	while(length > 0 && scpi_isspace(str[length-1]))
+	{
+		length--;
+	}
+
+	scpi_parameter_iterator_init(params, str, length);
+
+	list->count = 0;
+	list->status = SCPI_NUMERIC_SUCCESS;
+	list->element = NULL;
+	list->element_length = 0;
+	list->unit = NULL;
+	list->length = 0;
+	list->unit_id = SCPI_UNIT_NONE;
+}
+
+struct scpi_numeric_list
+scpi_parse_numeric_list(const char* str, size_t length, float* values, size_t capacity,
+                        float default_value, float min_value, float max_value)
+{
+	struct scpi_parameter_iterator params;
+	struct scpi_numeric_parts parts;
+	struct scpi_numeric_list retval;
+	size_t numbers;
+
+	numbers = 0;
+	scpi_numeric_list_init(&retval, &params, str, length);
+	while(scpi_next_numeric_element(&retval, &params, capacity, &parts, &numbers))
+	{
+		retval.status = scpi_numeric_float(&parts, default_value, min_value, max_value,
+		                                   &values[retval.count]);
+		if(retval.status != SCPI_NUMERIC_SUCCESS)
+		{
+			break;
+		}
+
+		retval.count++;
+	}
+
+	return retval;
+}
+
+struct scpi_numeric_list
+scpi_parse_numeric_list_fixed(const char* str, size_t length, int places, int32_t* values,
+                              size_t capacity, int32_t default_value, int32_t min_value,
+                              int32_t max_value)
+{
+	struct scpi_parameter_iterator params;
+	struct scpi_numeric_parts parts;
+	struct scpi_numeric_list retval;
+	size_t numbers;
+
+	numbers = 0;
+	scpi_numeric_list_init(&retval, &params, str, length);
+	while(scpi_next_numeric_element(&retval, &params, capacity, &parts, &numbers))
+	{
+		retval.status = scpi_numeric_fixed(&parts, places, default_value, min_value, max_value,
+		                                   &values[retval.count]);
+		if(retval.status != SCPI_NUMERIC_SUCCESS)
+		{
+			break;
+		}
+
+		retval.count++;
+	}
+
+	return retval;
+}
+
+#ifdef __AVR__
+
+/* The powers of ten that scpi_write_digits counts digits against. */
+static const uint32_t scpi_decimal_powers[10] SCPI_PROGMEM = {
+	1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+	10000UL, 1000UL, 100UL, 10UL, 1UL
+};
+
+#endif
+
+/*
+ * Write the decimal digits of a value, with no leading zeros but at
+ * least min_digits of them, returning how many were written.  The AVR
+ * has no divide instruction, so there each digit is found by
+ * subtracting its power of ten; elsewhere dividing by ten is quicker.
+ * The buffer must have room for ten characters.
+ */
+static size_t
+scpi_write_digits(char* buffer, uint32_t value, size_t min_digits)
+{
+#ifdef __AVR__
+	uint32_t power;
+	size_t i;
+	size_t length;
+	char digit;
+
+	length = 0;
+	for(i = 0; i < 10; i++)
+	{
+		scpi_read_table(&power, &scpi_decimal_powers[i], sizeof(power));
+
+		digit = '0';
+		while(value >= power)
+		{
+			value -= power;
+			digit++;
+		}
+
+		if(length != 0 || digit != '0' || 10 - i <= min_digits)
+		{
+			buffer[length++] = digit;
+		}
+	}
+
+	return length;
+#else
+	char digits[10];
+	size_t i;
+	size_t length;
+
+	length = 0;
+	do
+	{
+		digits[length++] = (char)('0' + value % 10);
+		value /= 10;
+	}
+	while(value != 0 || length < min_digits);
+
+	for(i = 0; i < length; i++)
+	{
+		buffer[i] = digits[length - 1 - i];
+	}
+
+	return length;
+#endif
+}
+
+/*
+ * Copy a formatted response into the caller's buffer, if it fits,
+ * returning its length or zero if it does not.
+ */
+static size_t
+scpi_copy_response(char* buffer, size_t size, const char* str, size_t length)
+{
+	if(length > size)
+	{
+		return 0;
+	}
+
+	memcpy(buffer, str, length);
+	return length;
+}
+
+size_t
+scpi_format_fixed(char* buffer, size_t size, int32_t value, int places)
+{
+	char str[SCPI_FORMAT_LENGTH];
+	char digits[10];
+	uint32_t magnitude;
+	size_t count;
+	size_t length;
+
+	if(places < 0 || places > 9)
+	{
+		return 0;
+	}
+
+	length = 0;
+	magnitude = (uint32_t)value;
+	if(value < 0)
+	{
+		str[length++] = '-';
+		magnitude = 0UL - magnitude;
+	}
+
+	count = scpi_write_digits(digits, magnitude, (size_t)places + 1);
+	memcpy(str + length, digits, count - places);
+	length += count - places;
+	if(places > 0)
+	{
+		str[length++] = '.';
+		memcpy(str + length, digits + count - places, places);
+		length += places;
+	}
+
+	return scpi_copy_response(buffer, size, str, length);
+}
+
+#ifndef __AVR__
+
+/* Powers of ten, all exact in a double, for scaling in scpi_format_float. */
+static const double scpi_pow10_double[23] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * Find 10^power as a double, for power up to 66, to within a few units
+ * in the last place.
+ */
+static double
+scpi_power_of_ten(int power)
+{
+	double result;
+
+	result = 1.0;
+	while(power > 22)
+	{
+		result *= scpi_pow10_double[22];
+		power -= 22;
+	}
+
+	return result * scpi_pow10_double[power];
+}
+
+/*
+ * The slack allowed for rounding in the scaled values of
+ * scpi_format_float, which are below 2e9 and found to within 1e-6.  An
+ * integer closer than this to the edge of the rounding interval is
+ * checked exactly.
+ */
+#define SCPI_FORMAT_SLACK 1e-4
+
+/*
+ * Check whether candidate*10^power rounds to the given float, by
+ * converting it back exactly.
+ */
+static int
+scpi_rounds_to(uint32_t candidate, int power, float value)
+{
+	char digits[10];
+	size_t length;
+	int overflow;
+
+	overflow = 0;
+	length = scpi_write_digits(digits, candidate, 1);
+	return scpi_numeric_to_float(candidate, power, 0, digits, length, power, &overflow) == value
+	       && !overflow;
+}
+
+size_t
+scpi_format_float(char* buffer, size_t size, float value)
+{
+	char str[SCPI_FORMAT_LENGTH];
+	char digits[10];
+	double scaled, low, high, below, above;
+	double scale;
+	double fraction;
+	uint32_t lowest, highest;
+	uint32_t first, last;
+	uint32_t candidate;
+	uint32_t end;
+	size_t count;
+	size_t length;
+	size_t i;
+	int binary_exponent;
+	int decimal_exponent;
+	int power;
+	int exponent;
+	int place;
+
+	/* SCPI reserves 9.9E37 for infinity and 9.91E37 for not a number. */
+	if(value != value)
+	{
+		return scpi_copy_response(buffer, size, "9.91E+37", 8);
+	}
+	if(value > FLT_MAX)
+	{
+		return scpi_copy_response(buffer, size, "9.9E+37", 7);
+	}
+	if(value < -FLT_MAX)
+	{
+		return scpi_copy_response(buffer, size, "-9.9E+37", 8);
+	}
+	if(value == 0.0f)
+	{
+		return scpi_copy_response(buffer, size, "0", 1);
+	}
+
+	length = 0;
+	if(value < 0.0f)
+	{
+		str[length++] = '-';
+		value = -value;
+	}
+
+	/*
+	 * The float rounds from anything strictly between the points
+	 * halfway to its neighbours, or on them if its mantissa is even.
+	 * These are exact in a double, as is the float.
+	 */
+	fraction = frexp(value, &binary_exponent);
+	above = ldexp(1.0, (binary_exponent < -125 ? -125 : binary_exponent) - 25);
+	below = above;
+	if(binary_exponent > -125 && fraction == 0.5)
+	{
+		below /= 2;
+	}
+
+	/*
+	 * Scale so that the value is between 1e8 and 2e9, where its nearest
+	 * integer has at least the nine digits that are enough to tell any
+	 * two floats apart.
+	 */
+	decimal_exponent = (int)floor((binary_exponent - 1) * 0.30102999566398120);
+	power = 8 - decimal_exponent;
+	scale = scpi_power_of_ten(power < 0 ? -power : power);
+	if(power < 0)
+	{
+		scaled = value / scale;
+		low = ((double)value - below) / scale;
+		high = ((double)value + above) / scale;
+	}
+	else
+	{
+		scaled = value * scale;
+		low = ((double)value - below) * scale;
+		high = ((double)value + above) * scale;
+	}
+
+	/*
+	 * The integers from lowest to highest may round to the value, and
+	 * do unless they are within the slack of an end.
+	 */
+	lowest = (uint32_t)(low - SCPI_FORMAT_SLACK);
+	if(lowest < low - SCPI_FORMAT_SLACK)
+	{
+		lowest++;
+	}
+	highest = (uint32_t)(high + SCPI_FORMAT_SLACK);
+
+	for(;;)
+	{
+		/* Drop digits for as long as some number in the range ends in zero. */
+		first = lowest;
+		last = highest;
+		place = 0;
+		while((first + 9) / 10 <= last / 10)
+		{
+			first = (first + 9) / 10;
+			last /= 10;
+			place++;
+		}
+
+		/* Of the numbers with that many digits, take the nearest. */
+		candidate = (uint32_t)(scaled / scpi_pow10_double[place] + 0.5);
+		if(candidate < first)
+		{
+			candidate = first;
+		}
+		else if(candidate > last)
+		{
+			candidate = last;
+		}
+
+		end = candidate * (uint32_t)scpi_pow10_double[place];
+		if(end < low + SCPI_FORMAT_SLACK && !scpi_rounds_to(candidate, place - power, value))
+		{
+			lowest++;
+		}
+		else if(end > high - SCPI_FORMAT_SLACK && !scpi_rounds_to(candidate, place - power, value))
+		{
+			highest--;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	count = scpi_write_digits(digits, candidate, 1);
+	exponent = place - power + (int)count - 1;
+
+	if(exponent >= -4 && exponent < 9)
+	{
+		/* In plain decimal notation, NR1 or NR2. */
+		if(exponent < 0)
+		{
+			str[length++] = '0';
+			str[length++] = '.';
+			for(i = 1; i < (size_t)-exponent; i++)
+			{
+				str[length++] = '0';
+			}
+		}
+		for(i = 0; i < count || (int)i <= exponent; i++)
+		{
+			if(exponent >= 0 && (int)i == exponent + 1)
+			{
+				str[length++] = '.';
+			}
+			str[length++] = i < count ? digits[i] : '0';
+		}
+	}
+	else
+	{
+		/* In scientific notation, NR3. */
+		str[length++] = digits[0];
+		if(count > 1)
+		{
+			str[length++] = '.';
+			memcpy(str + length, digits + 1, count - 1);
+			length += count - 1;
+		}
+		str[length++] = 'E';
+		str[length++] = exponent < 0 ? '-' : '+';
+		length += scpi_write_digits(str + length, exponent < 0 ? -exponent : exponent, 2);
+	}
+
+	return scpi_copy_response(buffer, size, str, length);
+}
+
+#endif
+
+/*
+ * The text of each error in the catalog, which is kept in program memory
+ * on the AVR and read only when an error is formatted.
+ */
+struct scpi_error_entry
+{
+	short id;
+	char  description[27];
+};
+
+static const struct scpi_error_entry scpi_error_catalog[SCPI_ERROR_MESSAGES] SCPI_PROGMEM = {
+	{    0, "No error" },
+	{ -100, "Command error" },
+	{ -101, "Invalid character" },
+	{ -102, "Syntax error" },
+	{ -104, "Data type error" },
+	{ -108, "Parameter not allowed" },
+	{ -109, "Missing parameter" },
+	{ -113, "Undefined header" },
+	{ -114, "Header suffix out of range" },
+	{ -120, "Numeric data error" },
+	{ -131, "Invalid suffix" },
+	{ -160, "Block data error" },
+	{ -200, "Execution error" },
+	{ -222, "Data out of range" },
+	{ -223, "Too much data" },
+	{ -224, "Illegal parameter value" },
+	{ -300, "Device-specific error" },
+	{ -350, "Queue overflow" },
+	{ -400, "Query error" }
+};
+
+#if SCPI_ERROR_QUEUE_ATOMIC
+
+/*
+ * The lock-free queue is a bounded MPSC ring.  A producer claims the
+ * position at the tail by compare-and-swap once the slot's sequence
+ * number shows that the consumer has freed it, then writes its error and
+ * publishes it by setting the sequence number to one past the position.
+ *
+ * The overflow word of the slot for position p is 2p while the error
+ * there may still be replaced, and 2p+1 once it has been.  A producer
+ * that finds the queue full replaces the newest error by setting the
+ * word, and the consumer exchanges it for the value for the slot's next
+ * position as it takes the error, so that a producer that comes too late
+ * sees that the queue has room again.
+ */
+void
+scpi_queue_error(struct scpi_parser_context* ctx, scpi_error_message_t message)
+{
+	struct scpi_error_slot* slot;
+	size_t position;
+	size_t sequence;
+	size_t overflow;
+	short id;
+
+	for(;;)
+	{
+		position = __atomic_load_n(&ctx->error_queue_tail, __ATOMIC_ACQUIRE);
+		slot = &ctx->error_queue[position % SCPI_ERROR_QUEUE_LENGTH];
+		sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+		if(sequence == position)
+		{
+			if(__atomic_compare_exchange_n(&ctx->error_queue_tail, &position, position + 1, 1,
+			                               __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			{
+				scpi_read_table(&id, &scpi_error_catalog[message].id, sizeof(id));
+				slot->error.id = id;
+				slot->error.message = (unsigned char)message;
+				__atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+				return;
+			}
+		}
+		else if((ptrdiff_t)(sequence - position) < 0)
+		{
+			/* Full, so the newest error is replaced unless it has been taken. */
+			slot = &ctx->error_queue[(position - 1) % SCPI_ERROR_QUEUE_LENGTH];
+			overflow = 2*(position - 1);
+			if(__atomic_compare_exchange_n(&slot->overflow, &overflow, overflow + 1, 0,
+			                               __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+			   || overflow == 2*(position - 1) + 1)
+			{
+				return;
+			}
+
+			message = SCPI_ERROR_QUEUE_OVERFLOW;
+		}
+	}
+}
+
+struct scpi_error
+scpi_pop_error(struct scpi_parser_context* ctx)
+{
+	struct scpi_error_slot* slot;
+	struct scpi_error error;
+	size_t position;
+	size_t next;
+	short id;
+
+	position = ctx->error_queue_head;
+	slot = &ctx->error_queue[position % SCPI_ERROR_QUEUE_LENGTH];
+	if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != position + 1)
+	{
+		error.id = 0;
+		error.message = SCPI_ERROR_NONE;
+		return error;
+	}
+
+	error = slot->error;
+	next = position + SCPI_ERROR_QUEUE_LENGTH;
+	if(__atomic_exchange_n(&slot->overflow, 2*next, __ATOMIC_ACQ_REL) == 2*position + 1)
+	{
+		scpi_read_table(&id, &scpi_error_catalog[SCPI_ERROR_QUEUE_OVERFLOW].id, sizeof(id));
+		error.id = id;
+		error.message = SCPI_ERROR_QUEUE_OVERFLOW;
+	}
+
+	ctx->error_queue_head = position + 1;
+	__atomic_store_n(&slot->sequence, next, __ATOMIC_RELEASE);
+
+	return error;
+}
+
+#else
+
+void
+scpi_queue_error(struct scpi_parser_context* ctx, scpi_error_message_t message)
+{
+	struct scpi_error* error;
+	short id;
+
+	if(ctx->error_queue_count == SCPI_ERROR_QUEUE_LENGTH)
+	{
+		message = SCPI_ERROR_QUEUE_OVERFLOW;
+		error = &ctx->error_queue[(ctx->error_queue_start + SCPI_ERROR_QUEUE_LENGTH - 1)
+		                         % SCPI_ERROR_QUEUE_LENGTH];
+	}
+	else
+	{
+		error = &ctx->error_queue[(ctx->error_queue_start + ctx->error_queue_count)
+		                         % SCPI_ERROR_QUEUE_LENGTH];
+		ctx->error_queue_count++;
+	}
+
+	scpi_read_table(&id, &scpi_error_catalog[message].id, sizeof(id));
+	error->id = id;
+	error->message = (unsigned char)message;
+}
+
+struct scpi_error
+scpi_pop_error(struct scpi_parser_context* ctx)
+{
+	struct scpi_error error;
+
+	if(ctx->error_queue_count == 0)
+	{
+		error.id = 0;
+		error.message = SCPI_ERROR_NONE;
+	}
+	else
+	{
+		error = ctx->error_queue[ctx->error_queue_start];
+		ctx->error_queue_start = (unsigned char)((ctx->error_queue_start + 1)
+		                                         % SCPI_ERROR_QUEUE_LENGTH);
+		ctx->error_queue_count--;
+	}
+
+	return error;
+}
+
+#endif
+
+size_t
+scpi_format_error(char* buffer, size_t size, struct scpi_error error)
+{
+	struct scpi_error_entry entry;
+	char str[SCPI_ERROR_LENGTH];
+	size_t length;
+	size_t i;
+
+	length = 0;
+	if(error.id < 0)
+	{
+		str[length++] = '-';
+	}
+	length += scpi_write_digits(str + length, (uint32_t)(error.id < 0 ? -error.id : error.id), 1);
+
+	scpi_read_table(&entry, &scpi_error_catalog[error.message < SCPI_ERROR_MESSAGES
+	                                            ? error.message : SCPI_ERROR_NONE],
+	                sizeof(entry));
+	str[length++] = ',';
+	str[length++] = '"';
+	for(i = 0; i < sizeof(entry.description) && entry.description[i] != '\0'; i++)
+	{
+		str[length++] = entry.description[i];
+	}
+	str[length++] = '"';
+
+	return scpi_copy_response(buffer, size, str, length);
+}
+
+/*
+ * Empty the response buffer, without writing it out.
+ */
+static void
+scpi_output_reset(struct scpi_parser_context* ctx)
+{
+	ctx->output_message = 0;
+	ctx->output_unit = 0;
+	ctx->output_length = 0;
+}
+
+/*
+ * Write out the part of the response that is in the buffer.
+ */
+static void
+scpi_output_drain(struct scpi_parser_context* ctx)
+{
+	if(ctx->output != NULL && ctx->output_length > 0)
+	{
+		ctx->output(ctx->output_opaque, ctx->output_buffer, ctx->output_length);
+	}
+
+	ctx->output_length = 0;
+}
+
+/*
+ * Append a byte to the response.
+ */
+static void
+scpi_output_char(struct scpi_parser_context* ctx, char c)
+{
+	if(ctx->output_length == SCPI_RESPONSE_BUFFER_LENGTH)
+	{
+		scpi_output_drain(ctx);
+	}
+
+	ctx->output_buffer[ctx->output_length++] = c;
+}
+
+void
+scpi_set_output(struct scpi_parser_context* ctx, scpi_write_t output, void* opaque)
+{
+	ctx->output = output;
+	ctx->output_opaque = opaque;
+}
+
+/*
+ * Begin the response of the command being executed, if it has not been
+ * already, separating it from that of the previous command.
+ */
+static void
+scpi_output_begin(struct scpi_parser_context* ctx)
+{
+	if(!ctx->output_unit)
+	{
+		if(ctx->output_message)
+		{
+			scpi_output_char(ctx, ';');
+		}
+
+		ctx->output_message = 1;
+		ctx->output_unit = 1;
+	}
+}
+
+#if SCPI_RESPONSE_BUFFER_LENGTH <= SCPI_FORMAT_LENGTH
+#error "SCPI_RESPONSE_BUFFER_LENGTH must be greater than SCPI_FORMAT_LENGTH"
+#endif
+
+/*
+ * Make room for a value of up to SCPI_FORMAT_LENGTH bytes, and one more
+ * for a separator, at the end of the response buffer, and return the
+ * address at which it is to be written.
+ */
+static char*
+scpi_output_reserve(struct scpi_parser_context* ctx)
+{
+	if(SCPI_RESPONSE_BUFFER_LENGTH - ctx->output_length < SCPI_FORMAT_LENGTH + 1)
+	{
+		scpi_output_drain(ctx);
+	}
+
+	return ctx->output_buffer + ctx->output_length;
+}
+
+void
+scpi_write(struct scpi_parser_context* ctx, const char* data, size_t length)
+{
+	size_t count;
+
+	scpi_output_begin(ctx);
+
+	/* Data too long for the buffer is written directly, after what precedes it. */
+	if(length >= SCPI_RESPONSE_BUFFER_LENGTH)
+	{
+		scpi_output_drain(ctx);
+		if(ctx->output != NULL)
+		{
+			ctx->output(ctx->output_opaque, data, length);
+		}
+		return;
+	}
+
+	count = SCPI_RESPONSE_BUFFER_LENGTH - ctx->output_length;
+	if(count < length)
+	{
+		memcpy(ctx->output_buffer + ctx->output_length, data, count);
+		ctx->output_length += count;
+		scpi_output_drain(ctx);
+
+		data += count;
+		length -= count;
+	}
+
+	memcpy(ctx->output_buffer + ctx->output_length, data, length);
+	ctx->output_length += length;
+}
+
+void
+scpi_write_string(struct scpi_parser_context* ctx, const char* str)
+{
+	scpi_write(ctx, str, strlen(str));
+}
+
+void
+scpi_write_fixed(struct scpi_parser_context* ctx, int32_t value, int places)
+{
+	char response[SCPI_FORMAT_LENGTH];
+
+	scpi_write(ctx, response, scpi_format_fixed(response, sizeof(response), value, places));
+}
+
+/*
+ * Begin a definite-length block of the given length.
+ */
+static void
+scpi_write_block_header(struct scpi_parser_context* ctx, uint32_t length)
+{
+	char* str;
+	size_t digits;
+
+	scpi_output_begin(ctx);
+	str = scpi_output_reserve(ctx);
+
+	digits = scpi_write_digits(str + 2, length, 1);
+	str[0] = '#';
+	str[1] = (char)('0' + digits);
+	ctx->output_length += digits + 2;
+}
+
+void
+scpi_write_block(struct scpi_parser_context* ctx, const char* data, size_t length)
+{
+	scpi_write_block_header(ctx, (uint32_t)length);
+	scpi_write(ctx, data, length);
+}
+
+/*
+ * The number of bytes of each value in the selected data format, or zero
+ * for ASCii.
+ */
+static size_t
+scpi_data_size(struct scpi_parser_context* ctx)
+{
+	switch(ctx->format_data)
+	{
+		case SCPI_DATA_INTEGER:
+			return 2;
+
+		case SCPI_DATA_REAL:
+			return 4;
+
+		default:
+			return 0;
+	}
+}
+
+/*
+ * Write the bytes of a binary value, in the order that FORMat:BORDer
+ * selects: most significant first if NORMal, and least if SWAPped.
+ */
+static void
+scpi_store_word(struct scpi_parser_context* ctx, uint32_t word, size_t size)
+{
+	char* str;
+	size_t i;
+
+	str = ctx->output_buffer + ctx->output_length;
+	for(i = 0; i < size; i++)
+	{
+		str[ctx->format_swapped ? i : size - 1 - i] = (char)(word & 0xFF);
+		word >>= 8;
+	}
+
+	ctx->output_length += size;
+}
+
+/*
+ * The bits of a single-precision number, as written in REAL format.
+ */
+static uint32_t
+scpi_float_bits(float value)
+{
+	uint32_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+void
+scpi_write_integers(struct scpi_parser_context* ctx, const int16_t* values, size_t count)
+{
+	char* str;
+	size_t size;
+	size_t i;
+
+	size = scpi_data_size(ctx);
+	if(size != 0)
+	{
+		scpi_write_block_header(ctx, (uint32_t)(count * size));
+	}
+	else
+	{
+		scpi_output_begin(ctx);
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		str = scpi_output_reserve(ctx);
+		if(size == 2)
+		{
+			scpi_store_word(ctx, (uint16_t)values[i], 2);
+		}
+		else if(size == 4)
+		{
+			scpi_store_word(ctx, scpi_float_bits(values[i]), 4);
+		}
+		else
+		{
+			if(i > 0)
+			{
+				*str++ = ',';
+				ctx->output_length++;
+			}
+
+			ctx->output_length += scpi_format_fixed(str, SCPI_FORMAT_LENGTH, values[i], 0);
+		}
+	}
+}
+
+#ifndef __AVR__
+
+void
+scpi_write_float(struct scpi_parser_context* ctx, float value)
+{
+	char response[SCPI_FORMAT_LENGTH];
+
+	scpi_write(ctx, response, scpi_format_float(response, sizeof(response), value));
+}
+
+/*
+ * Round a number to the nearest 16-bit integer, limiting it to the range
+ * of one.  NaN becomes zero.
+ */
+static int16_t
+scpi_round_integer(float value)
+{
+	if(value >= 32767.0f)
+	{
+		return 32767;
+	}
+	else if(value <= -32768.0f)
+	{
+		return -32768;
+	}
+	else if(value != value)
+	{
+		return 0;
+	}
+
+	return (int16_t)floor(value + 0.5f);
+}
+
+void
+scpi_write_reals(struct scpi_parser_context* ctx, const float* values, size_t count)
+{
+	char* str;
+	size_t size;
+	size_t i;
+
+	size = scpi_data_size(ctx);
+	if(size != 0)
+	{
+		scpi_write_block_header(ctx, (uint32_t)(count * size));
+	}
+	else
+	{
+		scpi_output_begin(ctx);
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		str = scpi_output_reserve(ctx);
+		if(size == 2)
+		{
+			scpi_store_word(ctx, (uint16_t)scpi_round_integer(values[i]), 2);
+		}
+		else if(size == 4)
+		{
+			scpi_store_word(ctx, scpi_float_bits(values[i]), 4);
+		}
+		else
+		{
+			if(i > 0)
+			{
+				*str++ = ',';
+				ctx->output_length++;
+			}
+
+			ctx->output_length += scpi_format_float(str, SCPI_FORMAT_LENGTH, values[i]);
+		}
+	}
+}
+
+#endif
+
+void
+scpi_flush(struct scpi_parser_context* ctx)
+{
+	if(ctx->output_message)
+	{
+		scpi_output_char(ctx, '\n');
+	}
+
+	scpi_output_drain(ctx);
+	scpi_output_reset(ctx);
+}
+
+/*
+ * Find an instrument by name, returning its index, or the number of
+ * instruments if there is none of that name.
+ */
+static unsigned char
+scpi_router_find(struct scpi_router* router, const char* name, size_t length)
+{
+	const char* candidate;
+	unsigned char i;
+	size_t j;
+
+	for(i = 0; i < router->count; i++)
+	{
+		candidate = router->names[i];
+		for(j = 0; j < length && candidate[j] != '\0'; j++)
+		{
+			if(scpi_fold_char(candidate[j]) != scpi_fold_char(name[j]))
+			{
+				break;
+			}
+		}
+
+		if(j == length && candidate[j] == '\0')
+		{
+			break;
+		}
+	}
+
+	return i;
+}
+
+/*
+ * INSTrument[:SELect] <name>
+ */
+static scpi_error_t
+instrument_select(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	struct scpi_parameter_iterator params;
+	struct scpi_token name;
+	struct scpi_token extra;
+	unsigned char instrument;
+
+	if(ctx->router == NULL)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_UNDEFINED_HEADER);
+		return SCPI_SUCCESS;
+	}
+
+	scpi_parameter_iterator_init(&params, command->value, command->length);
+	if(!scpi_next_parameter(&params, &name))
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_MISSING_PARAMETER);
+		return SCPI_SUCCESS;
+	}
+	else if(scpi_next_parameter(&params, &extra))
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_PARAMETER_NOT_ALLOWED);
+		return SCPI_SUCCESS;
+	}
+
+	instrument = scpi_router_find(ctx->router, name.value, name.length);
+	if(instrument == ctx->router->count)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_ILLEGAL_PARAMETER);
+		return SCPI_SUCCESS;
+	}
+
+	ctx->router->selected = instrument;
+	return SCPI_SUCCESS;
+}
+
+static scpi_error_t
+instrument_select_query(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	if(ctx->router == NULL)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_UNDEFINED_HEADER);
+		return SCPI_SUCCESS;
+	}
+
+	scpi_write_string(ctx, ctx->router->names[ctx->router->selected]);
+	return SCPI_SUCCESS;
+}
+
+/*
+ * INSTrument:NSELect <n>
+ */
+static scpi_error_t
+instrument_nselect(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	struct scpi_numeric_fixed number;
+
+	if(ctx->router == NULL)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_UNDEFINED_HEADER);
+		return SCPI_SUCCESS;
+	}
+
+	number = scpi_parse_numeric_fixed(command->value, command->length, 0,
+	                                  1, 1, ctx->router->count);
+	if(number.status == SCPI_NUMERIC_EMPTY)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_MISSING_PARAMETER);
+	}
+	else if(number.status != SCPI_NUMERIC_SUCCESS || number.unit_id != SCPI_UNIT_NONE)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_NUMERIC_DATA);
+	}
+	else if(number.value < 1 || number.value > ctx->router->count)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_DATA_OUT_OF_RANGE);
+	}
+	else
+	{
+		ctx->router->selected = (unsigned char)(number.value - 1);
+	}
+
+	return SCPI_SUCCESS;
+}
+
+static scpi_error_t
+instrument_nselect_query(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	if(ctx->router == NULL)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_UNDEFINED_HEADER);
+		return SCPI_SUCCESS;
+	}
+
+	scpi_write_fixed(ctx, ctx->router->selected + 1, 0);
+	return SCPI_SUCCESS;
+}
+
+static scpi_error_t
+instrument_catalog_query(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	unsigned char i;
+
+	if(ctx->router == NULL)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_UNDEFINED_HEADER);
+		return SCPI_SUCCESS;
+	}
+
+	for(i = 0; i < ctx->router->count; i++)
+	{
+		scpi_write(ctx, i == 0 ? "\"" : ",\"", i == 0 ? 1 : 2);
+		scpi_write_string(ctx, ctx->router->names[i]);
+		scpi_write(ctx, "\"", 1);
+	}
+
+	return SCPI_SUCCESS;
+}
+
+/*
+ * The INSTrument subtree, which is followed by the FORMat subtree.
+ */
+SCPI_COMMAND(scpi_instrument_catalog_command, "CATALOG?", "CAT?", instrument_catalog_query,
+				NULL, NULL);
+SCPI_COMMAND(scpi_instrument_nselect_query_command, "NSELECT?", "NSEL?",
+				instrument_nselect_query, NULL, &scpi_instrument_catalog_command);
+SCPI_COMMAND(scpi_instrument_nselect_command, "NSELECT", "NSEL", instrument_nselect,
+				NULL, &scpi_instrument_nselect_query_command);
+SCPI_COMMAND(scpi_instrument_select_query_command, "SELECT?", "SEL?", instrument_select_query,
+				NULL, &scpi_instrument_nselect_command);
+SCPI_COMMAND(scpi_instrument_select_command, "SELECT", "SEL", instrument_select,
+				NULL, &scpi_instrument_select_query_command);
+SCPI_COMMAND(scpi_instrument_command, "INSTRUMENT", "INST", instrument_select,
+				&scpi_instrument_select_command, &scpi_format_command);
+
+void
+scpi_router_init(struct scpi_router* router)
+{
+	router->count = 0;
+	router->selected = 0;
+}
+
+int
+scpi_router_add(struct scpi_router* router, struct scpi_parser_context* ctx, const char* name)
+{
+	struct scpi_command* instrument;
+
+	if(router->count == SCPI_ROUTER_INSTRUMENTS)
+	{
+		return 0;
+	}
+
+	/* SELect is the default node of INSTrument, and so may be left out. */
+	if(!ctx->command_tree_in_flash && !ctx->command_tree_shared)
+	{
+		instrument = scpi_register_command(
+					ctx->command_tree, SCPI_CL_CHILD, "INSTRUMENT", 10,
+													  "INST", 4, instrument_select);
+		scpi_register_command(instrument, SCPI_CL_CHILD, "SELECT", 6, "SEL", 3,
+								instrument_select);
+		scpi_register_command(instrument, SCPI_CL_CHILD, "SELECT?", 7, "SEL?", 4,
+								instrument_select_query);
+		scpi_register_command(instrument, SCPI_CL_CHILD, "NSELECT", 7, "NSEL", 4,
+								instrument_nselect);
+		scpi_register_command(instrument, SCPI_CL_CHILD, "NSELECT?", 8, "NSEL?", 5,
+								instrument_nselect_query);
+		scpi_register_command(instrument, SCPI_CL_CHILD, "CATALOG?", 8, "CAT?", 4,
+								instrument_catalog_query);
+	}
+
+	ctx->router = router;
+	router->instruments[router->count] = ctx;
+	router->names[router->count] = name;
+
+	return ++router->count;
+}
+
+scpi_error_t
+scpi_router_feed(struct scpi_router* router, char c)
+{
+	struct scpi_parser_context* from;
+	struct scpi_parser_context* to;
+	scpi_error_t error;
+
+	from = router->instruments[router->selected];
+	error = scpi_feed(from, c);
+
+	to = router->instruments[router->selected];
+	if(to != from && error == SCPI_INCOMPLETE)
+	{
+		/*
+		 * The rest of the message goes to the new instrument, beginning at
+		 * the root of its tree, and its responses follow those so far.
+		 */
+		memcpy(to->output_buffer, from->output_buffer, from->output_length);
+		to->output_length = from->output_length;
+		to->output_message = from->output_message;
+
+		scpi_output_reset(from);
+		scpi_feed_reset(from);
+	}
+
+	return error;
+}
+
+/*
+ * The indices of a receive ring are published with release ordering and
+ * read with acquire ordering where the atomic builtins are available, so
+ * that another thread may fill it.  On AVR, a one-byte volatile index is
+ * enough for an interrupt handler.
+ */
+#if defined(__GNUC__) && !defined(__AVR__)
+#define SCPI_RING_LOAD(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define SCPI_RING_STORE(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
+#else
+#define SCPI_RING_LOAD(index) (index)
+#define SCPI_RING_STORE(index, value) ((index) = (value))
+#endif
+
+void
+scpi_receive_init(struct scpi_receive_ring* ring)
+{
+	ring->head = 0;
+	ring->tail = 0;
+	ring->high_water = 0;
+	ring->overflows = 0;
+}
+
+int
+scpi_receive(struct scpi_receive_ring* ring, char c)
+{
+	scpi_receive_index_t head;
+	scpi_receive_index_t next;
+	scpi_receive_index_t tail;
+	scpi_receive_index_t count;
+
+	head = ring->head;
+	next = (scpi_receive_index_t)(head + 1 == SCPI_RECEIVE_BUFFER_LENGTH ? 0 : head + 1);
+	tail = SCPI_RING_LOAD(ring->tail);
+	if(next == tail)
+	{
+		ring->overflows++;
+		return 0;
+	}
+
+	ring->buffer[head] = c;
+	SCPI_RING_STORE(ring->head, next);
+
+	count = (scpi_receive_index_t)(next >= tail ? next - tail
+											: next + SCPI_RECEIVE_BUFFER_LENGTH - tail);
+	if(count > ring->high_water)
+	{
+		ring->high_water = count;
+	}
+
+	return 1;
+}
+
+int
+scpi_receive_peek(struct scpi_receive_ring* ring, char* c)
+{
+	scpi_receive_index_t tail;
+
+	tail = ring->tail;
+	if(tail == SCPI_RING_LOAD(ring->head))
+	{
+		return 0;
+	}
+
+	*c = ring->buffer[tail];
+	return 1;
+}
+
+void
+scpi_receive_consume(struct scpi_receive_ring* ring)
+{
+	scpi_receive_index_t tail;
+
+	tail = ring->tail;
+	SCPI_RING_STORE(ring->tail,
+		(scpi_receive_index_t)(tail + 1 == SCPI_RECEIVE_BUFFER_LENGTH ? 0 : tail + 1));
+}
+
+scpi_error_t
+scpi_receive_drain(struct scpi_parser_context* ctx, struct scpi_receive_ring* ring)
+{
+	scpi_error_t result;
+	scpi_error_t error;
+	char c;
+
+	result = SCPI_INCOMPLETE;
+	while(scpi_receive_peek(ring, &c))
+	{
+		error = scpi_feed(ctx, c);
+		if(error == SCPI_PENDING)
+		{
+			return SCPI_PENDING;
+		}
+
+		scpi_receive_consume(ring);
+		if(error != SCPI_INCOMPLETE)
+		{
+			result = error;
+		}
+	}
+
+	return result;
 }
 
 #ifdef __cplusplus
@@ -23,7 +23,12 @@ SOFTWARE.
 #ifndef __SCPIPARSER_H
 #define __SCPIPARSER_H
 
-#include <Arduino.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#endif
 
 #ifdef __cplusplus
 
@@ -35,7 +40,11 @@ typedef enum scpi_error_codes
 {
 	SCPI_SUCCESS			=  0,
 	SCPI_COMMAND_NOT_FOUND	= -1,
-	SCPI_NO_CALLBACK		= -2
+	SCPI_NO_CALLBACK		= -2,
+	SCPI_TOO_MANY_TOKENS	= -3,
+	SCPI_BUFFER_OVERFLOW	= -4,
+	SCPI_INCOMPLETE			=  1,
+	SCPI_PENDING			=  2
 } scpi_error_t;
 
 typedef enum scpi_command_location
@@ -44,12 +53,204 @@ typedef enum scpi_command_location
 	SCPI_CL_CHILD
 } scpi_command_location_t;
 
+typedef enum scpi_token_type
+{
+	SCPI_TT_HEADER		= 0,
+	SCPI_TT_PARAMETERS	= 1,
+	SCPI_TT_BLOCK		= 2
+} scpi_token_type_t;
+
+/*
+ * The maximum number of tokens produced when a command is executed.  Every
+ * header mnemonic takes one token, and the parameters take one more.
+ */
+#ifndef SCPI_MAX_TOKENS
+#define SCPI_MAX_TOKENS 8
+#endif
+
+/*
+ * The number of bytes that scpi_feed can hold while a command arrives.
+ * This must be long enough for the longest mnemonic and the longest
+ * parameter list that the instrument accepts.
+ */
+#ifndef SCPI_INPUT_BUFFER_LENGTH
+#define SCPI_INPUT_BUFFER_LENGTH 64
+#endif
+
+/*
+ * The number of recently-executed headers that scpi_execute_command
+ * remembers, and the longest header that it will remember.  The cache is
+ * disabled by default on AVR, where RAM is scarce.
+ */
+#ifndef SCPI_HEADER_CACHE_SIZE
+#ifdef __AVR__
+#define SCPI_HEADER_CACHE_SIZE 0
+#else
+#define SCPI_HEADER_CACHE_SIZE 4
+#endif
+#endif
+
+#ifndef SCPI_HEADER_CACHE_LENGTH
+#define SCPI_HEADER_CACHE_LENGTH 32
+#endif
+
+/*
+ * The number of errors that the error queue holds.  SCPI requires room
+ * for at least two.
+ */
+#ifndef SCPI_ERROR_QUEUE_LENGTH
+#ifdef __AVR__
+#define SCPI_ERROR_QUEUE_LENGTH 4
+#else
+#define SCPI_ERROR_QUEUE_LENGTH 16
+#endif
+#endif
+
+/*
+ * The number of operations that may be left pending at once, which is at
+ * most the largest unsigned int.  A callback that may leave many running
+ * should compare ctx->operations_pending with this before it starts one,
+ * since the parser refuses any beyond it only after the callback returns.
+ */
+#ifndef SCPI_MAX_PENDING
+#define SCPI_MAX_PENDING ((unsigned int)-1)
+#endif
+
+/*
+ * Whether the error queue may be written by several threads at once,
+ * while one reads it, without a lock.  This needs the GCC atomic
+ * builtins, and is enabled by default wherever they are available other
+ * than on AVR.
+ */
+#ifndef SCPI_ERROR_QUEUE_ATOMIC
+#if defined(__GNUC__) && !defined(__AVR__)
+#define SCPI_ERROR_QUEUE_ATOMIC 1
+#else
+#define SCPI_ERROR_QUEUE_ATOMIC 0
+#endif
+#endif
+
+/*
+ * The number of bytes of response that a parser context collects before
+ * writing them out.  A longer response is written in several pieces.
+ */
+#ifndef SCPI_RESPONSE_BUFFER_LENGTH
+#ifdef __AVR__
+#define SCPI_RESPONSE_BUFFER_LENGTH 64
+#else
+#define SCPI_RESPONSE_BUFFER_LENGTH 256
+#endif
+#endif
+
+/*
+ * The number of instruments that a router can hold.
+ */
+#ifndef SCPI_ROUTER_INSTRUMENTS
+#define SCPI_ROUTER_INSTRUMENTS 4
+#endif
+
+/*
+ * The size of a receive ring, which holds one byte fewer than this.  On
+ * AVR it may be at most 256, so that an index is read and written in a
+ * single instruction.
+ */
+#ifndef SCPI_RECEIVE_BUFFER_LENGTH
+#ifdef __AVR__
+#define SCPI_RECEIVE_BUFFER_LENGTH 128
+#else
+#define SCPI_RECEIVE_BUFFER_LENGTH 256
+#endif
+#endif
+
+#if SCPI_RECEIVE_BUFFER_LENGTH <= 256
+typedef unsigned char scpi_receive_index_t;
+#elif defined(__AVR__)
+#error "SCPI_RECEIVE_BUFFER_LENGTH must be at most 256 on AVR"
+#else
+typedef size_t scpi_receive_index_t;
+#endif
+
+/**
+ * The errors in the catalog, each with the number and text of the
+ * standard SCPI error that it stands for.
+ */
+typedef enum scpi_error_message
+{
+	SCPI_ERROR_NONE = 0,              /*    0, No error */
+	SCPI_ERROR_COMMAND,               /* -100, Command error */
+	SCPI_ERROR_INVALID_CHARACTER,     /* -101, Invalid character */
+	SCPI_ERROR_SYNTAX,                /* -102, Syntax error */
+	SCPI_ERROR_DATA_TYPE,             /* -104, Data type error */
+	SCPI_ERROR_PARAMETER_NOT_ALLOWED, /* -108, Parameter not allowed */
+	SCPI_ERROR_MISSING_PARAMETER,     /* -109, Missing parameter */
+	SCPI_ERROR_UNDEFINED_HEADER,      /* -113, Undefined header */
+	SCPI_ERROR_HEADER_SUFFIX,         /* -114, Header suffix out of range */
+	SCPI_ERROR_NUMERIC_DATA,          /* -120, Numeric data error */
+	SCPI_ERROR_INVALID_SUFFIX,        /* -131, Invalid suffix */
+	SCPI_ERROR_BLOCK_DATA,            /* -160, Block data error */
+	SCPI_ERROR_EXECUTION,             /* -200, Execution error */
+	SCPI_ERROR_DATA_OUT_OF_RANGE,     /* -222, Data out of range */
+	SCPI_ERROR_TOO_MUCH_DATA,         /* -223, Too much data */
+	SCPI_ERROR_ILLEGAL_PARAMETER,     /* -224, Illegal parameter value */
+	SCPI_ERROR_DEVICE_SPECIFIC,       /* -300, Device-specific error */
+	SCPI_ERROR_QUEUE_OVERFLOW,        /* -350, Queue overflow */
+	SCPI_ERROR_QUERY,                 /* -400, Query error */
+	SCPI_ERROR_MESSAGES
+} scpi_error_message_t;
+
+/**
+ * The encodings of numeric responses that FORMat:DATA selects.
+ */
+typedef enum scpi_data_format
+{
+	SCPI_DATA_ASCII   = 0, /* ASCii, comma-separated decimal numbers */
+	SCPI_DATA_INTEGER = 1, /* INTeger,16, a block of 16-bit integers */
+	SCPI_DATA_REAL    = 2  /* REAL,32, a block of IEEE 754 single-precision numbers */
+} scpi_data_format_t;
+
+/*
+ * What the parser is waiting for before it executes any more commands.
+ */
+typedef enum scpi_operation_wait
+{
+	SCPI_WAIT_NONE      = 0,
+	SCPI_WAIT_WAI       = 1, /* *WAI, until the pending operations complete */
+	SCPI_WAIT_OPC_QUERY = 2  /* *OPC?, which then responds with 1 */
+} scpi_operation_wait_t;
+
+/*
+ * The Operation Complete bit of the standard event status register, which
+ * is set by *OPC and read by *ESR?.
+ */
+#define SCPI_EVENT_OPERATION_COMPLETE 0x01
+
+typedef enum scpi_input_state
+{
+	SCPI_IS_HEADER,
+	SCPI_IS_PARAMETERS,
+	SCPI_IS_BLOCK_DIGITS,
+	SCPI_IS_BLOCK_LENGTH,
+	SCPI_IS_BLOCK_DATA,
+	SCPI_IS_DISCARD
+} scpi_input_state_t;
+
 struct scpi_token;
 struct scpi_parser_context;
 struct scpi_command;
+struct scpi_command_index;
 struct scpi_error;
+struct scpi_router;
 
 typedef scpi_error_t(*command_callback_t)(struct scpi_parser_context*,struct scpi_token*);
+typedef scpi_error_t(*block_callback_t)(struct scpi_parser_context*,const char*,size_t);
+
+typedef void*(*scpi_allocate_t)(void*,size_t);
+typedef void(*scpi_release_t)(void*,void*);
+
+typedef void(*scpi_write_t)(void*,const char*,size_t);
+
+typedef int(*scpi_command_matcher_t)(const struct scpi_command*,const char*,size_t,
+										const struct scpi_command**,unsigned long*);
 
 struct scpi_token
 {
@@ -61,20 +262,212 @@ struct scpi_token
 	struct scpi_token*	next;
 };
 
+/*
+ * A token that refers to a region of the string being parsed by offset,
+ * rather than by pointer, so that arrays of them may be kept on the stack.
+ */
+struct scpi_token_span
+{
+	unsigned char		type;
+	
+	size_t				offset;
+	size_t				length;
+};
+
+/*
+ * State for splitting a parameter list into its comma-separated values.
+ */
+struct scpi_parameter_iterator
+{
+	const char*			str;
+	size_t				length;
+	size_t				position;
+	
+	/* The state of the delimiter scanner. */
+	size_t				block;
+	unsigned long		mask;
+};
+
+/*
+ * A header, and the command that it resolved to from a given tree position.
+ */
+struct scpi_header_cache_entry
+{
+	size_t               hash;
+	size_t               length;
+	char                 header[SCPI_HEADER_CACHE_LENGTH];
+	
+	struct scpi_command* position;
+	struct scpi_command* command;
+	struct scpi_command* new_position;
+	unsigned long        suffix;
+};
+
+/*
+ * The size of the blocks in which a parser context obtains memory.
+ */
+#ifndef SCPI_ARENA_BLOCK_SIZE
+#ifdef __AVR__
+#define SCPI_ARENA_BLOCK_SIZE 64
+#else
+#define SCPI_ARENA_BLOCK_SIZE 1024
+#endif
+#endif
+
+struct scpi_arena_block;
+
+/*
+ * A bump-pointer allocator.  Everything that belongs to a parser context
+ * is allocated from its arena, so that it can all be released at once.
+ * The generation counts the commands registered in the arena, so that
+ * header caches filled before the last of them can be recognised as stale.
+ */
+struct scpi_arena
+{
+	struct scpi_arena_block* blocks;
+	size_t                   used;
+	size_t                   size;
+	unsigned long            generation;
+};
+
+/*
+ * A command tree that may be shared by several parser contexts, such as
+ * one per connection, each of which keeps only its own session state.
+ * Once scpi_tree_finalize has been called, nothing in the tree is written,
+ * so the contexts may execute commands in different threads without a lock.
+ */
+struct scpi_tree
+{
+	struct scpi_command*   command_tree;
+	unsigned char          command_tree_in_flash;
+	scpi_command_matcher_t command_matcher;
+	struct scpi_arena      arena;
+};
+
+/*
+ * An entry in the error queue: the number that SYSTem:ERRor? reports and
+ * the catalog entry whose text goes with it.
+ */
 struct scpi_error
 {
 	int id;
-	const char* description;
-	size_t length;
-	
-	struct scpi_error* next;
+	unsigned char message;
 };
 
+#if SCPI_ERROR_QUEUE_ATOMIC
+/*
+ * A slot of the lock-free error queue.  The sequence number says whether
+ * the slot is free for, or holds, the error at a given position in the
+ * queue, and the overflow word whether that error has been replaced by
+ * -350, "Queue overflow".
+ */
+struct scpi_error_slot
+{
+	size_t            sequence;
+	size_t            overflow;
+	struct scpi_error error;
+};
+#endif
+
 struct scpi_parser_context
 {
 	struct scpi_command* command_tree;
-	struct scpi_error*   error_queue_head;
-	struct scpi_error*   error_queue_tail;
+	unsigned char        command_tree_in_flash;
+	scpi_command_matcher_t command_matcher;
+	unsigned char        command_tree_shared;
+#if SCPI_ERROR_QUEUE_ATOMIC
+	struct scpi_error_slot error_queue[SCPI_ERROR_QUEUE_LENGTH];
+	size_t               error_queue_head;
+	size_t               error_queue_tail;
+#else
+	struct scpi_error    error_queue[SCPI_ERROR_QUEUE_LENGTH];
+	unsigned char        error_queue_start;
+	unsigned char        error_queue_count;
+#endif
+	struct scpi_arena    arena;
+	
+	/* The response to the program message being executed. */
+	scpi_write_t         output;
+	void*                output_opaque;
+	unsigned char        output_message;
+	unsigned char        output_unit;
+	size_t               output_length;
+	char                 output_buffer[SCPI_RESPONSE_BUFFER_LENGTH];
+	
+	/* The encoding of numeric responses, set by FORMat:DATA and FORMat:BORDer. */
+	unsigned char        format_data;
+	unsigned char        format_swapped;
+	
+	/* The router through which the context receives its input, if any. */
+	struct scpi_router*  router;
+	
+	/* Operations still in progress, and the state of *OPC, *OPC? and *WAI. */
+	unsigned int         operations_pending;
+	unsigned char        operation_wait;
+	unsigned char        operation_flush;
+	unsigned char        operation_complete_armed;
+	unsigned char        event_status;
+	
+	/*
+	 * Where scpi_execute_command_partial stopped in the tree, if it has
+	 * stopped before the end of its string.
+	 */
+	struct scpi_command* operation_position;
+	
+	/* The user data and numeric suffix of the command being executed. */
+	void*                user_data;
+	unsigned long        suffix;
+	
+	/* The state of scpi_feed. */
+	scpi_input_state_t   input_state;
+	scpi_error_t         input_error;
+	struct scpi_command* input_position;
+	struct scpi_command* input_parent;
+	struct scpi_command* input_command;
+	unsigned long        input_suffix;
+	char                 input_quote;
+	size_t               input_block_start;
+	size_t               input_block_data;
+	unsigned long        input_block_remaining;
+	unsigned char        input_block_streamed;
+	size_t               input_length;
+	char                 input_buffer[SCPI_INPUT_BUFFER_LENGTH];
+	
+	/* Headers recently resolved by scpi_execute_command. */
+#if SCPI_HEADER_CACHE_SIZE > 0
+	struct scpi_header_cache_entry header_cache[SCPI_HEADER_CACHE_SIZE];
+	unsigned char        header_cache_next;
+	unsigned long        header_cache_generation;
+#endif
+	unsigned long        header_cache_hits;
+	unsigned long        header_cache_misses;
+};
+
+/*
+ * A set of instruments that share one input stream, of which one is
+ * selected at a time with INSTrument:SELect.
+ */
+struct scpi_router
+{
+	struct scpi_parser_context* instruments[SCPI_ROUTER_INSTRUMENTS];
+	const char*          names[SCPI_ROUTER_INSTRUMENTS];
+	unsigned char        count;
+	unsigned char        selected;
+};
+
+/*
+ * A ring of received bytes, written by an interrupt handler, or another
+ * thread, and read by the code that feeds them to a parser.
+ */
+struct scpi_receive_ring
+{
+	volatile scpi_receive_index_t head;
+	volatile scpi_receive_index_t tail;
+	volatile char        buffer[SCPI_RECEIVE_BUFFER_LENGTH];
+	
+	/* The most bytes held at once, and the number lost because it was full. */
+	volatile scpi_receive_index_t high_water;
+	volatile unsigned long overflows;
 };
 
 struct scpi_command
@@ -89,23 +482,271 @@ struct scpi_command
 	struct scpi_command* children;
 	
 	command_callback_t callback;
+	block_callback_t   block_callback;
+	void*              user_data;
+	
+	/* A hash table of the children, built by scpi_finalize_tree. */
+	struct scpi_command_index* children_index;
+	
+	/* The arena from which the command and its siblings are allocated. */
+	struct scpi_arena* arena;
+};
+
+/*
+ * An open-addressed hash table of a list of sibling commands, holding each
+ * command under both its long and its short name.
+ */
+struct scpi_command_index
+{
+	size_t                mask;
+	struct scpi_command*  last;
+	struct scpi_command** slots;
 };
 
+/*
+ * The smallest number of siblings for which scpi_finalize_tree builds a
+ * hash table.  Shorter lists are searched linearly.
+ */
+#ifndef SCPI_INDEX_MIN_SIBLINGS
+#define SCPI_INDEX_MIN_SIBLINGS 8
+#endif
+
+/*
+ * Storage for constant command trees.  On AVR these are placed in program
+ * memory, rather than being copied into RAM at startup.
+ */
+#ifdef __AVR__
+#define SCPI_PROGMEM PROGMEM
+#else
+#define SCPI_PROGMEM
+#endif
+
+/*
+ * Define a command in a constant command tree.  As the names are given as
+ * string literals, their lengths are determined automatically.  They must
+ * be in upper case; commands are still matched regardless of case.
+ *
+ * A command must be defined after its children and its next sibling, so
+ * the tree is written from the bottom up.  For example,
+ *
+ *		SCPI_COMMAND(volt, "VOLTAGE", "VOLT", set_voltage, NULL, NULL);
+ *		SCPI_COMMAND(source, "SOURCE", "SOUR", NULL, &volt, &scpi_system_command);
+ *		SCPI_COMMAND(idn, "*IDN?", "*IDN?", identify, NULL, NULL);
+ *		SCPI_ROOT(tree, &source, &idn);
+ *
+ * @param name			The name of the variable holding the command.
+ * @param long_name		The long form of the command, a string literal.
+ * @param short_name	The short form of the command, a string literal.
+ * @param callback		A function to be called when the command is executed.
+ * @param children		A pointer to the first command beneath this one.
+ * @param next			A pointer to the next command at the same level.
+ */
+#define SCPI_COMMAND(name, long_name, short_name, callback, children, next) \
+	SCPI_BLOCK_COMMAND(name, long_name, short_name, callback, NULL, children, next)
+
+/*
+ * As SCPI_COMMAND, but also giving a block callback, as described for
+ * scpi_set_block_callback.
+ */
+#define SCPI_BLOCK_COMMAND(name, long_name, short_name, callback, block_callback, \
+							children, next) \
+	SCPI_DEFINE_COMMAND(name, long_name, short_name, callback, block_callback, NULL, \
+						children, next)
+
+/*
+ * As SCPI_COMMAND, but also giving user data, as described for
+ * scpi_set_user_data.
+ */
+#define SCPI_DATA_COMMAND(name, long_name, short_name, callback, user_data, \
+							children, next) \
+	SCPI_DEFINE_COMMAND(name, long_name, short_name, callback, NULL, user_data, \
+						children, next)
+
+#define SCPI_DEFINE_COMMAND(name, long_name, short_name, callback, block_callback, \
+							user_data, children, next) \
+	static const char name##_long_name[] SCPI_PROGMEM = long_name; \
+	static const char name##_short_name[] SCPI_PROGMEM = short_name; \
+	const struct scpi_command name SCPI_PROGMEM = { \
+		name##_long_name,  sizeof(long_name)-1, \
+		name##_short_name, sizeof(short_name)-1, \
+		(struct scpi_command*)(next), (struct scpi_command*)(children), \
+		callback, block_callback, (void*)(user_data), NULL, NULL }
+
+/*
+ * Define the root of a constant command tree, for use with scpi_init_const.
+ *
+ * @param name		The name of the variable holding the root.
+ * @param children	A pointer to the first top-level command.
+ * @param common	A pointer to the first common command, e.g. *IDN?.
+ */
+#define SCPI_ROOT(name, children, common) \
+	const struct scpi_command name SCPI_PROGMEM = { \
+		NULL, 0, NULL, 0, \
+		(struct scpi_command*)(common), (struct scpi_command*)(children), \
+		NULL, NULL, NULL, NULL, NULL }
+
+/*
+ * The SYSTem:ERRor subtree that scpi_init registers, for use as the last
+ * top-level command of a constant tree.
+ */
+extern const struct scpi_command scpi_system_command;
+
+/*
+ * The FORMat subtree that scpi_init registers, followed by
+ * scpi_system_command, for use in its place in a constant tree.
+ */
+extern const struct scpi_command scpi_format_command;
+
+/*
+ * The INSTrument subtree that scpi_router_add registers, followed by
+ * scpi_format_command, for use in its place in the constant tree of an
+ * instrument that is to be added to a router.
+ */
+extern const struct scpi_command scpi_instrument_command;
+
+/*
+ * The common commands *ESR?, *OPC, *OPC? and *WAI that scpi_init
+ * registers, linked in that order, for use as the last common commands of
+ * a constant tree.
+ */
+extern const struct scpi_command scpi_esr_query_command;
+extern const struct scpi_command scpi_opc_command;
+extern const struct scpi_command scpi_opc_query_command;
+extern const struct scpi_command scpi_wai_command;
+
+/**
+ * The outcome of parsing a numeric string.  SCPI_NUMERIC_EMPTY and
+ * SCPI_NUMERIC_INVALID correspond to the SCPI errors -109, "Missing
+ * parameter", and -120, "Numeric data error"; SCPI_NUMERIC_SUFFIX to
+ * -131, "Invalid suffix"; SCPI_NUMERIC_OVERFLOW to -222, "Data out of
+ * range"; and SCPI_NUMERIC_TOO_MANY, for a list too long for its array,
+ * to -108, "Parameter not allowed".
+ */
+typedef enum scpi_numeric_status
+{
+	SCPI_NUMERIC_SUCCESS  = 0,
+	SCPI_NUMERIC_EMPTY    = 1,
+	SCPI_NUMERIC_INVALID  = 2,
+	SCPI_NUMERIC_SUFFIX   = 3,
+	SCPI_NUMERIC_OVERFLOW = 4,
+	SCPI_NUMERIC_TOO_MANY = 5
+} scpi_numeric_status_t;
+
+/**
+ * The units that scpi_parse_numeric recognises, whatever their case.
+ * SCPI_UNIT_UNKNOWN is any other unit, which is left for the caller to
+ * compare by name.
+ */
+typedef enum scpi_unit
+{
+	SCPI_UNIT_NONE = 0,
+	SCPI_UNIT_UNKNOWN,
+	SCPI_UNIT_VOLT,       /* V */
+	SCPI_UNIT_AMPERE,     /* A */
+	SCPI_UNIT_WATT,       /* W */
+	SCPI_UNIT_OHM,        /* OHM */
+	SCPI_UNIT_FARAD,      /* F */
+	SCPI_UNIT_HERTZ,      /* HZ */
+	SCPI_UNIT_SECOND,     /* S */
+	SCPI_UNIT_JOULE,      /* J */
+	SCPI_UNIT_KELVIN,     /* K */
+	SCPI_UNIT_CELSIUS,    /* CEL */
+	SCPI_UNIT_DEGREE,     /* DEG */
+	SCPI_UNIT_RADIAN,     /* RAD */
+	SCPI_UNIT_DECIBEL,    /* DB */
+	SCPI_UNIT_DBM,        /* DBM */
+	SCPI_UNIT_PERCENT     /* PCT */
+} scpi_unit_t;
+
 struct scpi_numeric
 {
 	float  value;
 	const char*  unit;
 	size_t length;
+	scpi_numeric_status_t status;
+	scpi_unit_t unit_id;
+};
+
+struct scpi_numeric_fixed
+{
+	int32_t value;
+	const char*  unit;
+	size_t length;
+	scpi_numeric_status_t status;
+	scpi_unit_t unit_id;
+};
+
+/*
+ * The outcome of parsing a comma-separated list of numbers.  The count
+ * is of the elements stored, and so is also the index of the element
+ * that stopped the parse if the status is not SCPI_NUMERIC_SUCCESS.
+ */
+struct scpi_numeric_list
+{
+	size_t count;
+	scpi_numeric_status_t status;
+	const char*  element;
+	size_t element_length;
+	const char*  unit;
+	size_t length;
+	scpi_unit_t unit_id;
 };
 
 /**
  * Initialise an SCPI parser.
  *
+ * The command tree is allocated from an arena that belongs to the
+ * context, and is released by scpi_destroy.  The error queue is part of
+ * the context itself.
+ *
  * @param ctx	A pointer to the struct scpi_parser_context to initialise.
  */
 void
 scpi_init(struct scpi_parser_context* ctx);
 
+/**
+ * Release all of the memory belonging to an SCPI parser.
+ *
+ * This includes every command registered in its tree, unless the tree is
+ * a shared one, which is released by scpi_tree_destroy.  The context may
+ * be initialised again afterwards.
+ *
+ * @param ctx	The parser context to destroy.
+ */
+void
+scpi_destroy(struct scpi_parser_context* ctx);
+
+/**
+ * Set the functions from which parser contexts obtain memory.
+ *
+ * Memory is requested in blocks of SCPI_ARENA_BLOCK_SIZE bytes, or more
+ * for a larger object, and is only released by scpi_destroy.  By default,
+ * malloc and free are used.  This must not be changed while any context
+ * holds memory from the previous functions.
+ *
+ * @param allocate	A function returning a block of at least the given size,
+ *					or NULL if there is none.  NULL restores malloc.
+ * @param release	A function to release a block.  NULL restores free.
+ * @param opaque	A pointer passed as the first argument to both functions.
+ */
+void
+scpi_set_allocator(scpi_allocate_t allocate, scpi_release_t release, void* opaque);
+
+/**
+ * Initialise an SCPI parser with a constant command tree.
+ *
+ * The tree is described with SCPI_COMMAND and SCPI_ROOT, and so needs no
+ * memory to be allocated or any commands to be registered at startup.  It
+ * should include scpi_system_command to provide SYSTem:ERRor?, or
+ * scpi_format_command to provide FORMat as well.  Commands may not be
+ * registered in a constant tree.
+ *
+ * @param ctx			A pointer to the struct scpi_parser_context to initialise.
+ * @param command_tree	The root of the tree, as defined with SCPI_ROOT.
+ */
+void
+scpi_init_const(struct scpi_parser_context* ctx, const struct scpi_command* command_tree);
+
 /**
  * Convert an SCPI command into a list of tokens.
  *
@@ -117,6 +758,59 @@ scpi_init(struct scpi_parser_context* ctx);
 struct scpi_token*
 scpi_parse_string(const char* str, size_t length);
 
+/**
+ * Split an SCPI command into tokens without allocating any memory.
+ *
+ * Each mnemonic in the header becomes a token of type SCPI_TT_HEADER.
+ * The parameters are not split; instead, everything after the header is
+ * placed in a single token of type SCPI_TT_PARAMETERS, which may later be
+ * split with scpi_parameter_iterator_init and scpi_next_parameter.
+ *
+ * @param str		A pointer to the string to be parsed.
+ * @param length	The length of the string to be parsed.
+ * @param spans		The array into which the tokens are to be written.
+ * @param capacity	The number of elements in spans.
+ * @param count		Set to the number of tokens written.
+ *
+ * @return SCPI_SUCCESS, or SCPI_TOO_MANY_TOKENS if spans is too small.
+ */
+scpi_error_t
+scpi_tokenize(const char* str, size_t length,
+				struct scpi_token_span* spans, size_t capacity, size_t* count);
+
+/**
+ * Prepare to split a parameter list.
+ *
+ * @param iterator	The iterator to initialise.
+ * @param str		The parameter list, as passed to a command callback.
+ * @param length	The length of the parameter list.
+ */
+void
+scpi_parameter_iterator_init(struct scpi_parameter_iterator* iterator,
+								const char* str, size_t length);
+
+/**
+ * Fetch the next parameter from a parameter list.
+ *
+ * Leading and trailing whitespace is removed from each parameter.
+ *
+ * An arbitrary block parameter, #<n><length><data> or #0<data>, is returned
+ * as a token of type SCPI_TT_BLOCK that points to the data, which may
+ * contain any bytes.  An indefinite-length block, #0, runs to the end of
+ * the parameter list.  Anything but whitespace between the end of a block
+ * and the next comma makes the whole parameter an ordinary one, of type
+ * SCPI_TT_PARAMETERS; scpi_execute_command and scpi_feed do not call a
+ * callback with such a parameter, but queue -160, Block data error.
+ *
+ * @param iterator	The iterator, as initialised by scpi_parameter_iterator_init.
+ * @param parameter	Set to a token pointing to the parameter.
+ *
+ * @return Non-zero if a parameter was found, zero at the end of the list.
+ */
+int
+scpi_next_parameter(struct scpi_parameter_iterator* iterator,
+						struct scpi_token* parameter);
+
 /**
  * Add a command to a tree.
  *
@@ -131,6 +825,14 @@ scpi_parse_string(const char* str, size_t length);
  * The short name is equal to the first four letters of the long name.
  * If the final letters is a vowel, then it is dropped.
  *
+ * Commands are matched regardless of case.  If a name contains lower-case
+ * letters, then an upper-case copy of it is kept.
+ *
+ * A name may end in a numeric suffix, written as #, and optionally followed
+ * by a question mark.  The command VOLTAGE#? then matches VOLTAGE?, VOLT1?,
+ * VOLT2?, and so on, and the number given is passed to the callback in
+ * ctx->suffix.  If it is omitted, the suffix is 1.
+ *
  * For example,
  *
  *		Radial Velocity	-> RVELOCITY	-> RVEL
@@ -151,7 +853,8 @@ scpi_parse_string(const char* str, size_t length);
  *
  * @param callback	A function to be called when the command is executed.
  *
- * @return A pointer to the command structure inserted.
+ * @return A pointer to the command structure inserted, or NULL if there is
+ *			no memory for it.
  */
 struct scpi_command*
 scpi_register_command(struct scpi_command* parent, scpi_command_location_t location,
@@ -159,6 +862,136 @@ scpi_register_command(struct scpi_command* parent, scpi_command_location_t locat
 						const char* short_name, size_t short_name_length,
 						command_callback_t callback);
 						
+/**
+ * Set the function that receives blocks too large for scpi_feed to buffer.
+ *
+ * When the data of a block parameter does not fit in the input buffer,
+ * scpi_feed passes it to the block callback in pieces as it arrives.  The
+ * command callback is then called as usual, but sees the block as empty.
+ * Without a block callback, such a command fails with SCPI_BUFFER_OVERFLOW.
+ *
+ * @param command	The command to which the callback applies.
+ * @param callback	A function to be called with each piece of a block.
+ */
+void
+scpi_set_block_callback(struct scpi_command* command, block_callback_t callback);
+
+/**
+ * Set the user data of a command.
+ *
+ * While a command's callback runs, its user data is in ctx->user_data, so
+ * that a single callback may serve several commands, for example one per
+ * channel.
+ *
+ * @param command	The command to which the data applies.
+ * @param user_data	A pointer to be given to the callback.
+ */
+void
+scpi_set_user_data(struct scpi_command* command, void* user_data);
+
+/**
+ * Prepare a command tree for fast lookup.
+ *
+ * Every list of at least SCPI_INDEX_MIN_SIBLINGS sibling commands is given
+ * a hash table, so that each mnemonic of a header is found in constant
+ * time rather than by searching the list.  This should be called once all
+ * of the commands have been registered; commands registered afterwards are
+ * still found, but by a linear search, until it is called again.  The
+ * tables are allocated from the context's arena, so those replaced by a
+ * later call are only released by scpi_destroy.
+ *
+ * Constant trees, as given to scpi_init_const, are not indexed, and nor
+ * are shared trees, which are indexed by scpi_tree_finalize.
+ *
+ * @param ctx	The parser context whose tree is to be indexed.
+ */
+void
+scpi_finalize_tree(struct scpi_parser_context* ctx);
+
+/**
+ * Look up mnemonics with a function rather than by searching the tree.
+ *
+ * This is intended for the matchers generated by scpigen.py, which find
+ * the children of each command with a switch statement.  The matcher is
+ * called with the parent command, or NULL for a common command, and the
+ * mnemonic.  If the parent is one that it knows, then it stores the child
+ * found in *command, or NULL if there is none, sets *suffix if the child
+ * has a numeric suffix, and returns nonzero.  Otherwise it returns zero,
+ * and the children are searched as usual.
+ *
+ * @param ctx		The parser context.
+ * @param matcher	The function to use, or NULL to search the tree.
+ */
+void
+scpi_set_command_matcher(struct scpi_parser_context* ctx, scpi_command_matcher_t matcher);
+
+/**
+ * Initialise a command tree to be shared by several parser contexts.
+ *
+ * The tree holds FORMat and SYSTem:ERRor, as scpi_init would register
+ * them, and further commands are registered beneath tree->command_tree.
+ *
+ * @param tree	A pointer to the struct scpi_tree to initialise.
+ */
+void
+scpi_tree_init(struct scpi_tree* tree);
+
+/**
+ * Initialise a shared command tree with a constant tree.
+ *
+ * @param tree			A pointer to the struct scpi_tree to initialise.
+ * @param command_tree	The root of the tree, as defined with SCPI_ROOT.
+ */
+void
+scpi_tree_init_const(struct scpi_tree* tree, const struct scpi_command* command_tree);
+
+/**
+ * Look up the mnemonics of a shared tree with a function, as
+ * scpi_set_command_matcher does for a single context.
+ *
+ * @param tree		The shared tree.
+ * @param matcher	The function to use, or NULL to search the tree.
+ */
+void
+scpi_tree_set_command_matcher(struct scpi_tree* tree, scpi_command_matcher_t matcher);
+
+/**
+ * Freeze a shared command tree, indexing it as scpi_finalize_tree would.
+ *
+ * This must be called once every command has been registered and before
+ * any context is initialised with the tree.  Afterwards the tree is only
+ * read, and must not be changed while any context uses it.
+ *
+ * @param tree	The shared tree.
+ */
+void
+scpi_tree_finalize(struct scpi_tree* tree);
+
+/**
+ * Release all of the memory belonging to a shared command tree.  No
+ * context may use the tree afterwards.
+ *
+ * @param tree	The shared tree to destroy.
+ */
+void
+scpi_tree_destroy(struct scpi_tree* tree);
+
+/**
+ * Initialise an SCPI parser that executes commands against a shared tree.
+ *
+ * The context holds only the state of its own session: the error queue,
+ * the input and response buffers, the header cache and the data format.
+ * It allocates no memory, and neither scpi_finalize_tree nor
+ * scpi_router_add change the tree, so a shared tree to be routed to should
+ * be a constant one that includes scpi_instrument_command.
+ *
+ * @param ctx	A pointer to the struct scpi_parser_context to initialise.
+ * @param tree	The tree, which must have been frozen by scpi_tree_finalize
+ *				and must outlive the context.
+ */
+void
+scpi_init_session(struct scpi_parser_context* ctx, const struct scpi_tree* tree);
+
 /**
  * Find a command structure in a tree.
  *
@@ -175,6 +1008,42 @@ scpi_find_command(struct scpi_parser_context* ctx,
 /**
  * Execute an SCPI command string.
  *
+ * The string may hold several commands separated by semicolons.  A header
+ * beginning with a colon is looked up from the root of the tree, and one
+ * beginning with an asterisk is a common command.  Any other header is
+ * looked up beneath the parent of the previous command, so that
+ * ":SOUR:VOLT 1;VOLT1 2" sets both :SOUR:VOLT and :SOUR:VOLT1.  Execution
+ * stops at the first command that fails.  Headers are not case-sensitive.
+ *
+ * Each command is tokenized into a buffer of SCPI_MAX_TOKENS tokens on the
+ * stack, and so no memory is allocated.  The last SCPI_HEADER_CACHE_SIZE
+ * headers found are remembered, so that a repeated command is dispatched
+ * without searching the tree; ctx->header_cache_hits and
+ * ctx->header_cache_misses count how often this succeeds.  Registering a
+ * command empties the cache.  The callback receives a single
+ * token of type SCPI_TT_PARAMETERS holding the unsplit parameter list,
+ * with zero length if there are no parameters.  This token belongs to the
+ * parser, and must not be freed by the callback.  While the callback runs,
+ * ctx->user_data holds the command's user data, and ctx->suffix holds the
+ * numeric suffix of the last mnemonic in the header that took one.
+ *
+ * The responses of the commands are collected as described for
+ * scpi_write, and written out by scpi_flush once the string has been
+ * executed, even if a command fails.
+ *
+ * A callback may instead return SCPI_PENDING to leave its operation
+ * running, and report that it has finished with scpi_complete; the next
+ * command is executed meanwhile.  No more than SCPI_MAX_PENDING
+ * operations are counted; an execution error is queued for any beyond
+ * that, which *WAI and *OPC? then do not wait for, and scpi_complete
+ * must not be called for it.  If *WAI or *OPC? is reached while any
+ * operation is pending, then the responses are held back until
+ * scpi_complete is called, and SCPI_PENDING is returned; so it is for any
+ * string given until then.  The commands that could not be executed are
+ * lost, and an execution error is queued for them.  Use
+ * scpi_execute_command_partial to execute them once the operations are
+ * complete, or scpi_feed, which keeps the rest of the message itself.
+ *
  * @param ctx				The SCPI parser context.
  * @param command_string	The command to be executed.
  * @param length			The length of the executed command.
@@ -184,6 +1053,72 @@ scpi_find_command(struct scpi_parser_context* ctx,
 scpi_error_t
 scpi_execute_command(struct scpi_parser_context* ctx, const char* command_string, size_t length);
 
+/**
+ * Execute an SCPI command string, as far as *WAI or *OPC? allows.
+ *
+ * The scpi_execute_command_partial function executes the string as
+ * scpi_execute_command does, but queues no error for the commands that
+ * cannot be executed while *WAI or *OPC? waits.  Instead, it reports how
+ * much of the string it has dealt with, so that the rest can be given
+ * again once scpi_complete has finished the pending operations.  The rest
+ * is then executed as part of the same program message: its first header
+ * is looked up from where the last one left off, and the responses of the
+ * whole message are written together once the rest has been executed.
+ *
+ * @param ctx				The SCPI parser context.
+ * @param command_string	The command to be executed.
+ * @param length			The length of the executed command.
+ * @param consumed			Set to the length of the part of the string that
+ *							has been executed or abandoned after an error, which
+ *							is less than length only if SCPI_PENDING is returned.
+ *
+ * @return An error code.
+ */
+scpi_error_t
+scpi_execute_command_partial(struct scpi_parser_context* ctx, const char* command_string,
+								size_t length, size_t* consumed);
+
+/**
+ * Execute an SCPI command one byte at a time.
+ *
+ * Each mnemonic of the header is looked up as soon as it is complete, so
+ * only the current mnemonic and the parameters are buffered.  The data of
+ * a definite-length block parameter may contain newlines.  The callback
+ * is called as soon as the semicolon or newline that terminates the command
+ * arrives, and receives the parameters as described for scpi_execute_command.
+ * The responses to the message are written out when the newline arrives.
+ *
+ * @param ctx	The SCPI parser context.
+ * @param c		The next byte of input.
+ *
+ * @return SCPI_INCOMPLETE until a newline is received, after which the
+ *			result of the command is returned as for scpi_execute_command.
+ *			If the command does not fit in SCPI_INPUT_BUFFER_LENGTH bytes,
+ *			then it is discarded and SCPI_BUFFER_OVERFLOW is returned.
+ *			While *WAI or *OPC? waits for pending operations, the byte is
+ *			not accepted and SCPI_PENDING is returned; it should be given
+ *			again once scpi_complete has been called, so that the rest of
+ *			the input stays in the receive buffer meanwhile.
+ */
+scpi_error_t
+scpi_feed(struct scpi_parser_context* ctx, char c);
+
+/**
+ * Report that an operation whose callback returned SCPI_PENDING has
+ * finished, for example from a scheduler polled in loop().
+ *
+ * Once every pending operation has finished, the Operation Complete event
+ * is set if *OPC asked for it, *OPC? responds with 1, and the parser
+ * accepts input again after *WAI.  This must not be called from an
+ * interrupt handler, as it may write the responses to the message, nor
+ * for an operation refused because SCPI_MAX_PENDING were already pending,
+ * as it would then end the wait for another operation.
+ *
+ * @param ctx	The SCPI parser context.
+ */
+void
+scpi_complete(struct scpi_parser_context* ctx);
+
 /**
  * Free a token list.
  *
@@ -209,39 +1144,442 @@ scpi_free_some_tokens(struct scpi_token* start, struct scpi_token* end);
  * specified, the SI prefix will be incorporated into the numeric
  * value.  Default, maximum, and minimum values will also be handled.
  *
- * For example, 0.1mV => value: 1e-4, unit: V
+ * For example, 0.1mV => value: 1e-4, unit: V, unit_id: SCPI_UNIT_VOLT
+ *
+ * The value is correctly rounded, with ties to even, and found in time
+ * linear in the length of the string.  MINimum, MAXimum and DEFault may
+ * be given in either case and in short or long form.  The exponent may
+ * be marked by e or E; an E without digits after it starts the suffix.
+ *
+ * Suffixes may be given in either case, with the multipliers of IEEE
+ * 488.2: EX, PE, T, G, MA, K, M, U, N, P, F and A, in which M is milli,
+ * so that 1MV is 1e-3 V.  MHZ and MOHM are the exceptions, meaning
+ * megahertz and megohm as MAHZ and MAOHM do, and so 1mHz is 1e6 Hz.  A
+ * suffix that is a unit in its own right, such as PCT, is never read as
+ * a multiplier and a unit, and a suffix of a multiplier alone, such as
+ * k or M, is a multiplier with no unit; K alone is kilo, not kelvin.  A
+ * multiplier is only taken from a suffix that is not a unit when the
+ * rest is one, so that 100NT is 100 with the unknown unit NT.
  *
  * @param str		The string to parse.
  * @param length	The length of the string to parse.
+ * @param default_value The value of DEFAULT.
  * @param min_value     The value of MIN.
  * @param max_value     The value of MAX.
- * @param default_value The value of DEFAULT.
  *
  * @return A structure containing the numeric data.  The unit field
- *			points into the original string.
+ *			points into the original string.  The status field is
+ *			SCPI_NUMERIC_SUCCESS unless the string is malformed, in
+ *			which case the value is zero and there is no unit, or
+ *			out of range, in which case the value is infinite.
  */
 struct scpi_numeric
 scpi_parse_numeric(const char* str, size_t length, float default_value, float min_value, float max_value);
 
 /**
- * Add an error to the queue.
+ * Parse a numeric string into a fixed-point integer.
+ *
+ * The scpi_parse_numeric_fixed function parses a numeric string as
+ * scpi_parse_numeric does, but returns the value as an integer count of
+ * units of 10^-places, without using floating-point arithmetic.  The
+ * value is rounded to nearest, with ties to even, and so matches the
+ * result of scpi_parse_numeric wherever that is exact.
+ *
+ * For example, 1.5kHz with no places => value: 1500, unit: Hz
  *
- * @param ctx  	The parser context to which the error is associated.
- * @param error	The error object that is to be queued.
+ * @param str		The string to parse.
+ * @param length	The length of the string to parse.
+ * @param places	The number of decimal places in the value.
+ * @param default_value The value of DEFAULT, already scaled.
+ * @param min_value     The value of MIN, already scaled.
+ * @param max_value     The value of MAX, already scaled.
+ *
+ * @return A structure containing the numeric data, as for
+ *			scpi_parse_numeric.  A value out of the range of a
+ *			32-bit integer is saturated, with the status
+ *			SCPI_NUMERIC_OVERFLOW.
+ */
+struct scpi_numeric_fixed
+scpi_parse_numeric_fixed(const char* str, size_t length, int places,
+                         int32_t default_value, int32_t min_value, int32_t max_value);
+
+/**
+ * Parse a comma-separated list of numbers into an array.
+ *
+ * The scpi_parse_numeric_list function parses each element of a list,
+ * such as the parameters of :LIST:FREQ 1k,2k,3k, as scpi_parse_numeric
+ * would, storing the values in order without allocating any memory.
+ * Every number must have the same unit, though MINimum, MAXimum and
+ * DEFault may be mixed in.
+ *
+ * Parsing stops at the first element that is malformed or out of range,
+ * or that does not fit in the array.  A list of nothing but whitespace
+ * has no elements.
+ *
+ * @param str		The parameter list, as passed to a command callback.
+ * @param length	The length of the parameter list.
+ * @param values	The array into which the values are to be written.
+ * @param capacity	The number of elements in values.
+ * @param default_value The value of DEFAULT.
+ * @param min_value     The value of MIN.
+ * @param max_value     The value of MAX.
+ *
+ * @return A structure giving the number of values stored and the unit
+ *			of the list.  If the status is not SCPI_NUMERIC_SUCCESS,
+ *			the element field points to the element that stopped
+ *			the parse, whose index is the count.
+ */
+struct scpi_numeric_list
+scpi_parse_numeric_list(const char* str, size_t length, float* values, size_t capacity,
+                        float default_value, float min_value, float max_value);
+
+/**
+ * Parse a comma-separated list of numbers into an array of fixed-point
+ * integers.
+ *
+ * As scpi_parse_numeric_list, with each element converted as by
+ * scpi_parse_numeric_fixed.
+ *
+ * @param str		The parameter list, as passed to a command callback.
+ * @param length	The length of the parameter list.
+ * @param places	The number of decimal places in the values.
+ * @param values	The array into which the values are to be written.
+ * @param capacity	The number of elements in values.
+ * @param default_value The value of DEFAULT, already scaled.
+ * @param min_value     The value of MIN, already scaled.
+ * @param max_value     The value of MAX, already scaled.
+ *
+ * @return As for scpi_parse_numeric_list.
+ */
+struct scpi_numeric_list
+scpi_parse_numeric_list_fixed(const char* str, size_t length, int places, int32_t* values,
+                              size_t capacity, int32_t default_value, int32_t min_value,
+                              int32_t max_value);
+
+/**
+ * The longest response that scpi_format_fixed or scpi_format_float can
+ * write, so that a buffer of this size always has room.
+ */
+#define SCPI_FORMAT_LENGTH 16
+
+/**
+ * Format a fixed-point number for a response.
+ *
+ * Writes value/10^places in decimal, with exactly the given number of
+ * places after the point, using only integer arithmetic.  For example,
+ * a value of -1500 with 3 places is written as -1.500.  The response is
+ * not null-terminated.
+ *
+ * @param buffer	The buffer into which the response is to be written.
+ * @param size		The size of the buffer.
+ * @param value		The value, scaled by 10^places.
+ * @param places	The number of decimal places, from 0 to 9.
+ *
+ * @return The length of the response, or zero if it does not fit or
+ *			places is out of range.
+ */
+size_t
+scpi_format_fixed(char* buffer, size_t size, int32_t value, int places);
+
+#ifndef __AVR__
+
+/**
+ * Format a number for a response.
+ *
+ * Writes the shortest decimal number that scpi_parse_numeric would read
+ * back as the same float, choosing the nearest if there are several.
+ * Numbers from 1e-4 up to 1e9 are written without an exponent, in NR1 or
+ * NR2 form, and others in NR3 form, such as 1.5E+10.  Infinities are
+ * written as +/-9.9E+37 and NaN as 9.91E+37, as SCPI requires.  The
+ * response is not null-terminated.
+ *
+ * This needs double-precision arithmetic, so is not available on the
+ * AVR, where scpi_format_fixed should be used instead.
+ *
+ * @param buffer	The buffer into which the response is to be written.
+ * @param size		The size of the buffer.
+ * @param value		The value to be formatted.
+ *
+ * @return The length of the response, or zero if it does not fit.
+ */
+size_t
+scpi_format_float(char* buffer, size_t size, float value);
+
+#endif
+
+/**
+ * Add an error from the catalog to the queue.
+ *
+ * If the queue is full, the most recent error in it is replaced by -350,
+ * "Queue overflow", and the new error is lost, as SCPI requires.
+ *
+ * If SCPI_ERROR_QUEUE_ATOMIC is set, this may be called from any number
+ * of threads at once, and at the same time as scpi_pop_error is called
+ * from one other.
+ *
+ * @param ctx  		The parser context to which the error is associated.
+ * @param message	The error that is to be queued.
  */
 void
-scpi_queue_error(struct scpi_parser_context* ctx, struct scpi_error error);
+scpi_queue_error(struct scpi_parser_context* ctx, scpi_error_message_t message);
 
 /**
  * Remove the oldest error from the queue.
  *
  * @param ctx	The parser context from which the error is to be popped.
  *
- * @return The oldest error object in the queue.
+ * @return The oldest error in the queue, or error 0, "No error", if it is
+ *			empty.
  */
-struct scpi_error*
+struct scpi_error
 scpi_pop_error(struct scpi_parser_context* ctx);
 
+/**
+ * The longest response that scpi_format_error can write.
+ */
+#define SCPI_ERROR_LENGTH 40
+
+/**
+ * Format an error as the response to SYSTem:ERRor?, such as
+ * -113,"Undefined header".  The text is read from the catalog, which is
+ * kept in program memory on the AVR.  The response is not
+ * null-terminated.
+ *
+ * @param buffer	The buffer into which the response is to be written.
+ * @param size		The size of the buffer.
+ * @param error		The error, as returned by scpi_pop_error.
+ *
+ * @return The length of the response, or zero if it does not fit.
+ */
+size_t
+scpi_format_error(char* buffer, size_t size, struct scpi_error error);
+
+/**
+ * Set the function to which responses are written.
+ *
+ * The response to a program message is collected in the context, and
+ * given to this function all at once when the message has been executed,
+ * or in pieces of SCPI_RESPONSE_BUFFER_LENGTH bytes if it is longer.  On
+ * the Arduino, for example, it might pass the data to Serial.write.  Until
+ * this is called, responses are discarded.
+ *
+ * @param ctx		The parser context, after it has been initialised.
+ * @param output	The function to which responses are written, or NULL to
+ *					discard them.
+ * @param opaque	A pointer passed as the first argument to the function.
+ */
+void
+scpi_set_output(struct scpi_parser_context* ctx, scpi_write_t output, void* opaque);
+
+/**
+ * Add to the response of the command being executed.
+ *
+ * A command callback may write its response in any number of pieces.  The
+ * responses of the commands of a message are separated by semicolons,
+ * and the whole is terminated by a newline, as SCPI requires, so neither
+ * should be written by the callback.
+ *
+ * @param ctx		The parser context.
+ * @param data		The data to be written.
+ * @param length	The length of the data.
+ */
+void
+scpi_write(struct scpi_parser_context* ctx, const char* data, size_t length);
+
+/**
+ * Add a null-terminated string to the response, as scpi_write.
+ *
+ * @param ctx	The parser context.
+ * @param str	The string to be written.
+ */
+void
+scpi_write_string(struct scpi_parser_context* ctx, const char* str);
+
+/**
+ * Add a fixed-point number to the response, formatted as by
+ * scpi_format_fixed.
+ *
+ * @param ctx		The parser context.
+ * @param value		The value, scaled by 10^places.
+ * @param places	The number of decimal places, from 0 to 9.
+ */
+void
+scpi_write_fixed(struct scpi_parser_context* ctx, int32_t value, int places);
+
+/**
+ * Add a definite-length block to the response, as #<n><length><data>.
+ *
+ * @param ctx		The parser context.
+ * @param data		The data of the block, which may hold any bytes.
+ * @param length	The length of the data, less than 10^9.
+ */
+void
+scpi_write_block(struct scpi_parser_context* ctx, const char* data, size_t length);
+
+/**
+ * Add an array of numbers to the response in the format selected by
+ * FORMat:DATA.
+ *
+ * In ASCii format the numbers are written in decimal, separated by
+ * commas.  In INTeger and REAL formats they are written as a single
+ * definite-length block of 16-bit integers or 32-bit IEEE 754 numbers,
+ * with their most significant byte first unless FORMat:BORDer is
+ * SWAPped, so that no formatting is needed.  A single value is written
+ * in the same way, as an array of one.
+ *
+ * @param ctx		The parser context.
+ * @param values	The numbers to be written.
+ * @param count		The number of values.
+ */
+void
+scpi_write_integers(struct scpi_parser_context* ctx, const int16_t* values, size_t count);
+
+#ifndef __AVR__
+
+/**
+ * Add a number to the response, formatted as by scpi_format_float.
+ *
+ * @param ctx	The parser context.
+ * @param value	The value to be written.
+ */
+void
+scpi_write_float(struct scpi_parser_context* ctx, float value);
+
+/**
+ * Add an array of numbers to the response, as scpi_write_integers.  In
+ * INTeger format, each is rounded to the nearest integer, and limited to
+ * the range of a 16-bit integer.
+ *
+ * @param ctx		The parser context.
+ * @param values	The numbers to be written.
+ * @param count		The number of values.
+ */
+void
+scpi_write_reals(struct scpi_parser_context* ctx, const float* values, size_t count);
+
+#endif
+
+/**
+ * Terminate the response to a program message and write it out.
+ *
+ * This is called by scpi_execute_command, and by scpi_feed at the end of
+ * each message, and so need only be called directly for a response that
+ * was written outside a command callback.  If there is no response,
+ * nothing is written.
+ *
+ * @param ctx	The parser context.
+ */
+void
+scpi_flush(struct scpi_parser_context* ctx);
+
+/**
+ * Initialise a router with no instruments.
+ *
+ * @param router	The router to initialise.
+ */
+void
+scpi_router_init(struct scpi_router* router);
+
+/**
+ * Add an instrument to a router.
+ *
+ * Each instrument is an initialised parser context with a tree, error
+ * queue and output of its own.  The first instrument added is selected
+ * at first.  The INSTrument subtree is registered in the tree of the
+ * context; a constant tree should instead include scpi_instrument_command.
+ * It provides
+ *
+ *		INSTrument[:SELect] <name>	select an instrument by name
+ *		INSTrument:SELect?			the name of the selected instrument
+ *		INSTrument:NSELect <n>		select an instrument by number, from 1
+ *		INSTrument:NSELect?			the number of the selected instrument
+ *		INSTrument:CATalog?			the names of the instruments
+ *
+ * @param router	The router.
+ * @param ctx		The parser context of the instrument.
+ * @param name		The name by which the instrument is selected, which is
+ *					matched regardless of case.  It is not copied.
+ *
+ * @return The number of the instrument, or zero if the router is full.
+ */
+int
+scpi_router_add(struct scpi_router* router, struct scpi_parser_context* ctx, const char* name);
+
+/**
+ * Pass a byte of input to the selected instrument, as scpi_feed.
+ *
+ * The header of each command is looked up in the tree of the selected
+ * instrument alone.  If a command selects another instrument, then the
+ * rest of the message goes to that one, and the responses of both are
+ * written as a single response message.
+ *
+ * @param router	The router.
+ * @param c			The next byte of input.
+ *
+ * @return As for scpi_feed.
+ */
+scpi_error_t
+scpi_router_feed(struct scpi_router* router, char c);
+
+/**
+ * Empty a receive ring and reset its statistics.
+ *
+ * @param ring	A pointer to the struct scpi_receive_ring to initialise.
+ */
+void
+scpi_receive_init(struct scpi_receive_ring* ring);
+
+/**
+ * Add a received byte to a ring.  This is meant to be called from the
+ * receive interrupt handler of a serial port, or from one other thread,
+ * while the ring is read elsewhere.
+ *
+ * @param ring	The receive ring.
+ * @param c		The byte received.
+ *
+ * @return Nonzero if the byte was added, or zero if the ring was full, in
+ *			which case the byte is counted in ring->overflows and lost.
+ */
+int
+scpi_receive(struct scpi_receive_ring* ring, char c);
+
+/**
+ * Look at the oldest byte in a receive ring without removing it.
+ *
+ * @param ring	The receive ring.
+ * @param c		Where the byte is to be stored.
+ *
+ * @return Nonzero if there was a byte, or zero if the ring is empty.
+ */
+int
+scpi_receive_peek(struct scpi_receive_ring* ring, char* c);
+
+/**
+ * Remove the oldest byte from a receive ring, once it has been used.
+ *
+ * @param ring	The receive ring, which must not be empty.
+ */
+void
+scpi_receive_consume(struct scpi_receive_ring* ring);
+
+/**
+ * Feed the bytes in a receive ring to a parser, as from loop().
+ *
+ * The bytes are removed as scpi_feed takes them.  If it does not, because
+ * *WAI or *OPC? is waiting for an operation, then they are left in the
+ * ring until it is called again after scpi_complete.  The bytes are
+ * peeked and consumed in the same way for a router.
+ *
+ * @param ctx	The SCPI parser context.
+ * @param ring	The receive ring.
+ *
+ * @return SCPI_PENDING if the parser is waiting; otherwise the result of
+ *			the last message completed, as returned by scpi_feed, or
+ *			SCPI_INCOMPLETE if there was none.
+ */
+scpi_error_t
+scpi_receive_drain(struct scpi_parser_context* ctx, struct scpi_receive_ring* ring);
+
 #ifdef __cplusplus
   }
 #endif
@@ -1,46 +1,67 @@
 #include <scpiparser.h>
 #include <Arduino.h>
 
+#include "channels.h"
+
+/*
+ * Our command tree is fixed, and so it is compiled from meter.scpi into
+ * meter_commands.cpp, which keeps it in program memory rather than
+ * building it in RAM at startup, and finds each command with a switch
+ * statement.  The callbacks are declared in meter_commands.h.
+ */
+#include "meter_commands.h"
+
 struct scpi_parser_context ctx;
 
-scpi_error_t identify(struct scpi_parser_context* context, struct scpi_token* command);
-scpi_error_t get_voltage(struct scpi_parser_context* context, struct scpi_token* command);
-scpi_error_t get_voltage_2(struct scpi_parser_context* context, struct scpi_token* command);
-scpi_error_t get_voltage_3(struct scpi_parser_context* context, struct scpi_token* command);
-scpi_error_t set_voltage(struct scpi_parser_context* context, struct scpi_token* command);
-scpi_error_t set_voltage_2(struct scpi_parser_context* context, struct scpi_token* command);
+const struct channel_pins input_pins = {3, {0, 1, 2}};
+const struct channel_pins output_pins = {2, {3, 5}};
 
-void setup()
-{
-  struct scpi_command* source;
-  struct scpi_command* measure;
+/*
+ * The average being taken after INITiate:AVERage, one sample on each pass
+ * of loop(), in tenths of a millivolt.
+ */
+uint8_t average_pin;
+int32_t average_remaining;
+int32_t average_count;
+int32_t average_sum;
+
+/*
+ * The serial port runs at 115200 baud.  Bytes are received into a ring
+ * buffer by our own interrupt handler, rather than into the Arduino core's
+ * 64-byte buffer, so that none are lost while a slow command runs.  The
+ * core would install a handler of its own if Serial were used, so the
+ * USART is driven directly instead.
+ */
+#define BAUD_RATE 115200
 
-  /* First, initialise the parser. */
-  scpi_init(&ctx);
+struct scpi_receive_ring rx;
 
-  /*
-   * After initialising the parser, we set up the command tree.  Ours is
-   *
-   *  *IDN?         -> identify
-   *  :SOURCE
-   *    :VOLTage    -> set_voltage
-   *    :VOLTage1   -> set_voltage_2
-   *  :MEASure
-   *    :VOLTage?   -> get_voltage
-   *    :VOLTage1?  -> get_voltage_2
-   *    :VOLTage2?  -> get_voltage_3
-   */
-  scpi_register_command(ctx.command_tree, SCPI_CL_SAMELEVEL, "*IDN?", 5, "*IDN?", 5, identify);
+ISR(USART_RX_vect)
+{
+  scpi_receive(&rx, UDR0);
+}
 
-  source = scpi_register_command(ctx.command_tree, SCPI_CL_CHILD, "SOURCE", 6, "SOUR", 4, NULL);
-  measure = scpi_register_command(ctx.command_tree, SCPI_CL_CHILD, "MEASURE", 7, "MEAS", 4, NULL);
+/*
+ * Responses are collected by the parser and written to the serial port
+ * in a single burst at the end of each message.
+ */
+void write_response(void* opaque, const char* data, size_t length)
+{
+  size_t i;
 
-  scpi_register_command(source, SCPI_CL_CHILD, "VOLTAGE", 7, "VOLT", 4, set_voltage);
-  scpi_register_command(source, SCPI_CL_CHILD, "VOLTAGE1", 8, "VOLT1", 5, set_voltage_2);
+  for(i = 0; i < length; i++)
+  {
+    while(!(UCSR0A & _BV(UDRE0)));
+    UDR0 = data[i];
+  }
+}
 
-  scpi_register_command(measure, SCPI_CL_CHILD, "VOLTAGE?", 8, "VOLT?", 5, get_voltage);
-  scpi_register_command(measure, SCPI_CL_CHILD, "VOLTAGE1?", 9, "VOLT1?", 6, get_voltage_2);
-  scpi_register_command(measure, SCPI_CL_CHILD, "VOLTAGE2?", 9, "VOLT2?", 6, get_voltage_3);
+void setup()
+{
+  /* First, initialise the parser with our command tree. */
+  meter_commands_init(&ctx);
+  scpi_set_output(&ctx, write_response, NULL);
+  scpi_receive_init(&rx);
 
   /*
    * Next, we set our outputs to some default value.
@@ -48,23 +69,32 @@ void setup()
   analogWrite(3, 0);
   analogWrite(5, 0);
 
-  Serial.begin(9600);
+  /* 8 data bits, no parity and one stop bit, as Serial.begin would set. */
+  UCSR0A = _BV(U2X0);
+  UBRR0 = (F_CPU / 4 / BAUD_RATE - 1) / 2;
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
 }
 
 void loop()
 {
-  char line_buffer[256];
-  unsigned char read_length;
-
-  while(1)
+  /* Take the next sample of the average, if one is being taken. */
+  if(average_remaining > 0)
   {
-    /* Read in a line and execute it. */
-    read_length = Serial.readBytesUntil('\n', line_buffer, 256);
-    if(read_length > 0)
+    average_sum += analogRead(average_pin) * 50000L / 1024;
+    average_remaining--;
+
+    if(average_remaining == 0)
     {
-      scpi_execute_command(&ctx, line_buffer, read_length);
+      scpi_complete(&ctx);
     }
   }
+
+  /*
+   * Pass the bytes received so far to the parser.  While *WAI or *OPC?
+   * waits for the average, the parser leaves them in the ring.
+   */
+  scpi_receive_drain(&ctx, &rx);
 }
 
 
@@ -73,145 +103,244 @@ void loop()
  */
 scpi_error_t identify(struct scpi_parser_context* context, struct scpi_token* command)
 {
-  scpi_free_tokens(command);
-
-  Serial.println("OIC,Embedded SCPI Example,1,10");
+  scpi_write_string(context, "OIC,Embedded SCPI Example,1,10");
   return SCPI_SUCCESS;
 }
 
-/**
- * Read the voltage on A0.
+/*
+ * Check that the channel given by a command's numeric suffix exists,
+ * queueing an error if it does not.
  */
-scpi_error_t get_voltage(struct scpi_parser_context* context, struct scpi_token* command)
+int valid_channel(struct scpi_parser_context* context)
 {
-  float voltage;
+  const struct channel_pins* channels = (const struct channel_pins*)context->user_data;
 
-  voltage = analogRead(0) * 5.0f/1024;
-  Serial.println(voltage,4);
+  if(context->suffix < 1 || context->suffix > channels->count)
+  {
+    scpi_queue_error(context, SCPI_ERROR_HEADER_SUFFIX);
+    return 0;
+  }
 
-  scpi_free_tokens(command);
-  return SCPI_SUCCESS;
+  return 1;
 }
 
 /**
- * Read the voltage on A1.
+ * Read the voltage on an analogue input.
  */
-scpi_error_t get_voltage_2(struct scpi_parser_context* context, struct scpi_token* command)
+scpi_error_t get_voltage(struct scpi_parser_context* context, struct scpi_token* command)
 {
-  float voltage;
+  const struct channel_pins* channels = (const struct channel_pins*)context->user_data;
+  int32_t voltage;
+
+  if(!valid_channel(context))
+  {
+    return SCPI_SUCCESS;
+  }
 
-  voltage = analogRead(1) * 5.0f/1024;
-  Serial.println(voltage,4);
+  /* In tenths of a millivolt, to print with four places as before. */
+  voltage = analogRead(channels->pins[context->suffix-1]) * 50000L / 1024;
+  scpi_write_fixed(context, voltage, 4);
 
-  scpi_free_tokens(command);
   return SCPI_SUCCESS;
 }
 
+/*
+ * The most samples that MEASure:ARRay:VOLTage? can take at once.
+ */
+#define MAX_SAMPLES 32
+
 /**
- * Read the voltage on A2.
+ * Read a number of samples from an analogue input, in ADC counts.  These
+ * are sent in the format selected with FORMat:DATA, so after FORM INT,16
+ * each sample takes two bytes and needs no formatting.
  */
-scpi_error_t get_voltage_3(struct scpi_parser_context* context, struct scpi_token* command)
+scpi_error_t get_samples(struct scpi_parser_context* context, struct scpi_token* command)
 {
-  float voltage;
+  const struct channel_pins* channels = (const struct channel_pins*)context->user_data;
+  struct scpi_parameter_iterator params;
+  struct scpi_token arg;
+  struct scpi_numeric_fixed count;
+  int16_t samples[MAX_SAMPLES];
+  int32_t i;
+
+  if(!valid_channel(context))
+  {
+    return SCPI_SUCCESS;
+  }
 
-  voltage = analogRead(2) * 5.0f/1024;
-  Serial.println(voltage,4);
+  scpi_parameter_iterator_init(&params, command->value, command->length);
+  if(!scpi_next_parameter(&params, &arg))
+  {
+    scpi_queue_error(context, SCPI_ERROR_MISSING_PARAMETER);
+    return SCPI_SUCCESS;
+  }
+
+  count = scpi_parse_numeric_fixed(arg.value, arg.length, 0, 1, 1, MAX_SAMPLES);
+  if(count.status != SCPI_NUMERIC_SUCCESS)
+  {
+    scpi_queue_error(context, SCPI_ERROR_NUMERIC_DATA);
+    return SCPI_SUCCESS;
+  }
+  else if(count.value < 1 || count.value > MAX_SAMPLES)
+  {
+    scpi_queue_error(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+    return SCPI_SUCCESS;
+  }
+
+  for(i = 0; i < count.value; i++)
+  {
+    samples[i] = analogRead(channels->pins[context->suffix-1]);
+  }
+
+  scpi_write_integers(context, samples, count.value);
 
-  scpi_free_tokens(command);
   return SCPI_SUCCESS;
 }
 
+/*
+ * The most samples that INITiate:AVERage can average.
+ */
+#define MAX_AVERAGE 256
+
 /**
- * Set the voltage using PWM on pin 3.
+ * Start averaging a number of samples from an analogue input.  This
+ * returns at once, so that commands for the outputs are still executed
+ * while loop() takes the samples; "INIT:AVER 256;*WAI;:FETC:AVER?"
+ * waits for the average, and *OPC or *OPC? report when it is ready.
  */
-scpi_error_t set_voltage(struct scpi_parser_context* context, struct scpi_token* command)
+scpi_error_t start_average(struct scpi_parser_context* context, struct scpi_token* command)
 {
-  struct scpi_token* args;
-  struct scpi_numeric output_numeric;
-  unsigned char output_value;
+  const struct channel_pins* channels = (const struct channel_pins*)context->user_data;
+  struct scpi_parameter_iterator params;
+  struct scpi_token arg;
+  struct scpi_numeric_fixed count;
 
-  args = command;
+  if(!valid_channel(context))
+  {
+    return SCPI_SUCCESS;
+  }
 
-  while(args != NULL && args->type == 0)
+  /* Only one average may be taken at a time. */
+  if(average_remaining > 0)
   {
-    args = args->next;
+    scpi_queue_error(context, SCPI_ERROR_EXECUTION);
+    return SCPI_SUCCESS;
   }
 
-  output_numeric = scpi_parse_numeric(args->value, args->length, 0, 0, 5);
-  if(output_numeric.length == 0 ||
-    (output_numeric.length == 1 && output_numeric.unit[0] == 'V'))
+  scpi_parameter_iterator_init(&params, command->value, command->length);
+  if(!scpi_next_parameter(&params, &arg))
   {
-    output_value = (unsigned char)constrain(output_numeric.value / 5.0f * 256.0f, 0, 255);
+    scpi_queue_error(context, SCPI_ERROR_MISSING_PARAMETER);
+    return SCPI_SUCCESS;
   }
-  else if(output_numeric.length == 2 &&
-    output_numeric.unit[0] == 'N' && output_numeric.unit[1] == 'T')
+
+  count = scpi_parse_numeric_fixed(arg.value, arg.length, 0, 1, 1, MAX_AVERAGE);
+  if(count.status != SCPI_NUMERIC_SUCCESS)
   {
-    output_value = (unsigned char)constrain(output_numeric.value, 0, 255);
+    scpi_queue_error(context, SCPI_ERROR_NUMERIC_DATA);
+    return SCPI_SUCCESS;
   }
-  else
+  else if(count.value < 1 || count.value > MAX_AVERAGE)
   {
-    scpi_error error;
-    error.id = -200;
-    error.description = "Command error;Invalid unit";
-    error.length = 26;
-    Serial.print(output_numeric.length);
+    scpi_queue_error(context, SCPI_ERROR_DATA_OUT_OF_RANGE);
+    return SCPI_SUCCESS;
+  }
+
+  average_pin = channels->pins[context->suffix-1];
+  average_count = count.value;
+  average_remaining = count.value;
+  average_sum = 0;
 
-    scpi_queue_error(&ctx, error);
-    scpi_free_tokens(command);
+  return SCPI_PENDING;
+}
+
+/**
+ * Read the last average taken, or the part of it taken so far.
+ */
+scpi_error_t get_average(struct scpi_parser_context* context, struct scpi_token* command)
+{
+  int32_t taken = average_count - average_remaining;
+
+  if(taken == 0)
+  {
+    scpi_queue_error(context, SCPI_ERROR_EXECUTION);
     return SCPI_SUCCESS;
   }
 
-  analogWrite(3, output_value);
+  scpi_write_fixed(context, average_sum / taken, 4);
+
+  return SCPI_SUCCESS;
+}
+
+/**
+ * Report the most bytes that the receive ring has held at once, and the
+ * number lost because it was full.
+ */
+scpi_error_t get_receive_statistics(struct scpi_parser_context* context,
+  struct scpi_token* command)
+{
+  unsigned long overflows;
 
-  scpi_free_tokens(command);
+  /* The count is four bytes, which the interrupt handler may be changing. */
+  noInterrupts();
+  overflows = rx.overflows;
+  interrupts();
+
+  scpi_write_fixed(context, rx.high_water, 0);
+  scpi_write(context, ",", 1);
+  scpi_write_fixed(context, (int32_t)overflows, 0);
 
   return SCPI_SUCCESS;
 }
 
 /**
- * Set the voltage using PWM on pin 5.
+ * Set the voltage of an output using PWM.
  */
-scpi_error_t set_voltage_2(struct scpi_parser_context* context, struct scpi_token* command)
+scpi_error_t set_voltage(struct scpi_parser_context* context, struct scpi_token* command)
 {
-  struct scpi_token* args;
-  struct scpi_numeric output_numeric;
+  const struct channel_pins* channels = (const struct channel_pins*)context->user_data;
+  struct scpi_parameter_iterator params;
+  struct scpi_token arg;
+  struct scpi_numeric_fixed output_numeric;
   unsigned char output_value;
 
-  args = command;
+  if(!valid_channel(context))
+  {
+    return SCPI_SUCCESS;
+  }
 
-  while(args != NULL && args->type == 0)
+  scpi_parameter_iterator_init(&params, command->value, command->length);
+  if(!scpi_next_parameter(&params, &arg))
   {
-    args = args->next;
+    scpi_queue_error(context, SCPI_ERROR_MISSING_PARAMETER);
+    return SCPI_SUCCESS;
   }
 
-  output_numeric = scpi_parse_numeric(args->value, args->length, 0, 0, 5);
-  if(output_numeric.length == 0 ||
-    (output_numeric.length == 1 && output_numeric.unit[0] == 'V'))
+  /* In millivolts, so that no floating-point arithmetic is needed. */
+  output_numeric = scpi_parse_numeric_fixed(arg.value, arg.length, 3, 0, 0, 5000);
+  if(output_numeric.status != SCPI_NUMERIC_SUCCESS)
   {
-    output_value = (unsigned char)constrain(output_numeric.value / 5.0f * 256.0f, 0, 255);
+    scpi_queue_error(context, SCPI_ERROR_NUMERIC_DATA);
+    return SCPI_SUCCESS;
+  }
+  else if(output_numeric.unit_id == SCPI_UNIT_NONE ||
+    output_numeric.unit_id == SCPI_UNIT_VOLT)
+  {
+    /* Full scale is 5 V, which is held at the top count. */
+    output_value = (unsigned char)(constrain(output_numeric.value, 0, 4999) * 256L / 5000);
   }
-  else if(output_numeric.length == 2 &&
+  else if(output_numeric.unit_id == SCPI_UNIT_UNKNOWN && output_numeric.length == 2 &&
     output_numeric.unit[0] == 'N' && output_numeric.unit[1] == 'T')
   {
-    output_value = (unsigned char)constrain(output_numeric.value, 0, 255);
+    output_value = (unsigned char)constrain(output_numeric.value / 1000, 0, 255);
   }
   else
   {
-    scpi_error error;
-    error.id = -200;
-    error.description = "Command error;Invalid unit";
-    error.length = 26;
-    Serial.print(output_numeric.length);
-
-    scpi_queue_error(&ctx, error);
-    scpi_free_tokens(command);
+    scpi_queue_error(context, SCPI_ERROR_INVALID_SUFFIX);
     return SCPI_SUCCESS;
   }
 
-  analogWrite(5, output_value);
-
-  scpi_free_tokens(command);
+  analogWrite(channels->pins[context->suffix-1], output_value);
 
   return SCPI_SUCCESS;
 }
-
@@ -0,0 +1,18 @@
+#ifndef __CHANNELS_H
+#define __CHANNELS_H
+
+/*
+ * The pins used by each channel, which are numbered from 1.  These are
+ * given to the commands as user data, so that one callback can serve
+ * every channel.
+ */
+struct channel_pins
+{
+  unsigned char count;
+  unsigned char pins[3];
+};
+
+extern const struct channel_pins input_pins;
+extern const struct channel_pins output_pins;
+
+#endif
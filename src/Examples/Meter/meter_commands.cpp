@@ -0,0 +1,883 @@
+/*
+ * Generated by scpigen.py from meter.scpi.  Do not edit.
+ */
+
+#include "channels.h"
+#include "meter_commands.h"
+
+static const char meter_commands_name_1[] SCPI_PROGMEM = "*IDN?";
+static const char meter_commands_name_2[] SCPI_PROGMEM = "SOURCE";
+static const char meter_commands_short_name_2[] SCPI_PROGMEM = "SOUR";
+static const char meter_commands_name_3[] SCPI_PROGMEM = "VOLTAGE#";
+static const char meter_commands_short_name_3[] SCPI_PROGMEM = "VOLT#";
+static const char meter_commands_name_4[] SCPI_PROGMEM = "MEASURE";
+static const char meter_commands_short_name_4[] SCPI_PROGMEM = "MEAS";
+static const char meter_commands_name_5[] SCPI_PROGMEM = "VOLTAGE#?";
+static const char meter_commands_short_name_5[] SCPI_PROGMEM = "VOLT#?";
+static const char meter_commands_name_6[] SCPI_PROGMEM = "ARRAY";
+static const char meter_commands_short_name_6[] SCPI_PROGMEM = "ARR";
+static const char meter_commands_name_7[] SCPI_PROGMEM = "VOLTAGE#?";
+static const char meter_commands_short_name_7[] SCPI_PROGMEM = "VOLT#?";
+static const char meter_commands_name_8[] SCPI_PROGMEM = "INITIATE";
+static const char meter_commands_short_name_8[] SCPI_PROGMEM = "INIT";
+static const char meter_commands_name_9[] SCPI_PROGMEM = "AVERAGE#";
+static const char meter_commands_short_name_9[] SCPI_PROGMEM = "AVER#";
+static const char meter_commands_name_10[] SCPI_PROGMEM = "FETCH";
+static const char meter_commands_short_name_10[] SCPI_PROGMEM = "FETC";
+static const char meter_commands_name_11[] SCPI_PROGMEM = "AVERAGE?";
+static const char meter_commands_short_name_11[] SCPI_PROGMEM = "AVER?";
+static const char meter_commands_name_12[] SCPI_PROGMEM = "DIAGNOSTIC";
+static const char meter_commands_short_name_12[] SCPI_PROGMEM = "DIAG";
+static const char meter_commands_name_13[] SCPI_PROGMEM = "RECEIVE?";
+static const char meter_commands_short_name_13[] SCPI_PROGMEM = "REC?";
+
+const struct scpi_command meter_commands_tree[14] SCPI_PROGMEM =
+{
+	{
+		NULL, 0, NULL, 0,
+		(struct scpi_command*)&meter_commands_tree[1], (struct scpi_command*)&meter_commands_tree[2],
+		NULL, NULL, NULL, NULL, NULL
+	},
+
+	/* *IDN? */
+	{
+		meter_commands_name_1, 5, meter_commands_name_1, 5,
+		(struct scpi_command*)&scpi_esr_query_command, NULL,
+		identify, NULL, NULL, NULL, NULL
+	},
+
+	/* SOURCE */
+	{
+		meter_commands_name_2, 6, meter_commands_short_name_2, 4,
+		(struct scpi_command*)&meter_commands_tree[4], (struct scpi_command*)&meter_commands_tree[3],
+		NULL, NULL, NULL, NULL, NULL
+	},
+
+	/* VOLTAGE# */
+	{
+		meter_commands_name_3, 8, meter_commands_short_name_3, 5,
+		NULL, NULL,
+		set_voltage, NULL, (void*)(&output_pins), NULL, NULL
+	},
+
+	/* MEASURE */
+	{
+		meter_commands_name_4, 7, meter_commands_short_name_4, 4,
+		(struct scpi_command*)&meter_commands_tree[8], (struct scpi_command*)&meter_commands_tree[5],
+		NULL, NULL, NULL, NULL, NULL
+	},
+
+	/* VOLTAGE#? */
+	{
+		meter_commands_name_5, 9, meter_commands_short_name_5, 6,
+		(struct scpi_command*)&meter_commands_tree[6], NULL,
+		get_voltage, NULL, (void*)(&input_pins), NULL, NULL
+	},
+
+	/* ARRAY */
+	{
+		meter_commands_name_6, 5, meter_commands_short_name_6, 3,
+		NULL, (struct scpi_command*)&meter_commands_tree[7],
+		NULL, NULL, NULL, NULL, NULL
+	},
+
+	/* VOLTAGE#? */
+	{
+		meter_commands_name_7, 9, meter_commands_short_name_7, 6,
+		NULL, NULL,
+		get_samples, NULL, (void*)(&input_pins), NULL, NULL
+	},
+
+	/* INITIATE */
+	{
+		meter_commands_name_8, 8, meter_commands_short_name_8, 4,
+		(struct scpi_command*)&meter_commands_tree[10], (struct scpi_command*)&meter_commands_tree[9],
+		NULL, NULL, NULL, NULL, NULL
+	},
+
+	/* AVERAGE# */
+	{
+		meter_commands_name_9, 8, meter_commands_short_name_9, 5,
+		NULL, NULL,
+		start_average, NULL, (void*)(&input_pins), NULL, NULL
+	},
+
+	/* FETCH */
+	{
+		meter_commands_name_10, 5, meter_commands_short_name_10, 4,
+		(struct scpi_command*)&meter_commands_tree[12], (struct scpi_command*)&meter_commands_tree[11],
+		NULL, NULL, NULL, NULL, NULL
+	},
+
+	/* AVERAGE? */
+	{
+		meter_commands_name_11, 8, meter_commands_short_name_11, 5,
+		NULL, NULL,
+		get_average, NULL, NULL, NULL, NULL
+	},
+
+	/* DIAGNOSTIC */
+	{
+		meter_commands_name_12, 10, meter_commands_short_name_12, 4,
+		(struct scpi_command*)&scpi_format_command, (struct scpi_command*)&meter_commands_tree[13],
+		NULL, NULL, NULL, NULL, NULL
+	},
+
+	/* RECEIVE? */
+	{
+		meter_commands_name_13, 8, meter_commands_short_name_13, 4,
+		NULL, NULL,
+		get_receive_statistics, NULL, NULL, NULL, NULL
+	}
+};
+
+const char meter_commands_listing[] SCPI_PROGMEM =
+	"\tSOURCE\n"
+	"\t\tVOLTAGE#\n"
+	"\tMEASURE\n"
+	"\t\tVOLTAGE#?\n"
+	"\t\tARRAY\n"
+	"\t\t\tVOLTAGE#?\n"
+	"\tINITIATE\n"
+	"\t\tAVERAGE#\n"
+	"\tFETCH\n"
+	"\t\tAVERAGE?\n"
+	"\tDIAGNOSTIC\n"
+	"\t\tRECEIVE?\n"
+	"\tFORMAT\n"
+	"\t\tDATA\n"
+	"\t\tDATA?\n"
+	"\t\tBORDER\n"
+	"\t\tBORDER?\n"
+	"\tSYSTEM\n"
+	"\t\tERROR\n"
+	"\t\t\tNEXT?\n"
+	"\t\tERROR?\n"
+	"*IDN?\n"
+	"*ESR?\n"
+	"*OPC\n"
+	"*OPC?\n"
+	"*WAI\n"
+	;
+
+/*
+ * Read the numeric suffix of a mnemonic, which is 1 if there are no digits.
+ * The suffix is at most nine digits, so that it cannot overflow.
+ */
+static int
+meter_commands_suffix(const char* digits, size_t length, unsigned long* suffix)
+{
+	unsigned long value;
+	size_t i;
+	
+	if(length > 9)
+	{
+		return 0;
+	}
+	
+	value = 1;
+	if(length > 0)
+	{
+		value = 0;
+		for(i = 0; i < length; i++)
+		{
+			if(digits[i] < '0' || digits[i] > '9')
+			{
+				return 0;
+			}
+			
+			value = value*10 + (digits[i]-'0');
+		}
+	}
+	
+	*suffix = value;
+	return 1;
+}
+
+/*
+ * Find a top-level command.
+ */
+static const struct scpi_command*
+meter_commands_match_0(const char* name, size_t length, unsigned long* suffix)
+{
+	switch(length)
+	{
+	case 4:
+		switch(name[0] | 0x20)
+		{
+		case 'd':
+			/* DIAG */
+			if((name[1] | 0x20) == 'i'
+				&& (name[2] | 0x20) == 'a'
+				&& (name[3] | 0x20) == 'g')
+			{
+				return &meter_commands_tree[12];
+			}
+
+			break;
+		case 'f':
+			/* FETC */
+			if((name[1] | 0x20) == 'e'
+				&& (name[2] | 0x20) == 't'
+				&& (name[3] | 0x20) == 'c')
+			{
+				return &meter_commands_tree[10];
+			}
+
+			/* FORM */
+			if((name[1] | 0x20) == 'o'
+				&& (name[2] | 0x20) == 'r'
+				&& (name[3] | 0x20) == 'm')
+			{
+				return &scpi_format_command;
+			}
+
+			break;
+		case 'i':
+			/* INIT */
+			if((name[1] | 0x20) == 'n'
+				&& (name[2] | 0x20) == 'i'
+				&& (name[3] | 0x20) == 't')
+			{
+				return &meter_commands_tree[8];
+			}
+
+			break;
+		case 'm':
+			/* MEAS */
+			if((name[1] | 0x20) == 'e'
+				&& (name[2] | 0x20) == 'a'
+				&& (name[3] | 0x20) == 's')
+			{
+				return &meter_commands_tree[4];
+			}
+
+			break;
+		case 's':
+			/* SOUR */
+			if((name[1] | 0x20) == 'o'
+				&& (name[2] | 0x20) == 'u'
+				&& (name[3] | 0x20) == 'r')
+			{
+				return &meter_commands_tree[2];
+			}
+
+			/* SYST */
+			if((name[1] | 0x20) == 'y'
+				&& (name[2] | 0x20) == 's'
+				&& (name[3] | 0x20) == 't')
+			{
+				return &scpi_system_command;
+			}
+
+			break;
+		}
+		break;
+	case 5:
+		/* FETCH */
+		if((name[0] | 0x20) == 'f'
+			&& (name[1] | 0x20) == 'e'
+			&& (name[2] | 0x20) == 't'
+			&& (name[3] | 0x20) == 'c'
+			&& (name[4] | 0x20) == 'h')
+		{
+			return &meter_commands_tree[10];
+		}
+
+		break;
+	case 6:
+		switch(name[0] | 0x20)
+		{
+		case 'f':
+			/* FORMAT */
+			if((name[1] | 0x20) == 'o'
+				&& (name[2] | 0x20) == 'r'
+				&& (name[3] | 0x20) == 'm'
+				&& (name[4] | 0x20) == 'a'
+				&& (name[5] | 0x20) == 't')
+			{
+				return &scpi_format_command;
+			}
+
+			break;
+		case 's':
+			/* SOURCE */
+			if((name[1] | 0x20) == 'o'
+				&& (name[2] | 0x20) == 'u'
+				&& (name[3] | 0x20) == 'r'
+				&& (name[4] | 0x20) == 'c'
+				&& (name[5] | 0x20) == 'e')
+			{
+				return &meter_commands_tree[2];
+			}
+
+			/* SYSTEM */
+			if((name[1] | 0x20) == 'y'
+				&& (name[2] | 0x20) == 's'
+				&& (name[3] | 0x20) == 't'
+				&& (name[4] | 0x20) == 'e'
+				&& (name[5] | 0x20) == 'm')
+			{
+				return &scpi_system_command;
+			}
+
+			break;
+		}
+		break;
+	case 7:
+		/* MEASURE */
+		if((name[0] | 0x20) == 'm'
+			&& (name[1] | 0x20) == 'e'
+			&& (name[2] | 0x20) == 'a'
+			&& (name[3] | 0x20) == 's'
+			&& (name[4] | 0x20) == 'u'
+			&& (name[5] | 0x20) == 'r'
+			&& (name[6] | 0x20) == 'e')
+		{
+			return &meter_commands_tree[4];
+		}
+
+		break;
+	case 8:
+		/* INITIATE */
+		if((name[0] | 0x20) == 'i'
+			&& (name[1] | 0x20) == 'n'
+			&& (name[2] | 0x20) == 'i'
+			&& (name[3] | 0x20) == 't'
+			&& (name[4] | 0x20) == 'i'
+			&& (name[5] | 0x20) == 'a'
+			&& (name[6] | 0x20) == 't'
+			&& (name[7] | 0x20) == 'e')
+		{
+			return &meter_commands_tree[8];
+		}
+
+		break;
+	case 10:
+		/* DIAGNOSTIC */
+		if((name[0] | 0x20) == 'd'
+			&& (name[1] | 0x20) == 'i'
+			&& (name[2] | 0x20) == 'a'
+			&& (name[3] | 0x20) == 'g'
+			&& (name[4] | 0x20) == 'n'
+			&& (name[5] | 0x20) == 'o'
+			&& (name[6] | 0x20) == 's'
+			&& (name[7] | 0x20) == 't'
+			&& (name[8] | 0x20) == 'i'
+			&& (name[9] | 0x20) == 'c')
+		{
+			return &meter_commands_tree[12];
+		}
+
+		break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a child of SOURCE.
+ */
+static const struct scpi_command*
+meter_commands_match_2(const char* name, size_t length, unsigned long* suffix)
+{
+	switch(length)
+	{
+	case 5:
+		/* VOLT# */
+		if((name[0] | 0x20) == 'v'
+			&& (name[1] | 0x20) == 'o'
+			&& (name[2] | 0x20) == 'l'
+			&& (name[3] | 0x20) == 't'
+			&& name[4] == '#')
+		{
+			return &meter_commands_tree[3];
+		}
+
+		break;
+	case 8:
+		/* VOLTAGE# */
+		if((name[0] | 0x20) == 'v'
+			&& (name[1] | 0x20) == 'o'
+			&& (name[2] | 0x20) == 'l'
+			&& (name[3] | 0x20) == 't'
+			&& (name[4] | 0x20) == 'a'
+			&& (name[5] | 0x20) == 'g'
+			&& (name[6] | 0x20) == 'e'
+			&& name[7] == '#')
+		{
+			return &meter_commands_tree[3];
+		}
+
+		break;
+	}
+
+	/* VOLTAGE# */
+	if(length >= 7
+		&& (name[0] | 0x20) == 'v'
+		&& (name[1] | 0x20) == 'o'
+		&& (name[2] | 0x20) == 'l'
+		&& (name[3] | 0x20) == 't'
+		&& (name[4] | 0x20) == 'a'
+		&& (name[5] | 0x20) == 'g'
+		&& (name[6] | 0x20) == 'e'
+		&& meter_commands_suffix(name+7, length-7, suffix))
+	{
+		return &meter_commands_tree[3];
+	}
+
+	/* VOLT# */
+	if(length >= 4
+		&& (name[0] | 0x20) == 'v'
+		&& (name[1] | 0x20) == 'o'
+		&& (name[2] | 0x20) == 'l'
+		&& (name[3] | 0x20) == 't'
+		&& meter_commands_suffix(name+4, length-4, suffix))
+	{
+		return &meter_commands_tree[3];
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a child of MEASURE.
+ */
+static const struct scpi_command*
+meter_commands_match_4(const char* name, size_t length, unsigned long* suffix)
+{
+	switch(length)
+	{
+	case 3:
+		/* ARR */
+		if((name[0] | 0x20) == 'a'
+			&& (name[1] | 0x20) == 'r'
+			&& (name[2] | 0x20) == 'r')
+		{
+			return &meter_commands_tree[6];
+		}
+
+		break;
+	case 5:
+		/* ARRAY */
+		if((name[0] | 0x20) == 'a'
+			&& (name[1] | 0x20) == 'r'
+			&& (name[2] | 0x20) == 'r'
+			&& (name[3] | 0x20) == 'a'
+			&& (name[4] | 0x20) == 'y')
+		{
+			return &meter_commands_tree[6];
+		}
+
+		break;
+	case 6:
+		/* VOLT#? */
+		if((name[0] | 0x20) == 'v'
+			&& (name[1] | 0x20) == 'o'
+			&& (name[2] | 0x20) == 'l'
+			&& (name[3] | 0x20) == 't'
+			&& name[4] == '#'
+			&& name[5] == '?')
+		{
+			return &meter_commands_tree[5];
+		}
+
+		break;
+	case 9:
+		/* VOLTAGE#? */
+		if((name[0] | 0x20) == 'v'
+			&& (name[1] | 0x20) == 'o'
+			&& (name[2] | 0x20) == 'l'
+			&& (name[3] | 0x20) == 't'
+			&& (name[4] | 0x20) == 'a'
+			&& (name[5] | 0x20) == 'g'
+			&& (name[6] | 0x20) == 'e'
+			&& name[7] == '#'
+			&& name[8] == '?')
+		{
+			return &meter_commands_tree[5];
+		}
+
+		break;
+	}
+
+	/* VOLTAGE#? */
+	if(length >= 8
+		&& name[length-1] == '?'
+		&& (name[0] | 0x20) == 'v'
+		&& (name[1] | 0x20) == 'o'
+		&& (name[2] | 0x20) == 'l'
+		&& (name[3] | 0x20) == 't'
+		&& (name[4] | 0x20) == 'a'
+		&& (name[5] | 0x20) == 'g'
+		&& (name[6] | 0x20) == 'e'
+		&& meter_commands_suffix(name+7, length-8, suffix))
+	{
+		return &meter_commands_tree[5];
+	}
+
+	/* VOLT#? */
+	if(length >= 5
+		&& name[length-1] == '?'
+		&& (name[0] | 0x20) == 'v'
+		&& (name[1] | 0x20) == 'o'
+		&& (name[2] | 0x20) == 'l'
+		&& (name[3] | 0x20) == 't'
+		&& meter_commands_suffix(name+4, length-5, suffix))
+	{
+		return &meter_commands_tree[5];
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a child of ARRAY.
+ */
+static const struct scpi_command*
+meter_commands_match_6(const char* name, size_t length, unsigned long* suffix)
+{
+	switch(length)
+	{
+	case 6:
+		/* VOLT#? */
+		if((name[0] | 0x20) == 'v'
+			&& (name[1] | 0x20) == 'o'
+			&& (name[2] | 0x20) == 'l'
+			&& (name[3] | 0x20) == 't'
+			&& name[4] == '#'
+			&& name[5] == '?')
+		{
+			return &meter_commands_tree[7];
+		}
+
+		break;
+	case 9:
+		/* VOLTAGE#? */
+		if((name[0] | 0x20) == 'v'
+			&& (name[1] | 0x20) == 'o'
+			&& (name[2] | 0x20) == 'l'
+			&& (name[3] | 0x20) == 't'
+			&& (name[4] | 0x20) == 'a'
+			&& (name[5] | 0x20) == 'g'
+			&& (name[6] | 0x20) == 'e'
+			&& name[7] == '#'
+			&& name[8] == '?')
+		{
+			return &meter_commands_tree[7];
+		}
+
+		break;
+	}
+
+	/* VOLTAGE#? */
+	if(length >= 8
+		&& name[length-1] == '?'
+		&& (name[0] | 0x20) == 'v'
+		&& (name[1] | 0x20) == 'o'
+		&& (name[2] | 0x20) == 'l'
+		&& (name[3] | 0x20) == 't'
+		&& (name[4] | 0x20) == 'a'
+		&& (name[5] | 0x20) == 'g'
+		&& (name[6] | 0x20) == 'e'
+		&& meter_commands_suffix(name+7, length-8, suffix))
+	{
+		return &meter_commands_tree[7];
+	}
+
+	/* VOLT#? */
+	if(length >= 5
+		&& name[length-1] == '?'
+		&& (name[0] | 0x20) == 'v'
+		&& (name[1] | 0x20) == 'o'
+		&& (name[2] | 0x20) == 'l'
+		&& (name[3] | 0x20) == 't'
+		&& meter_commands_suffix(name+4, length-5, suffix))
+	{
+		return &meter_commands_tree[7];
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a child of INITIATE.
+ */
+static const struct scpi_command*
+meter_commands_match_8(const char* name, size_t length, unsigned long* suffix)
+{
+	switch(length)
+	{
+	case 5:
+		/* AVER# */
+		if((name[0] | 0x20) == 'a'
+			&& (name[1] | 0x20) == 'v'
+			&& (name[2] | 0x20) == 'e'
+			&& (name[3] | 0x20) == 'r'
+			&& name[4] == '#')
+		{
+			return &meter_commands_tree[9];
+		}
+
+		break;
+	case 8:
+		/* AVERAGE# */
+		if((name[0] | 0x20) == 'a'
+			&& (name[1] | 0x20) == 'v'
+			&& (name[2] | 0x20) == 'e'
+			&& (name[3] | 0x20) == 'r'
+			&& (name[4] | 0x20) == 'a'
+			&& (name[5] | 0x20) == 'g'
+			&& (name[6] | 0x20) == 'e'
+			&& name[7] == '#')
+		{
+			return &meter_commands_tree[9];
+		}
+
+		break;
+	}
+
+	/* AVERAGE# */
+	if(length >= 7
+		&& (name[0] | 0x20) == 'a'
+		&& (name[1] | 0x20) == 'v'
+		&& (name[2] | 0x20) == 'e'
+		&& (name[3] | 0x20) == 'r'
+		&& (name[4] | 0x20) == 'a'
+		&& (name[5] | 0x20) == 'g'
+		&& (name[6] | 0x20) == 'e'
+		&& meter_commands_suffix(name+7, length-7, suffix))
+	{
+		return &meter_commands_tree[9];
+	}
+
+	/* AVER# */
+	if(length >= 4
+		&& (name[0] | 0x20) == 'a'
+		&& (name[1] | 0x20) == 'v'
+		&& (name[2] | 0x20) == 'e'
+		&& (name[3] | 0x20) == 'r'
+		&& meter_commands_suffix(name+4, length-4, suffix))
+	{
+		return &meter_commands_tree[9];
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a child of FETCH.
+ */
+static const struct scpi_command*
+meter_commands_match_10(const char* name, size_t length, unsigned long* suffix)
+{
+	switch(length)
+	{
+	case 5:
+		/* AVER? */
+		if((name[0] | 0x20) == 'a'
+			&& (name[1] | 0x20) == 'v'
+			&& (name[2] | 0x20) == 'e'
+			&& (name[3] | 0x20) == 'r'
+			&& name[4] == '?')
+		{
+			return &meter_commands_tree[11];
+		}
+
+		break;
+	case 8:
+		/* AVERAGE? */
+		if((name[0] | 0x20) == 'a'
+			&& (name[1] | 0x20) == 'v'
+			&& (name[2] | 0x20) == 'e'
+			&& (name[3] | 0x20) == 'r'
+			&& (name[4] | 0x20) == 'a'
+			&& (name[5] | 0x20) == 'g'
+			&& (name[6] | 0x20) == 'e'
+			&& name[7] == '?')
+		{
+			return &meter_commands_tree[11];
+		}
+
+		break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a child of DIAGNOSTIC.
+ */
+static const struct scpi_command*
+meter_commands_match_12(const char* name, size_t length, unsigned long* suffix)
+{
+	switch(length)
+	{
+	case 4:
+		/* REC? */
+		if((name[0] | 0x20) == 'r'
+			&& (name[1] | 0x20) == 'e'
+			&& (name[2] | 0x20) == 'c'
+			&& name[3] == '?')
+		{
+			return &meter_commands_tree[13];
+		}
+
+		break;
+	case 8:
+		/* RECEIVE? */
+		if((name[0] | 0x20) == 'r'
+			&& (name[1] | 0x20) == 'e'
+			&& (name[2] | 0x20) == 'c'
+			&& (name[3] | 0x20) == 'e'
+			&& (name[4] | 0x20) == 'i'
+			&& (name[5] | 0x20) == 'v'
+			&& (name[6] | 0x20) == 'e'
+			&& name[7] == '?')
+		{
+			return &meter_commands_tree[13];
+		}
+
+		break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find a common command.
+ */
+static const struct scpi_command*
+meter_commands_match_common(const char* name, size_t length, unsigned long* suffix)
+{
+	switch(length)
+	{
+	case 4:
+		/* *OPC */
+		if(name[0] == '*'
+			&& (name[1] | 0x20) == 'o'
+			&& (name[2] | 0x20) == 'p'
+			&& (name[3] | 0x20) == 'c')
+		{
+			return &scpi_opc_command;
+		}
+
+		/* *WAI */
+		if(name[0] == '*'
+			&& (name[1] | 0x20) == 'w'
+			&& (name[2] | 0x20) == 'a'
+			&& (name[3] | 0x20) == 'i')
+		{
+			return &scpi_wai_command;
+		}
+
+		break;
+	case 5:
+		switch(name[0] | 0x20)
+		{
+		case '*':
+			/* *IDN? */
+			if(name[0] == '*'
+				&& (name[1] | 0x20) == 'i'
+				&& (name[2] | 0x20) == 'd'
+				&& (name[3] | 0x20) == 'n'
+				&& name[4] == '?')
+			{
+				return &meter_commands_tree[1];
+			}
+
+			/* *ESR? */
+			if(name[0] == '*'
+				&& (name[1] | 0x20) == 'e'
+				&& (name[2] | 0x20) == 's'
+				&& (name[3] | 0x20) == 'r'
+				&& name[4] == '?')
+			{
+				return &scpi_esr_query_command;
+			}
+
+			/* *OPC? */
+			if(name[0] == '*'
+				&& (name[1] | 0x20) == 'o'
+				&& (name[2] | 0x20) == 'p'
+				&& (name[3] | 0x20) == 'c'
+				&& name[4] == '?')
+			{
+				return &scpi_opc_query_command;
+			}
+
+			break;
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+int
+meter_commands_match(const struct scpi_command* parent, const char* name, size_t length,
+		const struct scpi_command** command, unsigned long* suffix)
+{
+	if(parent == NULL)
+	{
+		*command = meter_commands_match_common(name, length, suffix);
+		return 1;
+	}
+	
+	/* Commands outside of the tree, such as SYSTem:ERRor, are searched. */
+	if(parent < meter_commands_tree || parent >= meter_commands_tree + 14)
+	{
+		return 0;
+	}
+	
+	switch(parent - meter_commands_tree)
+	{
+	case 0:
+		*command = meter_commands_match_0(name, length, suffix);
+		break;
+		
+	case 2:
+		*command = meter_commands_match_2(name, length, suffix);
+		break;
+		
+	case 4:
+		*command = meter_commands_match_4(name, length, suffix);
+		break;
+		
+	case 6:
+		*command = meter_commands_match_6(name, length, suffix);
+		break;
+		
+	case 8:
+		*command = meter_commands_match_8(name, length, suffix);
+		break;
+		
+	case 10:
+		*command = meter_commands_match_10(name, length, suffix);
+		break;
+		
+	case 12:
+		*command = meter_commands_match_12(name, length, suffix);
+		break;
+		
+	default:
+		*command = NULL;
+		break;
+	}
+	
+	return 1;
+}
+
+void
+meter_commands_init(struct scpi_parser_context* ctx)
+{
+	scpi_init_const(ctx, &meter_commands_tree[0]);
+	scpi_set_command_matcher(ctx, meter_commands_match);
+}
+
+void
+meter_commands_tree_init(struct scpi_tree* tree)
+{
+	scpi_tree_init_const(tree, &meter_commands_tree[0]);
+	scpi_tree_set_command_matcher(tree, meter_commands_match);
+}
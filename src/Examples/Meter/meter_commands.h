@@ -0,0 +1,104 @@
+/*
+ * Generated by scpigen.py from meter.scpi.  Do not edit.
+ *
+ * The command tree is
+ *
+ *  *IDN?                    -> identify
+ *  *ESR?
+ *  *OPC
+ *  *OPC?
+ *  *WAI
+ *  :SOURce
+ *    :VOLTage#              -> set_voltage
+ *  :MEASure
+ *    :VOLTage#?             -> get_voltage
+ *    :ARRay
+ *      :VOLTage#?           -> get_samples
+ *  :INITiate
+ *    :AVERage#              -> start_average
+ *  :FETCh
+ *    :AVERage?              -> get_average
+ *  :DIAGnostic
+ *    :RECeive?              -> get_receive_statistics
+ *  :FORMat
+ *    :DATA
+ *    :DATA?
+ *    :BORDer
+ *    :BORDer?
+ *  :SYSTem
+ *    :ERRor
+ *      :NEXT?
+ *    :ERRor?
+ */
+
+#ifndef __METER_COMMANDS_H
+#define __METER_COMMANDS_H
+
+#include <stddef.h>
+
+#include "scpiparser.h"
+
+#ifdef __cplusplus
+
+  extern "C" {
+  
+#endif
+
+/* *IDN? */
+scpi_error_t identify(struct scpi_parser_context* ctx, struct scpi_token* command);
+
+/* SOURce:VOLTage# <numeric> */
+scpi_error_t set_voltage(struct scpi_parser_context* ctx, struct scpi_token* command);
+
+/* MEASure:VOLTage#? */
+scpi_error_t get_voltage(struct scpi_parser_context* ctx, struct scpi_token* command);
+
+/* MEASure:ARRay:VOLTage#? <numeric> */
+scpi_error_t get_samples(struct scpi_parser_context* ctx, struct scpi_token* command);
+
+/* INITiate:AVERage# <numeric> */
+scpi_error_t start_average(struct scpi_parser_context* ctx, struct scpi_token* command);
+
+/* FETCh:AVERage? */
+scpi_error_t get_average(struct scpi_parser_context* ctx, struct scpi_token* command);
+
+/* DIAGnostic:RECeive? */
+scpi_error_t get_receive_statistics(struct scpi_parser_context* ctx, struct scpi_token* command);
+
+/*
+ * The command tree, whose root is the first element.
+ */
+extern const struct scpi_command meter_commands_tree[14];
+
+/*
+ * The long names of the commands, one per line and indented by their
+ * depth in the tree.  On AVR this is in program memory.
+ */
+extern const char meter_commands_listing[];
+
+/*
+ * Find a child of a command in the tree, for scpi_set_command_matcher.
+ */
+int
+meter_commands_match(const struct scpi_command* parent, const char* name, size_t length,
+		const struct scpi_command** command, unsigned long* suffix);
+
+/*
+ * Initialise a parser with the tree and its matcher.
+ */
+void
+meter_commands_init(struct scpi_parser_context* ctx);
+
+/*
+ * Initialise a shared tree with the tree and its matcher.
+ */
+void
+meter_commands_tree_init(struct scpi_tree* tree);
+
+#ifdef __cplusplus
+
+  }
+  
+#endif
+
+#endif
@@ -7,7 +7,7 @@ from pylab import *
 class ArduinoDAQ(object):
 	def __init__(self, resource):
 		
-		self.instrument = visa.instrument(resource, term_chars = '\n', timeout=0.1)
+		self.instrument = visa.instrument(resource, term_chars = '\n', timeout=0.1, baud_rate = 115200)
 		time.sleep(2)
 
 		try:
@@ -23,19 +23,16 @@ class ArduinoDAQ(object):
 	def close(self):
 		self.instrument.close()
 		
+	# The instrument numbers its channels from 1.
 	def read(self, channel):
-		if channel == 0:
-			return float(self.instrument.ask(':MEASURE:VOLTAGE?'))
-		elif channel == 1:
-			return float(self.instrument.ask(':MEASURE:VOLTAGE1?'))
+		if channel == 0 or channel == 1:
+			return float(self.instrument.ask(':MEASURE:VOLTAGE%d?' % (channel+1)))
 		else:
 			raise Exception("Invalid input channel ID.")
 			
 	def write(self, channel, value):
-		if channel == 0:
-			self.instrument.write(':SOURCE:VOLTAGE ' + value)
-		elif channel == 1:
-			self.instrument.write(':SOURCE:VOLTAGE1 ' + value)
+		if channel == 0 or channel == 1:
+			self.instrument.write(':SOURCE:VOLTAGE%d %s' % (channel+1, value))
 		else:
 			raise Exception("Invalid output channel ID.")
 			
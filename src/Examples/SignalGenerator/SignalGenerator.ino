@@ -4,7 +4,7 @@
 
 struct scpi_parser_context ctx;
 
-float frequency;
+long frequency;
 
 scpi_error_t identify(struct scpi_parser_context* context, struct scpi_token* command);
 scpi_error_t get_frequency(struct scpi_parser_context* context, struct scpi_token* command);
@@ -23,6 +23,15 @@ AD9835 dds(
         50000000 // hzMasterClockFrequency (50MHz)
     );
 
+/*
+ * Responses are collected by the parser and written to the serial port
+ * in a single burst at the end of each message.
+ */
+void write_response(void* opaque, const char* data, size_t length)
+{
+  Serial.write((const uint8_t*)data, length);
+}
+
 void setup()
 {
   struct scpi_command* source;
@@ -30,6 +39,7 @@ void setup()
 
   /* First, initialise the parser. */
   scpi_init(&ctx);
+  scpi_set_output(&ctx, write_response, NULL);
 
   /*
    * After initialising the parser, we set up the command tree.  Ours is
@@ -45,7 +55,7 @@ void setup()
   scpi_register_command(source, SCPI_CL_CHILD, "FREQUENCY", 9, "FREQ", 4, set_frequency);
   scpi_register_command(source, SCPI_CL_CHILD, "FREQUENCY?", 10, "FREQ?", 5, get_frequency);
   
-  frequency = 1e3;
+  frequency = 1000;
 
   Serial.begin(9600);
   dds.begin();
@@ -53,9 +63,6 @@ void setup()
 
 void loop()
 {
-  char line_buffer[256];
-  unsigned char read_length;
-  
   dds.setFrequencyHz(0, 1000);
   
   dds.selectFrequencyRegister(0);
@@ -64,11 +71,10 @@ void loop()
 
   while(1)
   {
-    /* Read in a line and execute it. */
-    read_length = Serial.readBytesUntil('\n', line_buffer, 256);
-    if(read_length > 0)
+    /* Pass each byte to the parser as it arrives. */
+    while(Serial.available() > 0)
     {
-      scpi_execute_command(&ctx, line_buffer, read_length);
+      scpi_feed(&ctx, Serial.read());
     }
   }
 }
@@ -79,9 +85,7 @@ void loop()
  */
 scpi_error_t identify(struct scpi_parser_context* context, struct scpi_token* command)
 {
-  scpi_free_tokens(command);
-
-  Serial.println("OIC,Signal Generator,1,10");
+  scpi_write_string(context, "OIC,Signal Generator,1,10");
   return SCPI_SUCCESS;
 }
 
@@ -90,11 +94,8 @@ scpi_error_t identify(struct scpi_parser_context* context, struct scpi_token* co
  */
 scpi_error_t get_frequency(struct scpi_parser_context* context, struct scpi_token* command)
 {
-  float voltage;
+  scpi_write_fixed(context, frequency, 0);
 
-  Serial.println(frequency,4);
-
-  scpi_free_tokens(command);
   return SCPI_SUCCESS;
 }
 
@@ -103,37 +104,35 @@ scpi_error_t get_frequency(struct scpi_parser_context* context, struct scpi_toke
  */
 scpi_error_t set_frequency(struct scpi_parser_context* context, struct scpi_token* command)
 {
-  struct scpi_token* args;
-  struct scpi_numeric output_numeric;
+  struct scpi_parameter_iterator params;
+  struct scpi_token arg;
+  struct scpi_numeric_fixed output_numeric;
   unsigned char output_value;
 
-  args = command;
-
-  while(args != NULL && args->type == 0)
+  scpi_parameter_iterator_init(&params, command->value, command->length);
+  if(!scpi_next_parameter(&params, &arg))
   {
-    args = args->next;
+    scpi_queue_error(context, SCPI_ERROR_MISSING_PARAMETER);
+    return SCPI_SUCCESS;
   }
 
-  output_numeric = scpi_parse_numeric(args->value, args->length, 1e3, 0, 25e6);
-  if(output_numeric.length == 0 ||
-    (output_numeric.length == 2 && output_numeric.unit[0] == 'H' && output_numeric.unit[1] == 'z'))
+  output_numeric = scpi_parse_numeric_fixed(arg.value, arg.length, 0, 1000, 0, 25000000L);
+  if(output_numeric.status != SCPI_NUMERIC_SUCCESS)
   {
-    dds.setFrequencyHz(0, (unsigned long)constrain(output_numeric.value, 0, 25e6));
-    frequency = (unsigned long)constrain(output_numeric.value, 0, 25e6);
+    scpi_queue_error(context, SCPI_ERROR_NUMERIC_DATA);
+    return SCPI_SUCCESS;
+  }
+  else if(output_numeric.unit_id == SCPI_UNIT_NONE ||
+    output_numeric.unit_id == SCPI_UNIT_HERTZ)
+  {
+    dds.setFrequencyHz(0, (unsigned long)constrain(output_numeric.value, 0, 25000000L));
+    frequency = constrain(output_numeric.value, 0, 25000000L);
   }
   else
   {
-    scpi_error error;
-    error.id = -200;
-    error.description = "Command error;Invalid unit";
-    error.length = 26;
-    
-    scpi_queue_error(&ctx, error);
-    scpi_free_tokens(command);
+    scpi_queue_error(context, SCPI_ERROR_INVALID_SUFFIX);
     return SCPI_SUCCESS;
   }
 
-  scpi_free_tokens(command);
-
   return SCPI_SUCCESS;
 }
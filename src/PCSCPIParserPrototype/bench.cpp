@@ -0,0 +1,1958 @@
+/*
+ * Benchmarks for the SCPI parser.
+ *
+ * Build with "make bench", which also builds a copy of the parser without
+ * SIMD so that the two can be compared.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+#include <x86intrin.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "scpiparser.h"
+#include "bench_commands.h"
+
+/* Prevents the compiler from discarding the work being timed. */
+static volatile size_t sink;
+
+/*
+ * Tokenize a command and split all of its parameters, as a callback would.
+ */
+static void
+tokenize_and_split(const char* str, size_t length)
+{
+	struct scpi_token_span spans[SCPI_MAX_TOKENS];
+	struct scpi_parameter_iterator params;
+	struct scpi_token param;
+	size_t count;
+
+	scpi_tokenize(str, length, spans, SCPI_MAX_TOKENS, &count);
+	sink += count;
+
+	if(count > 0 && spans[count-1].type == SCPI_TT_PARAMETERS)
+	{
+		scpi_parameter_iterator_init(&params, str+spans[count-1].offset,
+										spans[count-1].length);
+		while(scpi_next_parameter(&params, &param))
+		{
+			sink += param.length;
+		}
+	}
+}
+
+/*
+ * Report the throughput of tokenize_and_split on a single command.
+ */
+static void
+bench_tokenize(const char* name, const char* str, size_t iterations)
+{
+	size_t i;
+	size_t run;
+	size_t length;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t cycles;
+
+	length = strlen(str);
+
+	/* Take the best of several runs, to reduce the effect of other load. */
+	cycles = 0;
+	for(run = 0; run < 5; run++)
+	{
+		start = __rdtsc();
+		for(i = 0; i < iterations; i++)
+		{
+			tokenize_and_split(str, length);
+		}
+
+		elapsed = __rdtsc() - start;
+
+		if(run == 0 || elapsed < cycles)
+		{
+			cycles = elapsed;
+		}
+	}
+
+	printf("%-24s %8lu bytes  %8.3f bytes/cycle\n", name, (unsigned long)length,
+			(double)length * iterations / cycles);
+}
+
+scpi_error_t
+bench_callback(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	sink += command->length;
+	return SCPI_SUCCESS;
+}
+
+/*
+ * Find a child by comparing its names with memcmp, as commands were
+ * matched before headers were folded to upper case.  This is a baseline
+ * for the folding comparison; common commands are left to the parser.
+ */
+static int
+memcmp_matcher(const struct scpi_command* parent, const char* name, size_t length,
+				const struct scpi_command** command, unsigned long* suffix)
+{
+	const struct scpi_command* child;
+
+	if(parent == NULL)
+	{
+		return 0;
+	}
+
+	for(child = parent->children; child != NULL; child = child->next)
+	{
+		if((child->long_name_length == length && !memcmp(child->long_name, name, length))
+			|| (child->short_name_length == length && !memcmp(child->short_name, name, length)))
+		{
+			break;
+		}
+	}
+
+	*command = child;
+	*suffix = 1;
+	return 1;
+}
+
+/*
+ * Report the cost of finding a command from its header alone.  Unlike
+ * bench_execute, this does not go through the header cache, and so
+ * measures the comparison of mnemonics.
+ */
+static void
+bench_find(struct scpi_parser_context* ctx, const char* name, const char* header,
+			size_t iterations)
+{
+	struct scpi_token tokens[8];
+	size_t count;
+	size_t i;
+	size_t run;
+	const char* end;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t cycles;
+
+	/* Split the header into a list of header tokens, one per mnemonic. */
+	for(count = 0; *header != '\0' && count < 8; count++)
+	{
+		if(*header == ':')
+		{
+			header++;
+		}
+
+		for(end = header; *end != '\0' && *end != ':'; end++);
+
+		tokens[count].type = SCPI_TT_HEADER;
+		tokens[count].value = header;
+		tokens[count].length = end - header;
+		tokens[count].next = NULL;
+		if(count > 0)
+		{
+			tokens[count-1].next = &tokens[count];
+		}
+
+		header = end;
+	}
+
+	cycles = 0;
+	for(run = 0; run < 5; run++)
+	{
+		start = __rdtsc();
+		for(i = 0; i < iterations; i++)
+		{
+			sink += (size_t)scpi_find_command(ctx, tokens);
+		}
+
+		elapsed = __rdtsc() - start;
+
+		if(run == 0 || elapsed < cycles)
+		{
+			cycles = elapsed;
+		}
+	}
+
+	printf("%-24s %8.1f cycles\n", name, (double)cycles / iterations);
+}
+
+/*
+ * Report the cost of executing a single command.
+ */
+static void
+bench_execute(struct scpi_parser_context* ctx, const char* name, const char* str,
+				size_t iterations)
+{
+	size_t i;
+	size_t run;
+	size_t length;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t cycles;
+
+	length = strlen(str);
+
+	cycles = 0;
+	for(run = 0; run < 5; run++)
+	{
+		start = __rdtsc();
+		for(i = 0; i < iterations; i++)
+		{
+			scpi_execute_command(ctx, str, length);
+		}
+
+		elapsed = __rdtsc() - start;
+
+		if(run == 0 || elapsed < cycles)
+		{
+			cycles = elapsed;
+		}
+	}
+
+	printf("%-24s %8.1f cycles\n", name, (double)cycles / iterations);
+}
+
+/*
+ * Report the cost of matching headers in various cases.
+ */
+static void
+bench_headers(size_t iterations)
+{
+	struct scpi_parser_context ctx;
+	struct scpi_command* command;
+
+	scpi_init(&ctx);
+	command = scpi_register_command(ctx.command_tree, SCPI_CL_CHILD, "SENSE", 5, "SENS", 4, NULL);
+	command = scpi_register_command(command, SCPI_CL_CHILD, "VOLTAGE", 7, "VOLT", 4, NULL);
+	command = scpi_register_command(command, SCPI_CL_CHILD, "DC", 2, "DC", 2, NULL);
+	command = scpi_register_command(command, SCPI_CL_CHILD, "RANGE", 5, "RANG", 4, NULL);
+	scpi_register_command(command, SCPI_CL_CHILD, "UPPER", 5, "UPP", 3, bench_callback);
+
+	bench_execute(&ctx, "upper case", ":SENSE:VOLTAGE:DC:RANGE:UPPER 10", iterations);
+	bench_execute(&ctx, "lower case", ":sense:voltage:dc:range:upper 10", iterations);
+	bench_execute(&ctx, "mixed short form", ":Sens:Volt:dc:Rang:Upp 10", iterations);
+
+	/* A pair of queries, as sent repeatedly by a host polling the instrument. */
+	command = scpi_register_command(ctx.command_tree, SCPI_CL_CHILD, "MEASURE", 7, "MEAS", 4, NULL);
+	scpi_register_command(command, SCPI_CL_CHILD, "VOLTAGE?", 8, "VOLT?", 5, bench_callback);
+	scpi_register_command(command, SCPI_CL_CHILD, "VOLTAGE1?", 9, "VOLT1?", 6, bench_callback);
+
+	bench_execute(&ctx, "repeated queries", ":MEAS:VOLT?;:MEAS:VOLT1?", iterations);
+
+	printf("%-24s %8lu hits  %8lu misses\n", "header cache",
+			ctx.header_cache_hits, ctx.header_cache_misses);
+
+	/* The comparison alone, against the memcmp that it replaced. */
+	bench_find(&ctx, "find upper case", ":SENSE:VOLTAGE:DC:RANGE:UPPER", iterations);
+	bench_find(&ctx, "find mixed short form", ":Sens:Volt:dc:Rang:Upp", iterations);
+	scpi_set_command_matcher(&ctx, memcmp_matcher);
+	bench_find(&ctx, "find with memcmp", ":SENSE:VOLTAGE:DC:RANGE:UPPER", iterations);
+	scpi_set_command_matcher(&ctx, NULL);
+}
+
+/*
+ * Report the cost of looking up commands beneath a node with the given
+ * number of children, with and without scpi_finalize_tree.
+ */
+static void
+bench_width(size_t width, size_t iterations)
+{
+	struct scpi_parser_context ctx;
+	struct scpi_command* sense;
+	char* names;
+	char* commands;
+	size_t i;
+	size_t run;
+	size_t finalized;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t cycles[2];
+
+	/* Each child has a long name CHANnnnn and a short name CHnnnn. */
+	names = (char*)malloc(width*16);
+	commands = (char*)malloc(width*16);
+
+	scpi_init(&ctx);
+	sense = scpi_register_command(ctx.command_tree, SCPI_CL_CHILD, "SENSE", 5, "SENS", 4, NULL);
+	for(i = 0; i < width; i++)
+	{
+		sprintf(names+i*16, "CHAN%04u", (unsigned)i);
+		sprintf(names+i*16+9, "CH%04u", (unsigned)i);
+		scpi_register_command(sense, SCPI_CL_CHILD, names+i*16, 8, names+i*16+9, 6,
+								bench_callback);
+	}
+
+	/* Look the children up in a scattered order, by both names. */
+	for(i = 0; i < width; i++)
+	{
+		sprintf(commands+i*16, ":SENS:%s", names + (i*7919 % width)*16 + (i%2)*9);
+	}
+
+	for(finalized = 0; finalized < 2; finalized++)
+	{
+		if(finalized)
+		{
+			scpi_finalize_tree(&ctx);
+		}
+
+		for(run = 0; run < 5; run++)
+		{
+			start = __rdtsc();
+			for(i = 0; i < iterations; i++)
+			{
+				const char* command = commands + (i % width)*16;
+				scpi_execute_command(&ctx, command, strlen(command));
+			}
+
+			elapsed = __rdtsc() - start;
+
+			if(run == 0 || elapsed < cycles[finalized])
+			{
+				cycles[finalized] = elapsed;
+			}
+		}
+	}
+
+	printf("width %-18lu %8.1f cycles  %8.1f cycles finalized\n", (unsigned long)width,
+			(double)cycles[0] / iterations, (double)cycles[1] / iterations);
+
+	free(commands);
+	free(names);
+}
+
+/* The headers of the commands in bench_commands_tree. */
+#define MAX_HEADERS 128
+#define MAX_HEADER_LENGTH 64
+
+static char headers[MAX_HEADERS][MAX_HEADER_LENGTH];
+static size_t header_count;
+
+/*
+ * Write the full header of each command beneath a list, alternating
+ * between the long and short forms, with a suffix of 2 where one is taken.
+ */
+static void
+list_headers(const struct scpi_command* command, const char* prefix)
+{
+	char header[MAX_HEADER_LENGTH];
+	const char* name;
+	size_t length;
+	size_t i;
+
+	for(; command != NULL; command = command->next)
+	{
+		if(command == &scpi_system_command)
+		{
+			continue;
+		}
+
+		name = header_count % 2 ? command->short_name : command->long_name;
+		length = header_count % 2 ? command->short_name_length : command->long_name_length;
+
+		strcpy(header, prefix);
+		for(i = 0; i < length; i++)
+		{
+			if(name[i] == '#')
+			{
+				strcat(header, "2");
+			}
+			else
+			{
+				strncat(header, name+i, 1);
+			}
+		}
+
+		if(command->callback != NULL && header_count < MAX_HEADERS)
+		{
+			strcpy(headers[header_count++], header);
+		}
+
+		strcat(header, ":");
+		list_headers(command->children, header);
+	}
+}
+
+/*
+ * Register a copy of a constant tree beneath a command.
+ */
+static void
+copy_tree(struct scpi_command* parent, scpi_command_location_t location,
+			const struct scpi_command* command)
+{
+	struct scpi_command* copy;
+
+	for(; command != NULL; command = command->next)
+	{
+		/* These are registered by scpi_init. */
+		if(command == &scpi_format_command || command == &scpi_system_command)
+		{
+			continue;
+		}
+
+		copy = scpi_register_command(parent, location,
+										command->long_name, command->long_name_length,
+										command->short_name, command->short_name_length,
+										command->callback);
+		copy_tree(copy, SCPI_CL_CHILD, command->children);
+	}
+}
+
+/*
+ * Report the cost of executing every command of a tree in turn.
+ */
+static void
+bench_lookup(struct scpi_parser_context* ctx, const char* name, size_t iterations)
+{
+	size_t i;
+	size_t run;
+	size_t lengths[MAX_HEADERS];
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t cycles;
+
+	for(i = 0; i < header_count; i++)
+	{
+		lengths[i] = strlen(headers[i]);
+	}
+
+	cycles = 0;
+	for(run = 0; run < 5; run++)
+	{
+		start = __rdtsc();
+		for(i = 0; i < iterations; i++)
+		{
+			scpi_execute_command(ctx, headers[i % header_count], lengths[i % header_count]);
+		}
+
+		elapsed = __rdtsc() - start;
+
+		if(run == 0 || elapsed < cycles)
+		{
+			cycles = elapsed;
+		}
+	}
+
+	printf("%-24s %8.1f cycles\n", name, (double)cycles / iterations);
+}
+
+/*
+ * Compare the ways of finding commands in the tree of bench.scpi: as
+ * registered at startup, with and without scpi_finalize_tree, and as
+ * compiled by scpigen.py, with and without its matcher.
+ */
+static void
+bench_generated(size_t iterations)
+{
+	struct scpi_parser_context ctx;
+
+	header_count = 0;
+	list_headers(bench_commands_tree[0].next, "");
+	list_headers(bench_commands_tree[0].children, ":");
+
+	scpi_init(&ctx);
+	copy_tree(ctx.command_tree, SCPI_CL_SAMELEVEL, bench_commands_tree[0].next);
+	copy_tree(ctx.command_tree, SCPI_CL_CHILD, bench_commands_tree[0].children);
+	bench_lookup(&ctx, "registered", iterations);
+
+	scpi_finalize_tree(&ctx);
+	bench_lookup(&ctx, "registered, finalized", iterations);
+	scpi_destroy(&ctx);
+
+	scpi_init_const(&ctx, &bench_commands_tree[0]);
+	bench_lookup(&ctx, "constant", iterations);
+
+	bench_commands_init(&ctx);
+	bench_lookup(&ctx, "generated", iterations);
+
+	printf("%-24s %8lu headers  %8lu cache hits\n", "", (unsigned long)header_count,
+			ctx.header_cache_hits);
+}
+
+/* Counts of the calls made to the allocator. */
+static size_t allocations;
+static size_t releases;
+
+static void*
+counting_allocate(void* opaque, size_t size)
+{
+	allocations++;
+	return malloc(size);
+}
+
+static void
+counting_release(void* opaque, void* pointer)
+{
+	releases++;
+	free(pointer);
+}
+
+/*
+ * Report the allocator calls made over the life of a context, as when a
+ * context is created for each connection to an instrument.
+ */
+static void
+bench_connections(size_t connections)
+{
+	struct scpi_parser_context ctx;
+	struct scpi_command* source;
+	struct scpi_command* measure;
+	char names[20][16];
+	const char* commands;
+	size_t i;
+	size_t j;
+	uint64_t start;
+	uint64_t cycles;
+
+	scpi_set_allocator(counting_allocate, counting_release, NULL);
+	allocations = 0;
+	releases = 0;
+
+	start = __rdtsc();
+	for(i = 0; i < connections; i++)
+	{
+		scpi_init(&ctx);
+		source = scpi_register_command(ctx.command_tree, SCPI_CL_CHILD, "source", 6, "sour", 4, NULL);
+		measure = scpi_register_command(ctx.command_tree, SCPI_CL_CHILD, "measure", 7, "meas", 4, NULL);
+		for(j = 0; j < 10; j++)
+		{
+			sprintf(names[2*j], "CHANNEL%u?", (unsigned)j);
+			sprintf(names[2*j+1], "CHANNEL%u", (unsigned)j);
+			scpi_register_command(measure, SCPI_CL_CHILD, names[2*j], 9, names[2*j], 9,
+									bench_callback);
+			scpi_register_command(source, SCPI_CL_CHILD, names[2*j+1], 8, names[2*j+1], 8,
+									bench_callback);
+		}
+		scpi_finalize_tree(&ctx);
+
+		for(j = 0; j < 16; j++)
+		{
+			commands = ":MEAS:CHANNEL3?;:SOUR:CHANNEL3 1";
+			scpi_execute_command(&ctx, commands, strlen(commands));
+			scpi_execute_command(&ctx, ":BOGUS", 6);
+			scpi_pop_error(&ctx);
+		}
+
+		scpi_destroy(&ctx);
+	}
+	cycles = __rdtsc() - start;
+
+	scpi_set_allocator(NULL, NULL, NULL);
+
+	printf("%-24s %8.1f allocations  %8lu outstanding  %8.0f cycles\n", "per connection",
+			(double)allocations / connections, (unsigned long)(allocations - releases),
+			(double)cycles / connections);
+}
+
+/*
+ * Check that the error queue keeps its oldest errors and reports an
+ * overflow in place of the newest when it is full, then report the time
+ * to queue an error, pop it and format it for SYSTem:ERRor?.
+ */
+static void
+bench_errors(size_t iterations)
+{
+	struct scpi_parser_context ctx;
+	struct scpi_error error;
+	char response[SCPI_ERROR_LENGTH];
+	size_t i;
+	size_t length;
+	size_t mismatches;
+	uint64_t start;
+	uint64_t cycles;
+
+	scpi_init(&ctx);
+
+	for(i = 0; i < SCPI_ERROR_QUEUE_LENGTH + 3; i++)
+	{
+		scpi_queue_error(&ctx, i % 2 ? SCPI_ERROR_NUMERIC_DATA : SCPI_ERROR_UNDEFINED_HEADER);
+	}
+
+	mismatches = 0;
+	for(i = 0; i <= SCPI_ERROR_QUEUE_LENGTH; i++)
+	{
+		error = scpi_pop_error(&ctx);
+		if(i == SCPI_ERROR_QUEUE_LENGTH)
+		{
+			mismatches += error.id != 0;
+		}
+		else if(i == SCPI_ERROR_QUEUE_LENGTH - 1)
+		{
+			mismatches += error.id != -350;
+		}
+		else
+		{
+			mismatches += error.id != (i % 2 ? -120 : -113);
+		}
+	}
+
+	length = scpi_format_error(response, sizeof(response), scpi_pop_error(&ctx));
+	mismatches += length != 12 || memcmp(response, "0,\"No error\"", 12) != 0;
+
+	printf("%-24s %8lu errors    %8lu mismatched\n", "error queue",
+			(unsigned long)SCPI_ERROR_QUEUE_LENGTH + 3, (unsigned long)mismatches);
+
+	start = __rdtsc();
+	for(i = 0; i < iterations; i++)
+	{
+		scpi_queue_error(&ctx, SCPI_ERROR_MISSING_PARAMETER);
+		sink += scpi_format_error(response, sizeof(response), scpi_pop_error(&ctx));
+	}
+	cycles = __rdtsc() - start;
+
+	printf("%-24s %8.1f cycles/error\n", "queue, pop and format", (double)cycles / iterations);
+
+	scpi_destroy(&ctx);
+}
+
+#if SCPI_ERROR_QUEUE_ATOMIC
+
+/* The state shared by the threads of bench_error_threads. */
+struct error_threads
+{
+	struct scpi_parser_context ctx;
+	pthread_mutex_t mutex;
+	int             locked;
+	size_t          errors;
+	volatile int    stop;
+	size_t          popped;
+	size_t          unexpected;
+};
+
+/* Queue errors, under the mutex if that is being timed. */
+static void*
+error_producer(void* opaque)
+{
+	struct error_threads* threads;
+	size_t i;
+
+	threads = (struct error_threads*)opaque;
+	for(i = 0; i < threads->errors; i++)
+	{
+		if(threads->locked)
+		{
+			pthread_mutex_lock(&threads->mutex);
+			scpi_queue_error(&threads->ctx, SCPI_ERROR_NUMERIC_DATA);
+			pthread_mutex_unlock(&threads->mutex);
+		}
+		else
+		{
+			scpi_queue_error(&threads->ctx, SCPI_ERROR_NUMERIC_DATA);
+		}
+	}
+
+	return NULL;
+}
+
+/* Pop errors until the producers have finished and the queue is empty. */
+static void*
+error_consumer(void* opaque)
+{
+	struct error_threads* threads;
+	struct scpi_error error;
+	int stopping;
+
+	threads = (struct error_threads*)opaque;
+	do
+	{
+		stopping = threads->stop;
+		if(threads->locked)
+		{
+			pthread_mutex_lock(&threads->mutex);
+			error = scpi_pop_error(&threads->ctx);
+			pthread_mutex_unlock(&threads->mutex);
+		}
+		else
+		{
+			error = scpi_pop_error(&threads->ctx);
+		}
+
+		if(error.id != 0)
+		{
+			threads->popped++;
+			threads->unexpected += error.id != -120 && error.id != -350;
+		}
+	}
+	while(!stopping || error.id != 0);
+
+	return NULL;
+}
+
+#define ERROR_THREADS_MAX 32
+
+/*
+ * Report the time per error for producer threads that all queue errors
+ * into one context while a consumer pops them, without a lock and with
+ * each call made under a mutex.
+ */
+static void
+bench_error_threads(size_t errors)
+{
+	static struct error_threads threads;
+	pthread_t producers[ERROR_THREADS_MAX];
+	pthread_t consumer;
+	size_t count;
+	size_t i;
+	int locked;
+	uint64_t start;
+	uint64_t cycles[2];
+
+	pthread_mutex_init(&threads.mutex, NULL);
+	for(count = 1; count <= ERROR_THREADS_MAX; count *= 2)
+	{
+		for(locked = 0; locked <= 1; locked++)
+		{
+			scpi_init(&threads.ctx);
+			threads.locked = locked;
+			threads.errors = errors / count;
+			threads.stop = 0;
+			threads.popped = 0;
+			threads.unexpected = 0;
+
+			start = __rdtsc();
+			pthread_create(&consumer, NULL, error_consumer, &threads);
+			for(i = 0; i < count; i++)
+			{
+				pthread_create(&producers[i], NULL, error_producer, &threads);
+			}
+			for(i = 0; i < count; i++)
+			{
+				pthread_join(producers[i], NULL);
+			}
+			threads.stop = 1;
+			pthread_join(consumer, NULL);
+			cycles[locked] = __rdtsc() - start;
+
+			if(threads.unexpected != 0 || threads.popped == 0)
+			{
+				printf("  %lu threads: %lu unexpected errors of %lu\n", (unsigned long)count,
+						(unsigned long)threads.unexpected, (unsigned long)threads.popped);
+			}
+
+			scpi_destroy(&threads.ctx);
+		}
+
+		printf("%2lu producer threads     %8.1f cycles/error  %8.1f with a mutex\n",
+				(unsigned long)count, (double)cycles[0] / (threads.errors * count),
+				(double)cycles[1] / (threads.errors * count));
+	}
+	pthread_mutex_destroy(&threads.mutex);
+}
+
+#endif
+
+/* The file to which bench_responses writes, and the number of writes made. */
+static int response_fd;
+static size_t response_writes;
+
+static void
+write_response(void* opaque, const char* data, size_t length)
+{
+	response_writes++;
+	sink += write(response_fd, data, length);
+}
+
+/*
+ * A query that writes its own response, as callbacks did before responses
+ * were buffered by the parser.
+ */
+static scpi_error_t
+direct_query(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	char response[SCPI_FORMAT_LENGTH];
+
+	write_response(NULL, response, scpi_format_float(response, sizeof(response), 1.25f));
+	write_response(NULL, "\n", 1);
+
+	return SCPI_SUCCESS;
+}
+
+static scpi_error_t
+buffered_query(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	scpi_write_float(ctx, 1.25f);
+	return SCPI_SUCCESS;
+}
+
+/*
+ * Compare the cost of a message of several queries when each response is
+ * written as it is made, and when they are collected into one write.
+ */
+static void
+bench_responses(size_t iterations)
+{
+	static const char message[] = "MEAS?;MEAS?;MEAS?;MEAS?";
+	static const command_callback_t callbacks[] = { direct_query, buffered_query };
+	static const char* names[] = { "direct responses", "buffered responses" };
+	struct scpi_parser_context ctx;
+	size_t method;
+	size_t i;
+	uint64_t start;
+	uint64_t cycles;
+
+	response_fd = open("/dev/null", O_WRONLY);
+
+	for(method = 0; method < 2; method++)
+	{
+		scpi_init(&ctx);
+		scpi_set_output(&ctx, write_response, NULL);
+		scpi_register_command(ctx.command_tree, SCPI_CL_CHILD, "MEASURE?", 8, "MEAS?", 5,
+								callbacks[method]);
+
+		response_writes = 0;
+		start = __rdtsc();
+		for(i = 0; i < iterations; i++)
+		{
+			scpi_execute_command(&ctx, message, sizeof(message)-1);
+		}
+		cycles = __rdtsc() - start;
+
+		printf("%-24s %8.1f cycles/message  %8.1f writes/message\n", names[method],
+				(double)cycles / iterations, (double)response_writes / iterations);
+
+		scpi_destroy(&ctx);
+	}
+
+	close(response_fd);
+}
+
+/* A small, fast generator, so that runs are repeatable. */
+static uint64_t random_state = 88172645463325252UL;
+
+static unsigned long
+random_below(unsigned long n)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return (unsigned long)(random_state % n);
+}
+
+/*
+ * Write a random SCPI numeric, with up to 25 digits, an exponent, a
+ * multiplier and a unit, and the same number without the multiplier as
+ * strtof expects it.  A multiplier is always followed by a unit that
+ * cannot be mistaken for a megahertz or megohm, or for a unit alone.
+ */
+static void
+random_numeric(char* str, char* reference)
+{
+	static const char* prefixes[] = { "a", "f", "p", "n", "u", "m", "k", "MA", "G", "T", "PE", "EX" };
+	static const int exponents[] = { -18, -15, -12, -9, -6, -3, 3, 6, 9, 12, 15, 18 };
+	static const char* units[] = { "", "V", "A", "Hz", "OHM" };
+	static const char* prefixed_units[] = { "V", "A", "W", "s" };
+	size_t digits;
+	size_t point;
+	size_t i;
+	int length;
+	int mantissa_length;
+	int exponent;
+	int prefix;
+
+	length = 0;
+	if(random_below(4) == 0)
+	{
+		str[length++] = random_below(2) ? '-' : '+';
+	}
+
+	digits = 1 + random_below(25);
+	point = random_below(digits + 2);
+	for(i = 0; i < digits; i++)
+	{
+		if(i == point)
+		{
+			str[length++] = '.';
+		}
+		str[length++] = (char)('0' + random_below(10));
+	}
+
+	/* The reference has no prefix, so it is folded into the exponent. */
+	memcpy(reference, str, length);
+	mantissa_length = length;
+	exponent = 0;
+	if(random_below(2))
+	{
+		exponent = (int)random_below(91) - 50;
+		length += sprintf(str+length, "%c%d", random_below(2) ? 'e' : 'E', exponent);
+	}
+
+	prefix = random_below(3) ? -1 : (int)random_below(12);
+	sprintf(reference+mantissa_length, "e%d", exponent + (prefix < 0 ? 0 : exponents[prefix]));
+
+	if(random_below(2))
+	{
+		str[length++] = ' ';
+	}
+	if(prefix >= 0)
+	{
+		length += sprintf(str+length, "%s%s", prefixes[prefix], prefixed_units[random_below(4)]);
+	}
+	else
+	{
+		strcpy(str+length, units[random_below(5)]);
+	}
+}
+
+/*
+ * Write a number within a unit in the last place of halfway between two
+ * floats, or exactly halfway, for which rounding is hardest.
+ */
+static void
+random_midpoint(char* str, char* reference)
+{
+	uint32_t bits;
+	float low;
+	float high;
+	double midpoint;
+	size_t length;
+
+	/*
+	 * Any positive float but the largest, and the one after it, with the
+	 * smallest subnormals, whose midpoint is nearly zero, more often.
+	 */
+	bits = (uint32_t)(random_below(16) == 0 ? random_below(4) : random_below(0x7F7FFFFFUL));
+	memcpy(&low, &bits, sizeof(float));
+	bits++;
+	memcpy(&high, &bits, sizeof(float));
+
+	/* Every midpoint between floats has fewer than 116 digits. */
+	midpoint = ((double)low + (double)high) / 2;
+	sprintf(str, "%.115e", midpoint);
+
+	length = strchr(str, 'e') - str;
+	switch(random_below(3))
+	{
+		case 0:
+			while(str[length-1] == '9')
+			{
+				str[--length] = '0';
+			}
+			str[length-1]++;
+			break;
+		case 1:
+			if(str[length-1] != '0')
+			{
+				str[length-1]--;
+			}
+			break;
+	}
+
+	strcpy(reference, str);
+}
+
+/*
+ * Check scpi_parse_numeric against strtof on random numbers, counting
+ * results that differ in any bit.
+ */
+static void
+check_numeric(const char* name, void (*generate)(char*, char*), size_t count)
+{
+	char str[256];
+	char reference[256];
+	struct scpi_numeric numeric;
+	float expected;
+	size_t i;
+	size_t mismatches;
+
+	mismatches = 0;
+	for(i = 0; i < count; i++)
+	{
+		generate(str, reference);
+		numeric = scpi_parse_numeric(str, strlen(str), 0, 0, 0);
+		expected = strtof(reference, NULL);
+
+		if(numeric.status != (expected > FLT_MAX || expected < -FLT_MAX ? SCPI_NUMERIC_OVERFLOW : SCPI_NUMERIC_SUCCESS)
+		   || memcmp(&numeric.value, &expected, sizeof(float)) != 0)
+		{
+			if(mismatches < 5)
+			{
+				printf("  %s: got %.9g (status %d), expected %.9g\n", str,
+						numeric.value, (int)numeric.status, expected);
+			}
+			mismatches++;
+		}
+	}
+
+	printf("%-24s %8lu numbers  %8lu mismatched\n", name, (unsigned long)count,
+			(unsigned long)mismatches);
+}
+
+/*
+ * Check scpi_parse_numeric_fixed against scpi_parse_numeric on short
+ * numbers, wherever the float result, scaled, is an integer small
+ * enough that it must be the nearest to the exact value.
+ */
+static void
+check_fixed(size_t count)
+{
+	static const char* prefixes[] = { "", "", "m", "u", "k" };
+	char str[64];
+	struct scpi_numeric numeric;
+	struct scpi_numeric_fixed fixed;
+	double expected;
+	size_t i;
+	size_t j;
+	size_t length;
+	size_t digits;
+	size_t point;
+	size_t compared;
+	size_t mismatches;
+	int places;
+
+	compared = 0;
+	mismatches = 0;
+	for(i = 0; i < count; i++)
+	{
+		length = 0;
+		if(random_below(2))
+		{
+			str[length++] = '-';
+		}
+
+		digits = 1 + random_below(7);
+		point = random_below(digits + 1);
+		for(j = 0; j < digits; j++)
+		{
+			if(j == point)
+			{
+				str[length++] = '.';
+			}
+			str[length++] = (char)('0' + random_below(10));
+		}
+		strcpy(str+length, prefixes[random_below(5)]);
+		places = (int)random_below(7);
+
+		numeric = scpi_parse_numeric(str, strlen(str), 0, 0, 0);
+		fixed = scpi_parse_numeric_fixed(str, strlen(str), places, 0, 0, 0);
+
+		expected = numeric.value;
+		for(j = 0; j < (size_t)places; j++)
+		{
+			expected *= 10;
+		}
+
+		if(expected >= 4194304.0 || expected <= -4194304.0 || expected != (double)(long)expected)
+		{
+			continue;
+		}
+
+		compared++;
+		if(fixed.status != SCPI_NUMERIC_SUCCESS || fixed.value != (long)expected)
+		{
+			if(mismatches < 5)
+			{
+				printf("  %s, %d places: got %ld, expected %ld\n", str, places,
+						(long)fixed.value, (long)expected);
+			}
+			mismatches++;
+		}
+	}
+
+	printf("%-24s %8lu numbers  %8lu mismatched\n", "fixed against float",
+			(unsigned long)compared, (unsigned long)mismatches);
+}
+
+/* A suffix and what scpi_parse_numeric should make of it. */
+struct unit_case
+{
+	const char* str;
+	float value;
+	scpi_unit_t unit_id;
+};
+
+/*
+ * Check that each unit of scpi_unit_t is recognised, in either case and
+ * after a prefix, and that suffixes which could be read as a prefix and
+ * a unit or as a unit alone are read the same way every time.
+ */
+static void
+check_units(void)
+{
+	static const struct unit_case cases[] = {
+		{ "1", 1.0f, SCPI_UNIT_NONE },
+		{ "1 k", 1e3f, SCPI_UNIT_NONE },
+		{ "2K", 2e3f, SCPI_UNIT_NONE },
+		{ "1 m", 1e-3f, SCPI_UNIT_NONE },
+		{ "1 G", 1e9f, SCPI_UNIT_NONE },
+		{ "1V", 1.0f, SCPI_UNIT_VOLT },
+		{ "1 mv", 1e-3f, SCPI_UNIT_VOLT },
+		{ "1 MV", 1e-3f, SCPI_UNIT_VOLT },
+		{ "1 MAV", 1e6f, SCPI_UNIT_VOLT },
+		{ "1 uA", 1e-6f, SCPI_UNIT_AMPERE },
+		{ "1 MA", 1e-3f, SCPI_UNIT_AMPERE },
+		{ "1 kW", 1e3f, SCPI_UNIT_WATT },
+		{ "1 MOHM", 1e6f, SCPI_UNIT_OHM },
+		{ "1 MAOHM", 1e6f, SCPI_UNIT_OHM },
+		{ "1 KV", 1e3f, SCPI_UNIT_VOLT },
+		{ "1 pF", 1e-12f, SCPI_UNIT_FARAD },
+		{ "1 mHz", 1e6f, SCPI_UNIT_HERTZ },
+		{ "1 MHz", 1e6f, SCPI_UNIT_HERTZ },
+		{ "1 MAHZ", 1e6f, SCPI_UNIT_HERTZ },
+		{ "1 KHZ", 1e3f, SCPI_UNIT_HERTZ },
+		{ "1 GHZ", 1e9f, SCPI_UNIT_HERTZ },
+		{ "1 s", 1.0f, SCPI_UNIT_SECOND },
+		{ "1 ms", 1e-3f, SCPI_UNIT_SECOND },
+		{ "1 US", 1e-6f, SCPI_UNIT_SECOND },
+		{ "1 EXJ", 1e18f, SCPI_UNIT_JOULE },
+		{ "1 PEW", 1e15f, SCPI_UNIT_WATT },
+		{ "1 J", 1.0f, SCPI_UNIT_JOULE },
+		{ "1 mK", 1e-3f, SCPI_UNIT_KELVIN },
+		{ "1 KK", 1e3f, SCPI_UNIT_KELVIN },
+		{ "1 CEL", 1.0f, SCPI_UNIT_CELSIUS },
+		{ "1 deg", 1.0f, SCPI_UNIT_DEGREE },
+		{ "1 mRAD", 1e-3f, SCPI_UNIT_RADIAN },
+		{ "1 dB", 1.0f, SCPI_UNIT_DECIBEL },
+		{ "1 DBM", 1.0f, SCPI_UNIT_DBM },
+		{ "1 dBm", 1.0f, SCPI_UNIT_DBM },
+		{ "1 PCT", 1.0f, SCPI_UNIT_PERCENT },
+		{ "1 pct", 1.0f, SCPI_UNIT_PERCENT },
+		{ "1 BQ", 1.0f, SCPI_UNIT_UNKNOWN },
+		{ "1 kBQ", 1.0f, SCPI_UNIT_UNKNOWN },
+		{ "100NT", 100.0f, SCPI_UNIT_UNKNOWN }
+	};
+	static const char list[] = "1k,2k,3k";
+	struct scpi_numeric numeric;
+	struct scpi_numeric_list parsed;
+	float values[4];
+	size_t i;
+	size_t mismatches;
+
+	mismatches = 0;
+	for(i = 0; i < sizeof(cases)/sizeof(cases[0]); i++)
+	{
+		numeric = scpi_parse_numeric(cases[i].str, strlen(cases[i].str), 0, 0, 1e30f);
+		if(numeric.status != SCPI_NUMERIC_SUCCESS || numeric.value != cases[i].value
+		   || numeric.unit_id != cases[i].unit_id)
+		{
+			printf("  %s: got %g, unit %d\n", cases[i].str, numeric.value,
+					(int)numeric.unit_id);
+			mismatches++;
+		}
+	}
+
+	/* Each element of a list takes its own multiplier. */
+	parsed = scpi_parse_numeric_list(list, sizeof(list)-1, values, 4, 0, 0, 1e30f);
+	if(parsed.status != SCPI_NUMERIC_SUCCESS || parsed.count != 3 || values[0] != 1e3f
+	   || values[1] != 2e3f || values[2] != 3e3f)
+	{
+		printf("  %s: got %lu values\n", list, (unsigned long)parsed.count);
+		mismatches++;
+	}
+	i++;
+
+	printf("%-24s %8lu numbers  %8lu mismatched\n", "units",
+			(unsigned long)i, (unsigned long)mismatches);
+}
+
+#define NUMERIC_BATCH 4096
+
+/* The ways of converting numbers timed by bench_numeric. */
+#define NUMERIC_FLOAT  0
+#define NUMERIC_FIXED  1
+#define NUMERIC_STRTOF 2
+
+/*
+ * Report the time to parse a random number, as a float and as a fixed
+ * point integer, against strtof on the same number without its prefix
+ * and unit.
+ */
+static void
+bench_numeric(size_t iterations)
+{
+	static const char* names[] = { "scpi_parse_numeric", "scpi_parse_numeric_fixed", "strtof" };
+	static char strs[NUMERIC_BATCH][64];
+	static char references[NUMERIC_BATCH][64];
+	size_t lengths[NUMERIC_BATCH];
+	size_t i;
+	size_t j;
+	size_t run;
+	int method;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t cycles[3];
+	float total;
+
+	for(i = 0; i < NUMERIC_BATCH; i++)
+	{
+		random_numeric(strs[i], references[i]);
+		lengths[i] = strlen(strs[i]);
+	}
+
+	for(method = NUMERIC_FLOAT; method <= NUMERIC_STRTOF; method++)
+	{
+		for(run = 0; run < 5; run++)
+		{
+			total = 0;
+			start = __rdtsc();
+			for(i = 0; i < iterations; i++)
+			{
+				for(j = 0; j < NUMERIC_BATCH; j++)
+				{
+					switch(method)
+					{
+						case NUMERIC_FLOAT:
+							total += scpi_parse_numeric(strs[j], lengths[j], 0, 0, 0).value;
+							break;
+						case NUMERIC_FIXED:
+							total += scpi_parse_numeric_fixed(strs[j], lengths[j], 3, 0, 0, 0).value;
+							break;
+						case NUMERIC_STRTOF:
+							total += strtof(references[j], NULL);
+							break;
+					}
+				}
+			}
+			elapsed = __rdtsc() - start;
+			sink += (size_t)(total != 0);
+
+			if(run == 0 || elapsed < cycles[method])
+			{
+				cycles[method] = elapsed;
+			}
+		}
+
+		printf("%-24s %8.1f cycles/number\n", names[method],
+				(double)cycles[method] / (iterations * NUMERIC_BATCH));
+	}
+}
+
+/*
+ * Check that scpi_format_float writes random floats, from all of their
+ * range, so that scpi_parse_numeric reads them back unchanged, and with
+ * no more significant digits than the shortest printf precision that
+ * strtof reads back unchanged.
+ */
+static void
+check_format(size_t count)
+{
+	char str[SCPI_FORMAT_LENGTH + 1];
+	char reference[32];
+	struct scpi_numeric numeric;
+	uint32_t bits;
+	float value;
+	size_t i;
+	size_t j;
+	size_t length;
+	size_t digits;
+	size_t significant;
+	size_t mismatches;
+	size_t longer;
+	int precision;
+
+	mismatches = 0;
+	longer = 0;
+	for(i = 0; i < count; i++)
+	{
+		bits = (uint32_t)random_below(0x7F800000UL) | (uint32_t)random_below(2) << 31;
+		memcpy(&value, &bits, sizeof(value));
+
+		length = scpi_format_float(str, SCPI_FORMAT_LENGTH, value);
+		str[length] = '\0';
+		numeric = scpi_parse_numeric(str, length, 0, 0, 0);
+		if(length == 0 || numeric.status != SCPI_NUMERIC_SUCCESS || numeric.value != value)
+		{
+			if(mismatches < 5)
+			{
+				printf("  %.9g: wrote %s\n", value, str);
+			}
+			mismatches++;
+			continue;
+		}
+
+		for(precision = 1; precision < 9; precision++)
+		{
+			sprintf(reference, "%.*e", precision - 1, value);
+			if(strtof(reference, NULL) == value)
+			{
+				break;
+			}
+		}
+
+		/* Count the digits from the first nonzero one to the last. */
+		digits = 0;
+		significant = 0;
+		for(j = 0; j < length && str[j] != 'E'; j++)
+		{
+			if(str[j] >= '0' && str[j] <= '9' && (digits != 0 || str[j] != '0'))
+			{
+				digits++;
+				if(str[j] != '0')
+				{
+					significant = digits;
+				}
+			}
+		}
+
+		if(value != 0 && significant > (size_t)precision)
+		{
+			if(longer < 5)
+			{
+				printf("  %.9g: wrote %s, but %d digits would do\n", value, str, precision);
+			}
+			longer++;
+		}
+	}
+
+	printf("%-24s %8lu numbers  %8lu mismatched  %8lu longer than needed\n", "formatted floats",
+			(unsigned long)count, (unsigned long)mismatches, (unsigned long)longer);
+}
+
+/* The ways of formatting numbers timed by bench_format. */
+#define FORMAT_FLOAT    0
+#define FORMAT_FIXED    1
+#define FORMAT_PRINTF_E 2
+#define FORMAT_PRINTF_G 3
+#define FORMAT_PRINTF_D 4
+
+/*
+ * Report the time to format a measurement for a response, with
+ * scpi_format_float and scpi_format_fixed, against the printf formats
+ * that callbacks would otherwise use.
+ */
+static void
+bench_format(size_t iterations)
+{
+	static const char* names[] = { "scpi_format_float", "scpi_format_fixed", "printf %e",
+	                               "printf %.9g", "printf %ld.%03ld" };
+	static float values[NUMERIC_BATCH];
+	static int32_t fixed[NUMERIC_BATCH];
+	char str[32];
+	char reference[64];
+	size_t i;
+	size_t j;
+	size_t run;
+	size_t total;
+	int method;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t cycles[5];
+
+	/* Readings of a few digits, as a meter would return. */
+	for(i = 0; i < NUMERIC_BATCH; i++)
+	{
+		random_numeric(str, reference);
+		values[i] = scpi_parse_numeric(str, strlen(str), 0, 0, 0).value;
+		fixed[i] = (int32_t)random_below(2000000UL) - 1000000L;
+	}
+
+	for(method = FORMAT_FLOAT; method <= FORMAT_PRINTF_D; method++)
+	{
+		for(run = 0; run < 5; run++)
+		{
+			total = 0;
+			start = __rdtsc();
+			for(i = 0; i < iterations; i++)
+			{
+				for(j = 0; j < NUMERIC_BATCH; j++)
+				{
+					switch(method)
+					{
+						case FORMAT_FLOAT:
+							total += scpi_format_float(str, sizeof(str), values[j]);
+							break;
+						case FORMAT_FIXED:
+							total += scpi_format_fixed(str, sizeof(str), fixed[j], 3);
+							break;
+						case FORMAT_PRINTF_E:
+							total += snprintf(str, sizeof(str), "%e", values[j]);
+							break;
+						case FORMAT_PRINTF_G:
+							total += snprintf(str, sizeof(str), "%.9g", values[j]);
+							break;
+						case FORMAT_PRINTF_D:
+							total += snprintf(str, sizeof(str), "%s%ld.%03ld", fixed[j] < 0 ? "-" : "",
+							                  labs((long)fixed[j]) / 1000, labs((long)fixed[j]) % 1000);
+							break;
+					}
+				}
+			}
+			elapsed = __rdtsc() - start;
+			sink += total;
+
+			if(run == 0 || elapsed < cycles[method])
+			{
+				cycles[method] = elapsed;
+			}
+		}
+
+		printf("%-24s %8.1f cycles/number\n", names[method],
+				(double)cycles[method] / (iterations * NUMERIC_BATCH));
+	}
+}
+
+#define LIST_LENGTH 512
+
+/*
+ * Report the time per element to parse a list of copies of a number,
+ * one parameter at a time and with scpi_parse_numeric_list.
+ */
+static void
+bench_list(const char* name, const char* element, size_t iterations)
+{
+	static float values[LIST_LENGTH];
+	struct scpi_parameter_iterator params;
+	struct scpi_token param;
+	char* list;
+	size_t length;
+	size_t i;
+	size_t j;
+	size_t run;
+	int batch;
+	uint64_t start;
+	uint64_t elapsed;
+	uint64_t cycles[2];
+
+	list = (char*)malloc(LIST_LENGTH*(strlen(element)+1));
+	length = 0;
+	for(i = 0; i < LIST_LENGTH; i++)
+	{
+		length += sprintf(list+length, "%s%s", i == 0 ? "" : ",", element);
+	}
+
+	for(batch = 0; batch < 2; batch++)
+	{
+		for(run = 0; run < 5; run++)
+		{
+			start = __rdtsc();
+			for(i = 0; i < iterations; i++)
+			{
+				if(batch)
+				{
+					sink += scpi_parse_numeric_list(list, length, values, LIST_LENGTH, 0, 0, 0).count;
+					continue;
+				}
+
+				scpi_parameter_iterator_init(&params, list, length);
+				for(j = 0; scpi_next_parameter(&params, &param); j++)
+				{
+					values[j] = scpi_parse_numeric(param.value, param.length, 0, 0, 0).value;
+				}
+				sink += j;
+			}
+			elapsed = __rdtsc() - start;
+
+			if(run == 0 || elapsed < cycles[batch])
+			{
+				cycles[batch] = elapsed;
+			}
+		}
+	}
+
+	printf("%-24s %8.1f cycles/element  %8.1f cycles/element batched\n", name,
+			(double)cycles[0] / (iterations * LIST_LENGTH),
+			(double)cycles[1] / (iterations * LIST_LENGTH));
+
+	free(list);
+}
+
+/* The responses collected by capture_response. */
+static char captured[16384];
+static size_t captured_length;
+
+static void
+capture_response(void* opaque, const char* data, size_t length)
+{
+	if(captured_length + length <= sizeof(captured))
+	{
+		memcpy(captured + captured_length, data, length);
+	}
+	captured_length += length;
+}
+
+/* A record of samples from a 12-bit ADC, as returned by TRACe?. */
+#define TRACE_LENGTH 1000
+static int16_t trace[TRACE_LENGTH];
+
+static scpi_error_t
+trace_query(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	scpi_write_integers(ctx, trace, TRACE_LENGTH);
+	return SCPI_SUCCESS;
+}
+
+/*
+ * Write the response that TRACe? should give in each format.
+ */
+static size_t
+expected_trace(char* str, size_t format)
+{
+	uint32_t word;
+	float value;
+	size_t length;
+	size_t size;
+	size_t i;
+	size_t j;
+
+	length = 0;
+	if(format == 0)
+	{
+		for(i = 0; i < TRACE_LENGTH; i++)
+		{
+			length += sprintf(str+length, "%s%d", i == 0 ? "" : ",", trace[i]);
+		}
+	}
+	else
+	{
+		size = format == 3 ? 4 : 2;
+		length = sprintf(str+2, "%d", (int)(size*TRACE_LENGTH));
+		str[0] = '#';
+		str[1] = (char)('0' + length);
+		length += 2;
+		for(i = 0; i < TRACE_LENGTH; i++)
+		{
+			value = trace[i];
+			word = (uint16_t)trace[i];
+			if(size == 4)
+			{
+				memcpy(&word, &value, sizeof(word));
+			}
+
+			for(j = 0; j < size; j++)
+			{
+				str[length + (format == 2 ? j : size-1-j)] = (char)(word >> (8*j));
+			}
+			length += size;
+		}
+	}
+
+	str[length++] = '\n';
+	return length;
+}
+
+/*
+ * Check the response to a query for a record of samples in each data
+ * format, then compare how long each takes to write and how large it is.
+ */
+static void
+bench_data_formats(size_t iterations)
+{
+	static const char* commands[] = { "FORM ASC", "FORM INT,16", "FORM:DATA INT;BORD SWAP",
+	                                  "FORM:DATA REAL,32" };
+	static const char* names[] = { "ASCii data", "INTeger data", "swapped INTeger data",
+	                               "REAL data" };
+	static char expected[sizeof(captured)];
+	struct scpi_parser_context ctx;
+	size_t format;
+	size_t length;
+	size_t i;
+	uint64_t start;
+	uint64_t cycles;
+
+	for(i = 0; i < TRACE_LENGTH; i++)
+	{
+		trace[i] = (int16_t)random_below(4096);
+	}
+
+	for(format = 0; format < 4; format++)
+	{
+		scpi_init(&ctx);
+		scpi_set_output(&ctx, capture_response, NULL);
+		scpi_register_command(ctx.command_tree, SCPI_CL_CHILD, "TRACE?", 6, "TRAC?", 5,
+								trace_query);
+
+		scpi_execute_command(&ctx, commands[format], strlen(commands[format]));
+
+		length = expected_trace(expected, format);
+
+		start = __rdtsc();
+		for(i = 0; i < iterations; i++)
+		{
+			captured_length = 0;
+			scpi_execute_command(&ctx, "TRAC?", 5);
+		}
+		cycles = __rdtsc() - start;
+
+		printf("%-24s %8.1f cycles/sample  %6.2f bytes/sample  %s\n", names[format],
+				(double)cycles / (iterations * TRACE_LENGTH),
+				(double)captured_length / TRACE_LENGTH,
+				captured_length == length && memcmp(captured, expected, length) == 0
+					? "as expected" : "MISMATCHED");
+
+		scpi_destroy(&ctx);
+	}
+}
+
+/*
+ * Feed a message to a parser context, or to a router if one is given.
+ */
+static void
+feed_message(struct scpi_parser_context* ctx, struct scpi_router* router, const char* str)
+{
+	for(; *str != '\0'; str++)
+	{
+		if(router != NULL)
+		{
+			scpi_router_feed(router, *str);
+		}
+		else
+		{
+			scpi_feed(ctx, *str);
+		}
+	}
+}
+
+/*
+ * Compare the cost of feeding a message to an instrument directly and
+ * through a router of several, and of a message that switches between
+ * instruments part-way through.
+ */
+static void
+bench_router(size_t iterations)
+{
+	static const char* messages[] = { "MEAS?;MEAS?\n", "MEAS?;MEAS?\n",
+	                                  "INST:NSEL 2;MEAS?;:INST:NSEL 1;MEAS?\n" };
+	static const char* names[] = { "one instrument", "routed", "routed, switching" };
+	struct scpi_parser_context instruments[SCPI_ROUTER_INSTRUMENTS];
+	struct scpi_router router;
+	size_t method;
+	size_t i;
+	uint64_t start;
+	uint64_t cycles;
+
+	scpi_router_init(&router);
+	for(i = 0; i < SCPI_ROUTER_INSTRUMENTS; i++)
+	{
+		scpi_init(&instruments[i]);
+		scpi_set_output(&instruments[i], capture_response, NULL);
+		scpi_register_command(instruments[i].command_tree, SCPI_CL_CHILD, "MEASURE?", 8,
+								"MEAS?", 5, buffered_query);
+		scpi_router_add(&router, &instruments[i], "INSTRUMENT");
+	}
+
+	for(method = 0; method < 3; method++)
+	{
+		start = __rdtsc();
+		for(i = 0; i < iterations; i++)
+		{
+			captured_length = 0;
+			feed_message(&instruments[0], method == 0 ? NULL : &router, messages[method]);
+		}
+		cycles = __rdtsc() - start;
+
+		printf("%-24s %8.1f cycles/message  %s\n", names[method], (double)cycles / iterations,
+				captured_length == 10 && memcmp(captured, "1.25;1.25\n", 10) == 0
+					? "as expected" : "MISMATCHED");
+	}
+
+	for(i = 0; i < SCPI_ROUTER_INSTRUMENTS; i++)
+	{
+		scpi_destroy(&instruments[i]);
+	}
+}
+
+/* A setting that is accepted and ignored. */
+static scpi_error_t
+session_set(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	return SCPI_SUCCESS;
+}
+
+/* Count the bytes of the responses of one session. */
+static void
+count_response(void* opaque, const char* data, size_t length)
+{
+	*(size_t*)opaque += length;
+}
+
+/* The work of one thread of bench_sessions. */
+struct session_thread
+{
+	const struct scpi_tree* tree;
+	size_t                  messages;
+	size_t                  bytes;
+};
+
+/*
+ * Execute messages in a session of the shared tree.  The context is on
+ * the stack of the thread, so that no two threads write the same memory.
+ */
+static void*
+session_main(void* opaque)
+{
+	static const char message[] = ":MEAS:CHANNEL3?;:SOUR:CHANNEL3 1;:MEAS:CHANNEL7?";
+	struct session_thread* thread;
+	struct scpi_parser_context ctx;
+	size_t bytes;
+	size_t i;
+
+	thread = (struct session_thread*)opaque;
+	bytes = 0;
+
+	scpi_init_session(&ctx, thread->tree);
+	scpi_set_output(&ctx, count_response, &bytes);
+	for(i = 0; i < thread->messages; i++)
+	{
+		scpi_execute_command(&ctx, message, sizeof(message)-1);
+	}
+	scpi_destroy(&ctx);
+
+	thread->bytes = bytes;
+	return NULL;
+}
+
+#define SESSION_THREADS_MAX 64
+
+/*
+ * Report the throughput of threads that each execute messages in their
+ * own session of one shared tree, without a lock.  Each thread executes
+ * the same number of messages, so that the throughput should grow with
+ * the threads until there are more of them than cores.
+ */
+static void
+bench_sessions(size_t messages)
+{
+	static struct session_thread threads[SESSION_THREADS_MAX];
+	pthread_t ids[SESSION_THREADS_MAX];
+	struct scpi_tree tree;
+	struct scpi_command* source;
+	struct scpi_command* measure;
+	char names[20][16];
+	size_t count;
+	size_t i;
+	size_t mismatched;
+	uint64_t start;
+	uint64_t cycles;
+	double base;
+
+	scpi_tree_init(&tree);
+	source = scpi_register_command(tree.command_tree, SCPI_CL_CHILD, "SOURCE", 6, "SOUR", 4, NULL);
+	measure = scpi_register_command(tree.command_tree, SCPI_CL_CHILD, "MEASURE", 7, "MEAS", 4, NULL);
+	for(i = 0; i < 10; i++)
+	{
+		sprintf(names[2*i], "CHANNEL%u?", (unsigned)i);
+		sprintf(names[2*i+1], "CHANNEL%u", (unsigned)i);
+		scpi_register_command(measure, SCPI_CL_CHILD, names[2*i], 9, names[2*i], 9,
+								buffered_query);
+		scpi_register_command(source, SCPI_CL_CHILD, names[2*i+1], 8, names[2*i+1], 8,
+								session_set);
+	}
+	scpi_tree_finalize(&tree);
+
+	base = 0;
+	for(count = 1; count <= SESSION_THREADS_MAX; count *= 2)
+	{
+		start = __rdtsc();
+		for(i = 0; i < count; i++)
+		{
+			threads[i].tree = &tree;
+			threads[i].messages = messages;
+			pthread_create(&ids[i], NULL, session_main, &threads[i]);
+		}
+		for(i = 0; i < count; i++)
+		{
+			pthread_join(ids[i], NULL);
+		}
+		cycles = __rdtsc() - start;
+
+		/* Each message has the response "1.25;1.25\n". */
+		mismatched = 0;
+		for(i = 0; i < count; i++)
+		{
+			mismatched += threads[i].bytes != 10*messages;
+		}
+
+		if(count == 1)
+		{
+			base = (double)messages / cycles;
+		}
+
+		printf("%2lu session threads      %8.1f messages/Mcycle  %5.2fx  %s\n",
+				(unsigned long)count, 1e6 * count * messages / cycles,
+				(double)count * messages / cycles / base,
+				mismatched == 0 ? "as expected" : "MISMATCHED");
+	}
+
+	scpi_tree_destroy(&tree);
+}
+
+/* The state shared by the threads of bench_receive. */
+struct receive_threads
+{
+	struct scpi_receive_ring ring;
+	size_t                   messages;
+};
+
+/* Send messages into the ring, trying again whenever it is full. */
+static void*
+receive_producer(void* opaque)
+{
+	static const char message[] = "MEAS?;MEAS?\n";
+	struct receive_threads* threads;
+	size_t i;
+	size_t j;
+
+	threads = (struct receive_threads*)opaque;
+	for(i = 0; i < threads->messages; i++)
+	{
+		for(j = 0; j < sizeof(message)-1; j++)
+		{
+			while(!scpi_receive(&threads->ring, message[j]))
+			{
+				sched_yield();
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Compare the cost of feeding bytes to the parser directly and through a
+ * receive ring, then drain a ring that another thread fills, as a serial
+ * interrupt handler would, and check that no message is lost.
+ */
+static void
+bench_receive(size_t iterations)
+{
+	static const char message[] = "MEAS?;MEAS?\n";
+	static struct receive_threads threads;
+	struct scpi_parser_context ctx;
+	pthread_t producer;
+	size_t method;
+	size_t i;
+	size_t j;
+	size_t expected;
+	size_t bytes;
+	uint64_t start;
+	uint64_t cycles;
+
+	scpi_init(&ctx);
+	scpi_set_output(&ctx, capture_response, NULL);
+	scpi_register_command(ctx.command_tree, SCPI_CL_CHILD, "MEASURE?", 8, "MEAS?", 5,
+							buffered_query);
+
+	for(method = 0; method < 2; method++)
+	{
+		scpi_receive_init(&threads.ring);
+
+		start = __rdtsc();
+		for(i = 0; i < iterations; i++)
+		{
+			captured_length = 0;
+			for(j = 0; j < sizeof(message)-1; j++)
+			{
+				if(method == 0)
+				{
+					scpi_feed(&ctx, message[j]);
+				}
+				else
+				{
+					scpi_receive(&threads.ring, message[j]);
+				}
+			}
+
+			if(method == 1)
+			{
+				scpi_receive_drain(&ctx, &threads.ring);
+			}
+		}
+		cycles = __rdtsc() - start;
+
+		printf("%-24s %8.1f cycles/byte  %s\n", method == 0 ? "fed directly" : "through a ring",
+				(double)cycles / (iterations * (sizeof(message)-1)),
+				captured_length == 10 && memcmp(captured, "1.25;1.25\n", 10) == 0
+					? "as expected" : "MISMATCHED");
+	}
+
+	/* Each message has the response "1.25;1.25\n". */
+	scpi_receive_init(&threads.ring);
+	threads.messages = iterations;
+	expected = 10 * iterations;
+
+	bytes = 0;
+	scpi_set_output(&ctx, count_response, &bytes);
+
+	start = __rdtsc();
+	pthread_create(&producer, NULL, receive_producer, &threads);
+	while(bytes < expected)
+	{
+		scpi_receive_drain(&ctx, &threads.ring);
+		sched_yield();
+	}
+	pthread_join(producer, NULL);
+	cycles = __rdtsc() - start;
+
+	/* The producer tries again after an overflow, so no byte is lost. */
+	printf("%-24s %8.1f cycles/byte  %8lu high water  %8lu times full  %s\n",
+			"from another thread", (double)cycles / (iterations * (sizeof(message)-1)),
+			(unsigned long)threads.ring.high_water, threads.ring.overflows,
+			bytes == expected ? "as expected" : "MISMATCHED");
+
+	scpi_destroy(&ctx);
+}
+
+int main(int argc, char** argv)
+{
+	char* list;
+	size_t i;
+	size_t width;
+
+	printf("%s (AVX2 %s)\n\n", argv[0],
+			__builtin_cpu_supports("avx2") ? "available" : "unavailable");
+
+	/* A long list of values, as used to upload a sequence. */
+	list = (char*)malloc(4096+1);
+	strcpy(list, ":SOURCE:LIST:VOLTAGE ");
+	for(i = strlen(list); i+8 < 4096; i += 8)
+	{
+		memcpy(list+i, "1.2345V,", 8);
+	}
+	list[i] = '0';
+	list[i+1] = '\0';
+
+	bench_tokenize("query", ":MEASURE:VOLTAGE?", 2000000);
+	bench_tokenize("set", ":SOURCE:VOLTAGE 1.5V", 2000000);
+	bench_tokenize("long header", ":SENSE:VOLTAGE:DC:RANGE:UPPER:AUTO ON", 2000000);
+	bench_tokenize("list", list, 20000);
+
+	free(list);
+
+	printf("\n");
+	bench_headers(2000000);
+
+	printf("\n");
+	for(width = 4; width <= 4096; width *= 4)
+	{
+		bench_width(width, 50000);
+	}
+
+	printf("\n");
+	bench_generated(1000000);
+
+	printf("\n");
+	bench_connections(100000);
+	bench_errors(1000000);
+#if SCPI_ERROR_QUEUE_ATOMIC
+	bench_error_threads(3200000);
+#endif
+	bench_responses(200000);
+
+	printf("\n");
+	check_numeric("random numerics", random_numeric, 2000000);
+	check_numeric("near midpoints", random_midpoint, 1000000);
+	check_fixed(2000000);
+	check_units();
+	bench_numeric(200);
+	bench_list("short elements", "1.2345V", 2000);
+	bench_list("long elements", "0.123456789012345V", 2000);
+
+	printf("\n");
+	check_format(2000000);
+	bench_format(100);
+
+	printf("\n");
+	bench_data_formats(2000);
+	bench_router(200000);
+
+	printf("\n");
+	bench_sessions(50000);
+
+	printf("\n");
+	bench_receive(200000);
+
+	return 0;
+}
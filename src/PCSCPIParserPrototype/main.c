@@ -2,62 +2,126 @@
 #include <stdio.h>
 
 #include "scpiparser.h"
+#include "commands.h"
 
 float voltage;
 int   voltage_on;
+long  counts;
+long  sweep_steps;
+
+void write_response(void* opaque, const char* data, size_t length)
+{
+	fwrite(data, 1, length, (FILE*)opaque);
+}
 
 scpi_error_t identify(struct scpi_parser_context* ctx, struct scpi_token* command)
 {
-	printf("OIC,0.1,SCPI Test,0\n");
-	scpi_free_tokens(command);
+	scpi_write_string(ctx, "OIC,0.1,SCPI Test,0");
 	return SCPI_SUCCESS;
 }
 
 scpi_error_t measure_callback(struct scpi_parser_context* ctx, struct scpi_token* command)
 {
-	printf("%e\n", voltage_on ? voltage : 0.0f);
-	scpi_free_tokens(command);
-	
+	scpi_write_float(ctx, voltage_on ? voltage : 0.0f);
 	return SCPI_SUCCESS;
 }
 
 scpi_error_t set_voltage(struct scpi_parser_context* ctx, struct scpi_token* command)
 {
+	struct scpi_parameter_iterator params;
+	struct scpi_token arg;
 	struct scpi_token* args;
+	struct scpi_numeric numeric;
 	
-	args = command;
-	while(args != NULL && args->type == 0)
-	{
-		args = args->next;
-	}
+	scpi_parameter_iterator_init(&params, command->value, command->length);
+	args = scpi_next_parameter(&params, &arg) ? &arg : NULL;
 	
 	if(args == NULL)
 	{
-		printf("ERROR: No argument.\n");
+		scpi_queue_error(ctx, SCPI_ERROR_MISSING_PARAMETER);
 	}
 	else
 	{
-		voltage = scpi_parse_numeric(args->value, args->length, 0.0f, 0.0f,1.0e5f).value;
+		numeric = scpi_parse_numeric(args->value, args->length, 0.0f, 0.0f,1.0e5f);
+		if(numeric.status != SCPI_NUMERIC_SUCCESS)
+		{
+			scpi_queue_error(ctx, SCPI_ERROR_NUMERIC_DATA);
+		}
+		else if(numeric.unit_id != SCPI_UNIT_NONE && numeric.unit_id != SCPI_UNIT_VOLT)
+		{
+			scpi_queue_error(ctx, SCPI_ERROR_INVALID_SUFFIX);
+		}
+		else
+		{
+			voltage = numeric.value;
+		}
 	}
 	
-	scpi_free_tokens(command);
-	
 	return SCPI_SUCCESS;
 }
 
-scpi_error_t set_output(struct scpi_parser_context* ctx, struct scpi_token* command)
+/*
+ * Raise the voltage by 1 V a number of times.  This is left running when
+ * the callback returns, and is carried on by poll_sweep.
+ */
+scpi_error_t start_sweep(struct scpi_parser_context* ctx, struct scpi_token* command)
 {
-	struct scpi_token* args;
+	struct scpi_parameter_iterator params;
+	struct scpi_token arg;
+	struct scpi_numeric_fixed steps;
 	
-	args = command;
-	while(args != NULL && args->type == 0)
+	scpi_parameter_iterator_init(&params, command->value, command->length);
+	if(!scpi_next_parameter(&params, &arg))
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_MISSING_PARAMETER);
+		return SCPI_SUCCESS;
+	}
+	
+	steps = scpi_parse_numeric_fixed(arg.value, arg.length, 0, 1, 1, 100);
+	if(steps.status != SCPI_NUMERIC_SUCCESS)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_NUMERIC_DATA);
+		return SCPI_SUCCESS;
+	}
+	else if(steps.value < 1 || steps.value > 100)
+	{
+		scpi_queue_error(ctx, SCPI_ERROR_DATA_OUT_OF_RANGE);
+		return SCPI_SUCCESS;
+	}
+	
+	sweep_steps = steps.value;
+	return SCPI_PENDING;
+}
+
+/*
+ * Take the next step of the sweep, as an instrument would in loop().
+ */
+void poll_sweep(struct scpi_parser_context* ctx)
+{
+	if(sweep_steps > 0)
 	{
-		args = args->next;
+		voltage += 1.0f;
+		sweep_steps--;
+		
+		if(sweep_steps == 0)
+		{
+			scpi_complete(ctx);
+		}
 	}
+}
+
+scpi_error_t set_output(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	struct scpi_parameter_iterator params;
+	struct scpi_token arg;
+	struct scpi_token* args;
+	
+	scpi_parameter_iterator_init(&params, command->value, command->length);
+	args = scpi_next_parameter(&params, &arg) ? &arg : NULL;
 	
 	if(args == NULL)
 	{
-		printf("ERROR: No argument.\n");
+		scpi_queue_error(ctx, SCPI_ERROR_MISSING_PARAMETER);
 	}
 	else
 	{
@@ -77,15 +141,53 @@ scpi_error_t set_output(struct scpi_parser_context* ctx, struct scpi_token* comm
 		
 	}
 	
-	scpi_free_tokens(command);
-	
 	return SCPI_SUCCESS;
 }
 
 scpi_error_t get_output(struct scpi_parser_context* ctx, struct scpi_token* command)
 {
-	printf("%d\n", voltage_on);
-	scpi_free_tokens(command);
+	scpi_write_fixed(ctx, voltage_on, 0);
+	return SCPI_SUCCESS;
+}
+
+scpi_error_t load_data(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	struct scpi_parameter_iterator params;
+	struct scpi_token arg;
+	
+	scpi_parameter_iterator_init(&params, command->value, command->length);
+	while(scpi_next_parameter(&params, &arg))
+	{
+		if(arg.type == SCPI_TT_BLOCK)
+		{
+			scpi_write_string(ctx, "Block of ");
+			scpi_write_fixed(ctx, (int32_t)arg.length, 0);
+			scpi_write_string(ctx, " bytes: ");
+			scpi_write(ctx, arg.value, arg.length);
+		}
+	}
+	
+	return SCPI_SUCCESS;
+}
+
+scpi_error_t get_trace(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	/* Chosen so that each byte of the INTeger format is printable. */
+	static const int16_t trace[] = { 0x4142, 0x4344, 0x4546 };
+	
+	scpi_write_integers(ctx, trace, 3);
+	return SCPI_SUCCESS;
+}
+
+scpi_error_t identify_counter(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	scpi_write_string(ctx, "OIC,0.1,SCPI Counter,0");
+	return SCPI_SUCCESS;
+}
+
+scpi_error_t count_callback(struct scpi_parser_context* ctx, struct scpi_token* command)
+{
+	scpi_write_fixed(ctx, ++counts, 0);
 	return SCPI_SUCCESS;
 }
 
@@ -97,18 +199,26 @@ void status_message(char* str)
 void execute_command(struct scpi_parser_context* ctx, char* str)
 {
 	scpi_error_t error;
+	size_t length;
+	size_t consumed;
 	
 	printf(">> %s\n", str);
-	error = scpi_execute_command(ctx, str, strlen(str));
+	
+	/*
+	 * Whatever is after a *WAI or *OPC? that has to wait is given again
+	 * once the sweep is complete.
+	 */
+	length = strlen(str);
+	while((error = scpi_execute_command_partial(ctx, str, length, &consumed)) == SCPI_PENDING)
+	{
+		poll_sweep(ctx);
+		str += consumed;
+		length -= consumed;
+	}
 	putchar('\n');
 	if(error == SCPI_COMMAND_NOT_FOUND)
 	{
-		struct scpi_error notfound_error;
-		notfound_error.id = -100;
-		notfound_error.description = "Command error;Command not found";
-		notfound_error.length = strlen(notfound_error.description);
-		
-		scpi_queue_error(ctx, notfound_error);
+		scpi_queue_error(ctx, SCPI_ERROR_UNDEFINED_HEADER);
 		
 		printf("<< Command not found.\n");
 	}
@@ -117,74 +227,89 @@ void execute_command(struct scpi_parser_context* ctx, char* str)
 	*/
 }
 
-void print_command_tree(struct scpi_command* list, int tabs)
+void feed_command(struct scpi_parser_context* ctx, char* str)
 {
-	while(list != NULL)
+	scpi_error_t error;
+	
+	printf(">> %s\n", str);
+	
+	/*
+	 * Feed the command one byte at a time, as it would arrive from a serial
+	 * port.  While *WAI or *OPC? waits, the byte is kept and the sweep run.
+	 */
+	while(*str != '\0')
 	{
-		int i;
-		
-		if(list->long_name != NULL)
+		if(scpi_feed(ctx, *str) == SCPI_PENDING)
 		{
-			for(i = 0; i < tabs; i++)
-			{
-				putchar('\t');
-			}
-			
-			fwrite(list->long_name, 1, list->long_name_length, stdout);
-			putchar('\n');
+			poll_sweep(ctx);
+			continue;
 		}
-		print_command_tree(list->children, tabs+1);
 		
-		list = list->next;
+		str++;
+	}
+	
+	while((error = scpi_feed(ctx, '\n')) == SCPI_PENDING)
+	{
+		poll_sweep(ctx);
+	}
+	
+	while(ctx->operation_wait != SCPI_WAIT_NONE)
+	{
+		poll_sweep(ctx);
+	}
+	
+	putchar('\n');
+	if(error == SCPI_COMMAND_NOT_FOUND)
+	{
+		printf("<< Command not found.\n");
 	}
 }
 
-void print_single_command(struct scpi_command* list)
+void route_command(struct scpi_router* router, char* str)
 {
-	if(list->long_name != NULL)
+	scpi_error_t error;
+	
+	printf(">> %s\n", str);
+	
+	while(*str != '\0')
+	{
+		scpi_router_feed(router, *str);
+		str++;
+	}
+	
+	error = scpi_router_feed(router, '\n');
+	putchar('\n');
+	if(error == SCPI_COMMAND_NOT_FOUND)
 	{
-		fwrite(list->long_name, 1, list->long_name_length, stdout);
-		putchar('\n');
+		printf("<< Command not found.\n");
 	}
-	print_command_tree(list->children, 1);
 }
 
 int main(int argc, char** argv)
 {
 	struct scpi_parser_context ctx;
-	struct scpi_command* measure;
-	struct scpi_command* source;
-	struct scpi_command* output;
+	struct scpi_parser_context counter;
+	struct scpi_router router;
 	
 	voltage = 0;
 	voltage_on = 0;
+	counts = 0;
+	sweep_steps = 0;
 	
-	scpi_init(&ctx);
-	measure = scpi_register_command(ctx.command_tree, SCPI_CL_CHILD,
-										"MEASURE", 7, "MEAS", 4, NULL);
-	
-	printf("\nAssembling command tree:\n\n");
-	
-	scpi_register_command(ctx.command_tree, SCPI_CL_SAMELEVEL, "*IDN?", 5, "*IDN?", 5, identify);
+	/* The command tree is compiled from commands.scpi by scpigen.py. */
+	commands_init(&ctx);
 	
+	/* Each response is written to stdout in one piece. */
+	scpi_set_output(&ctx, write_response, stdout);
 	
-	scpi_register_command(measure, SCPI_CL_CHILD, "VOLTAGE?", 8, "VOLT?", 5, measure_callback);
-	scpi_register_command(measure, SCPI_CL_CHILD, "FREQUENCY?", 10, "FREQ?", 5, NULL);
-	
-	source = scpi_register_command(measure, SCPI_CL_SAMELEVEL, "SOURCE", 6, "SOUR", 4, NULL);
-	scpi_register_command(source, SCPI_CL_CHILD, "VOLTAGE", 7, "VOLT", 4, set_voltage);
-	
-	output = scpi_register_command(measure, SCPI_CL_SAMELEVEL, "OUTPUT", 6, "OUTP", 4, set_output);
-	scpi_register_command(measure, SCPI_CL_SAMELEVEL, "OUTPUT?", 7, "OUTP?", 5, get_output);
-	scpi_register_command(output, SCPI_CL_CHILD, "STATE", 5, "STAT", 4, set_output);
-	scpi_register_command(output, SCPI_CL_CHILD, "STATE?", 6, "STAT?", 5, get_output);
-	
-	print_command_tree(ctx.command_tree, 0);
+	printf("\nCommand tree:\n\n");
+	fputs(commands_listing, stdout);
 	
 	putchar('\n');
 	
 	execute_command(&ctx, "*IDN?");
 	execute_command(&ctx, ":MEASURE:VOLTAGE?");
+	execute_command(&ctx, ":meas:volt?");
 	execute_command(&ctx, ":SOURCE:VOLTAGE 15kV");
 	execute_command(&ctx, ":MEASURE:VOLTAGE?");
 	execute_command(&ctx, ":OUTPUT:STATE  ON");
@@ -199,5 +324,50 @@ int main(int argc, char** argv)
 	execute_command(&ctx, ":SYSTEM:ERROR?");
 	execute_command(&ctx, ":SYSTEM:ERROR?");
 	
+	execute_command(&ctx, ":SOURCE:VOLTAGE 3;:OUTPUT ON;*IDN?;:MEASURE:VOLTAGE?;FREQUENCY?");
+	execute_command(&ctx, ":SYSTEM:ERROR?");
+	
+	execute_command(&ctx, ":DATA #211a;b,c\"d'e,f;:OUTPUT?");
+	execute_command(&ctx, ":DATA #13abcXYZ,5;:SYSTEM:ERROR?");
+	
+	execute_command(&ctx, ":TRACE?");
+	execute_command(&ctx, ":FORMAT:DATA INT,16;:TRACE?");
+	execute_command(&ctx, ":FORMAT:BORDER SWAPPED;:TRACE?;:FORMAT:DATA?;BORDER?");
+	execute_command(&ctx, ":FORMAT REAL,64;:SYSTEM:ERROR?");
+	execute_command(&ctx, ":FORM ASC;:FORM:BORD NORM;:TRACE?");
+	
+	printf("Header cache: %lu hits, %lu misses\n\n",
+			ctx.header_cache_hits, ctx.header_cache_misses);
+	
+	feed_command(&ctx, ":SOURCE:VOLTAGE 2.5e3");
+	feed_command(&ctx, ":OUTPUT:STATE ON\r");
+	feed_command(&ctx, ":MEASURE:VOLTAGE?");
+	feed_command(&ctx, ":MEASURE:CURRENT?");
+	feed_command(&ctx, ":SOURCE:SWEEP 3;*OPC;*ESR?;:MEASURE:VOLTAGE?;*OPC?;*ESR?;:MEASURE:VOLTAGE?");
+	feed_command(&ctx, ":SOURCE:SWEEP 2;*WAI;:MEASURE:VOLTAGE?");
+	execute_command(&ctx, ":SOURCE:SWEEP 2;*OPC?;:MEASURE:VOLTAGE?");
+	execute_command(&ctx, ":SOURCE:SWEEP 2;*WAI;VOLTAGE 2.5e3;:MEASURE:VOLTAGE?");
+	
+	/* A second instrument, which shares its input with the first. */
+	scpi_init(&counter);
+	scpi_register_command(counter.command_tree, SCPI_CL_SAMELEVEL, "*IDN?", 5, "*IDN?", 5,
+							identify_counter);
+	scpi_register_command(counter.command_tree, SCPI_CL_CHILD, "COUNT?", 6, "COUN?", 5,
+							count_callback);
+	scpi_set_output(&counter, write_response, stdout);
+	
+	scpi_router_init(&router);
+	scpi_router_add(&router, &ctx, "SUPPLY");
+	scpi_router_add(&router, &counter, "COUNTER");
+	
+	route_command(&router, "*IDN?;:INSTRUMENT:CATALOG?");
+	route_command(&router, ":MEASURE:VOLTAGE?;:INST COUNTER;*IDN?;COUNT?;INST:NSEL?");
+	route_command(&router, ":COUNT?;:MEASURE:VOLTAGE?");
+	route_command(&router, ":INST:NSEL 1;:MEASURE:VOLTAGE?;:INST:SEL?");
+	route_command(&router, ":INST:SEL METER;:SYSTEM:ERROR?");
+	
+	scpi_destroy(&counter);
+	scpi_destroy(&ctx);
+	
 	return 0;
 }
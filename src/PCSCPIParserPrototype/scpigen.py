@@ -0,0 +1,657 @@
+#!/usr/bin/env python
+#
+# Compile a command tree specification into C++ for the SCPI parser.
+#
+# Usage: scpigen.py [--stubs FILE] SPEC NAME
+#
+# This writes NAME.h and NAME.cpp, which hold the tree as constant data,
+# a matcher that finds the children of each command with a switch
+# statement rather than by searching the list, and a listing of the tree.
+# The matcher is installed by NAME_init, which is used in place of
+# scpi_init, or by NAME_tree_init for a tree shared by several contexts
+# with scpi_init_session.  With --stubs, a skeleton of each callback is written to FILE.
+#
+# The specification gives one command per line, with the children of a
+# command indented beneath it.  Each command is written in the usual SCPI
+# form, where the upper-case letters are the short form, and is followed by
+# the name of its callback, if it has one, and any options:
+#
+#	# Lines starting with a hash are comments.
+#	%include "channels.h"
+#	%instrument
+#
+#	*IDN?			identify
+#	SOURce
+#		VOLTage#	set_voltage		data=&output_pins	params=numeric
+#	MEASure
+#		VOLTage#?	get_voltage		data=&input_pins
+#	DATA			-				block=load_block
+#
+# A # in a command stands for a numeric suffix, and a callback of - means
+# that the command has none.  The options are:
+#
+#	data=EXPR		The user data of the command, a C expression.
+#	block=NAME		The block callback of the command.
+#	params=TYPES	The parameters expected, a comma-separated list of numeric,
+#					boolean, string, block and any, used to document the
+#					callback and to write its stub.
+#
+# The FORMat and SYSTem:ERRor subtrees are added as the last top-level
+# commands, and *ESR?, *OPC, *OPC? and *WAI as the last common commands,
+# as scpi_init would; the latter are left out if the specification
+# defines any of them itself.  The %instrument directive adds the
+# INSTrument subtree before them, as scpi_router_add would, for a tree
+# that is to be one of the instruments of a router.  Commands that share a
+# level must not be able to match the same mnemonic, e.g. VOLTage? and
+# VOLTage#?, as the matcher does not try them in order.
+
+import os
+import re
+import sys
+
+PARAMETER_TYPES = ('numeric', 'boolean', 'string', 'block', 'any')
+
+class SpecError(Exception):
+	pass
+
+class Command(object):
+	def __init__(self, spec, callback=None, line=0):
+		self.spec = spec
+		self.callback = callback
+		self.data = None
+		self.block = None
+		self.params = []
+		self.children = []
+		self.line = line
+		self.index = None
+		self.reference = None
+
+		# The long form is the whole mnemonic in upper case, and the short
+		# form its leading capitals, keeping any suffix and question mark.
+		match = re.match(r'^(\*?[A-Za-z][A-Za-z0-9_]*)(#?)(\??)$', spec)
+		if match is None:
+			raise SpecError('line %d: invalid mnemonic %s' % (line, spec))
+
+		body, hash_mark, query = match.groups()
+		short = re.match(r'^\*?[A-Z0-9_]*', body).group(0)
+		if short == '' or short == '*':
+			short = body
+
+		self.long_name = body.upper() + hash_mark + query
+		self.short_name = short.upper() + hash_mark + query
+
+	def names(self):
+		if self.short_name == self.long_name:
+			return [self.long_name]
+		return [self.long_name, self.short_name]
+
+def system_command():
+	system = Command('SYSTem')
+	error = Command('ERRor')
+	error.children = [Command('NEXT?')]
+	system.children = [error, Command('ERRor?')]
+	system.reference = '&scpi_system_command'
+	return system
+
+def instrument_command():
+	# The library's INSTrument subtree is followed by its FORMat subtree.
+	instrument = Command('INSTrument')
+	instrument.children = [Command('SELect'), Command('SELect?'), Command('NSELect'),
+							Command('NSELect?'), Command('CATalog?')]
+	instrument.reference = '&scpi_instrument_command'
+	return instrument
+
+def format_command():
+	# The library's FORMat subtree is followed by its SYSTem subtree, and
+	# so must come just before it.
+	form = Command('FORMat')
+	form.children = [Command('DATA'), Command('DATA?'), Command('BORDer'), Command('BORDer?')]
+	form.reference = '&scpi_format_command'
+	return form
+
+def common_commands():
+	# The library's common commands are linked in this order, and so must
+	# be the last common commands.
+	commands = []
+	for name, reference in [('*ESR?', 'scpi_esr_query_command'), ('*OPC', 'scpi_opc_command'),
+							('*OPC?', 'scpi_opc_query_command'), ('*WAI', 'scpi_wai_command')]:
+		command = Command(name)
+		command.reference = '&' + reference
+		commands.append(command)
+	return commands
+
+def parse_spec(path):
+	includes = []
+	common = []
+	top = []
+	instrument = False
+
+	# The commands at each level of indentation above the current line.
+	stack = []
+
+	with open(path) as spec:
+		lines = spec.readlines()
+
+	for number, line in enumerate(lines, 1):
+		line = line.rstrip()
+		content = line.lstrip()
+		if content == '' or content.startswith('#'):
+			continue
+
+		if content.startswith('%'):
+			directive = content[1:].split(None, 1)
+			if directive == ['instrument']:
+				instrument = True
+			elif directive[0] == 'include' and len(directive) == 2:
+				includes.append(directive[1])
+			else:
+				raise SpecError('line %d: unknown directive %s' % (number, content))
+			continue
+
+		depth = len(line.expandtabs(4)) - len(content.expandtabs(4))
+		fields = content.split()
+
+		command = Command(fields[0], line=number)
+		if len(fields) > 1 and fields[1] != '-':
+			if '=' in fields[1]:
+				fields.insert(1, '-')
+			else:
+				command.callback = fields[1]
+
+		for option in fields[2:]:
+			key, _, value = option.partition('=')
+			if key == 'data':
+				command.data = value
+			elif key == 'block':
+				command.block = value
+			elif key == 'params':
+				command.params = value.split(',')
+				for param in command.params:
+					if param not in PARAMETER_TYPES:
+						raise SpecError('line %d: unknown parameter type %s' % (number, param))
+			else:
+				raise SpecError('line %d: unknown option %s' % (number, option))
+
+		while stack and stack[-1][0] >= depth:
+			stack.pop()
+
+		if stack:
+			if command.long_name.startswith('*'):
+				raise SpecError('line %d: common commands must be at the top level' % number)
+			stack[-1][1].children.append(command)
+		elif command.long_name.startswith('*'):
+			common.append(command)
+		else:
+			top.append(command)
+
+		stack.append((depth, command))
+
+	if instrument:
+		top.append(instrument_command())
+	top.append(format_command())
+	top.append(system_command())
+
+	# A specification that defines any of these itself is left with its own.
+	builtin = common_commands()
+	defined = set(command.long_name for command in common)
+	if not any(command.long_name in defined for command in builtin):
+		common.extend(builtin)
+
+	for siblings in [common] + [top] + list(all_children(top)):
+		check_siblings(siblings)
+
+	return includes, common, top
+
+def all_children(commands):
+	for command in commands:
+		if command.children:
+			yield command.children
+			for children in all_children(command.children):
+				yield children
+
+def walk(commands):
+	for command in commands:
+		yield command
+		for child in walk(command.children):
+			yield child
+
+def walk_nodes(commands):
+	"""As walk, but leaving out commands defined elsewhere and their children."""
+	for command in commands:
+		if command.reference is None:
+			yield command
+			for child in walk_nodes(command.children):
+				yield child
+
+def pattern(name):
+	"""Split a name into its stem, whether it has a suffix, and its tail."""
+	query = name.endswith('?') and '?' or ''
+	body = name[:len(name)-len(query)]
+	if body.endswith('#'):
+		return body[:-1], True, query
+	return name, False, ''
+
+def overlap(a, b):
+	"""Return whether two names may match the same mnemonic."""
+	if a == b:
+		return True
+
+	stem_a, suffix_a, tail_a = pattern(a)
+	stem_b, suffix_b, tail_b = pattern(b)
+
+	if not suffix_a and not suffix_b:
+		return False
+
+	if not suffix_a:
+		a, b = b, a
+		stem_a, suffix_a, tail_a, stem_b, suffix_b, tail_b = \
+			stem_b, suffix_b, tail_b, stem_a, suffix_a, tail_a
+
+	if not suffix_b:
+		# Does the exact name b look like stem_a, digits and tail_a?
+		if not (b.startswith(stem_a) and b.endswith(tail_a)):
+			return False
+		digits = b[len(stem_a):len(b)-len(tail_a)]
+		return len(b) >= len(stem_a) + len(tail_a) and len(digits) <= 9 \
+			and (digits == '' or digits.isdigit())
+
+	if tail_a != tail_b:
+		return False
+
+	if len(stem_a) > len(stem_b):
+		stem_a, stem_b = stem_b, stem_a
+	extra = stem_b[len(stem_a):]
+	return stem_b.startswith(stem_a) and (extra == '' or extra.isdigit())
+
+def check_siblings(siblings):
+	for i, a in enumerate(siblings):
+		for b in siblings[i+1:]:
+			for name_a in a.names():
+				for name_b in b.names():
+					if overlap(name_a, name_b):
+						raise SpecError('line %d: %s may be mistaken for %s'
+										% (b.line, b.spec, a.spec))
+
+def c_string(s):
+	return '"' + s.replace('\\', '\\\\').replace('"', '\\"').replace('\n', '\\n') \
+		.replace('\t', '\\t') + '"'
+
+def c_char(value):
+	c = chr(value)
+	if c in '\\\'':
+		return "'\\" + c + "'"
+	if 32 <= value < 127:
+		return "'" + c + "'"
+	return '0x%02x' % value
+
+def char_test(index, c):
+	"""A test for one character of a mnemonic, ignoring its case."""
+	if c.isalpha():
+		return '(name[%s] | 0x20) == %s' % (index, c_char(ord(c.lower())))
+	return 'name[%s] == %s' % (index, c_char(ord(c)))
+
+def compare(name, skip_first=False):
+	tests = []
+	for i, c in enumerate(name):
+		if i == 0 and skip_first:
+			continue
+		tests.append(char_test(i, c))
+	return tests
+
+def join_tests(tests, indent):
+	if not tests:
+		return '1'
+	return ('\n' + indent + '&& ').join(tests)
+
+class Generator(object):
+	def __init__(self, name, spec_path, includes, common, top):
+		self.name = name
+		self.spec_path = spec_path
+		self.includes = includes
+		self.common = common
+		self.top = top
+
+		# The root is the first node, followed by every command in order.
+		self.nodes = [None]
+		for command in walk_nodes(common + top):
+			command.index = len(self.nodes)
+			self.nodes.append(command)
+
+		self.uses_suffix = any('#' in c.long_name for c in self.nodes[1:])
+
+	def node(self, command):
+		if command is None:
+			return 'NULL'
+		if command.reference is not None:
+			return '(struct scpi_command*)' + command.reference
+		return '(struct scpi_command*)&%s_tree[%d]' % (self.name, command.index)
+
+	def target(self, command):
+		if command.reference is not None:
+			return command.reference
+		return '&%s_tree[%d]' % (self.name, command.index)
+
+	def listing(self):
+		"""The tree as it would be printed by walking it, by long name."""
+		lines = []
+		def add(commands, depth):
+			for command in commands:
+				lines.append('\t'*depth + command.long_name + '\n')
+				add(command.children, depth+1)
+		add(self.top, 1)
+		add(self.common, 0)
+		return ''.join(lines)
+
+	def summary(self):
+		"""The tree in the form of the specification, for documentation."""
+		lines = []
+		def add(commands, depth, prefix):
+			for command in commands:
+				text = '  '*depth + prefix + command.spec
+				if command.callback is not None:
+					text = text.ljust(24) + ' -> ' + command.callback
+				lines.append(' *  ' + text)
+				add(command.children, depth+1, ':')
+		add(self.common, 0, '')
+		add(self.top, 0, ':')
+		return '\n'.join(lines)
+
+	def headers(self, command, path=''):
+		"""Yield the full header and command of every command below command."""
+		for child in command:
+			header = path + (path and ':' or '') + child.spec
+			yield header, child
+			for result in self.headers(child.children, header):
+				yield result
+
+	def callbacks(self):
+		"""Return the callbacks and block callbacks with the commands using them."""
+		callbacks = {}
+		blocks = {}
+		order = []
+		for header, command in self.headers(self.common + self.top):
+			for table, name in ((callbacks, command.callback), (blocks, command.block)):
+				if name is None:
+					continue
+				if name not in callbacks and name not in blocks:
+					order.append(name)
+				table.setdefault(name, []).append((header, command))
+		return order, callbacks, blocks
+
+	def write_header(self, out):
+		guard = '__%s_H' % re.sub(r'\W', '_', self.name).upper()
+		order, callbacks, blocks = self.callbacks()
+
+		out.write('/*\n * Generated by scpigen.py from %s.  Do not edit.\n *\n'
+					% os.path.basename(self.spec_path))
+		out.write(' * The command tree is\n *\n%s\n */\n\n' % self.summary())
+		out.write('#ifndef %s\n#define %s\n\n#include <stddef.h>\n\n#include "scpiparser.h"\n\n'
+					% (guard, guard))
+		out.write('#ifdef __cplusplus\n\n  extern "C" {\n  \n#endif\n\n')
+
+		for name in order:
+			if name in callbacks:
+				for header, command in callbacks[name]:
+					params = ''.join(' <%s>' % p for p in command.params)
+					out.write('/* %s%s */\n' % (header, params))
+				out.write('scpi_error_t %s(struct scpi_parser_context* ctx, '
+							'struct scpi_token* command);\n\n' % name)
+			if name in blocks:
+				for header, command in blocks[name]:
+					out.write('/* %s, block data */\n' % header)
+				out.write('scpi_error_t %s(struct scpi_parser_context* ctx, '
+							'const char* data, size_t length);\n\n' % name)
+
+		out.write('/*\n * The command tree, whose root is the first element.\n */\n')
+		out.write('extern const struct scpi_command %s_tree[%d];\n\n'
+					% (self.name, len(self.nodes)))
+		out.write('/*\n * The long names of the commands, one per line and indented '
+					'by their\n * depth in the tree.  On AVR this is in program memory.\n */\n')
+		out.write('extern const char %s_listing[];\n\n' % self.name)
+		out.write('/*\n * Find a child of a command in the tree, for '
+					'scpi_set_command_matcher.\n */\n')
+		out.write('int\n%s_match(const struct scpi_command* parent, const char* name, '
+					'size_t length,\n\t\tconst struct scpi_command** command, '
+					'unsigned long* suffix);\n\n' % self.name)
+		out.write('/*\n * Initialise a parser with the tree and its matcher.\n */\n')
+		out.write('void\n%s_init(struct scpi_parser_context* ctx);\n\n' % self.name)
+		out.write('/*\n * Initialise a shared tree with the tree and its matcher.\n */\n')
+		out.write('void\n%s_tree_init(struct scpi_tree* tree);\n\n' % self.name)
+		out.write('#ifdef __cplusplus\n\n  }\n  \n#endif\n\n#endif\n')
+
+	def write_names(self, out):
+		for command in self.nodes[1:]:
+			out.write('static const char %s_name_%d[] SCPI_PROGMEM = %s;\n'
+						% (self.name, command.index, c_string(command.long_name)))
+			if command.short_name != command.long_name:
+				out.write('static const char %s_short_name_%d[] SCPI_PROGMEM = %s;\n'
+							% (self.name, command.index, c_string(command.short_name)))
+		out.write('\n')
+
+	def write_tree(self, out):
+		out.write('const struct scpi_command %s_tree[%d] SCPI_PROGMEM =\n{\n'
+					% (self.name, len(self.nodes)))
+
+		out.write('\t{\n\t\tNULL, 0, NULL, 0,\n\t\t%s, %s,\n\t\tNULL, NULL, NULL, NULL, NULL\n\t}'
+					% (self.node(self.common and self.common[0] or None),
+						self.node(self.top[0])))
+
+		siblings = {}
+		for commands in [self.common, self.top] + list(all_children(self.top)):
+			for i, command in enumerate(commands):
+				siblings[id(command)] = i+1 < len(commands) and commands[i+1] or None
+
+		for command in self.nodes[1:]:
+			long_name = '%s_name_%d' % (self.name, command.index)
+			short_name = long_name
+			if command.short_name != command.long_name:
+				short_name = '%s_short_name_%d' % (self.name, command.index)
+
+			out.write(',\n\n\t/* %s */\n\t{\n' % command.long_name)
+			out.write('\t\t%s, %d, %s, %d,\n' % (long_name, len(command.long_name),
+												short_name, len(command.short_name)))
+			out.write('\t\t%s, %s,\n' % (self.node(siblings[id(command)]),
+										self.node(command.children and command.children[0] or None)))
+			out.write('\t\t%s, %s, %s, NULL, NULL\n\t}'
+						% (command.callback or 'NULL', command.block or 'NULL',
+							command.data and '(void*)(%s)' % command.data or 'NULL'))
+
+		out.write('\n};\n\n')
+
+	def write_exact(self, out, candidates, indent):
+		"""Match names exactly, switching on the first character if there are several."""
+		if len(candidates) < 3:
+			for name, command in candidates:
+				out.write('%s/* %s */\n' % (indent, name))
+				out.write('%sif(%s)\n%s{\n%s\treturn %s;\n%s}\n\n'
+							% (indent, join_tests(compare(name), indent + '\t'), indent,
+								indent, self.target(command), indent))
+			out.write('%sbreak;\n' % indent)
+			return
+
+		groups = {}
+		for name, command in candidates:
+			groups.setdefault(ord(name[0]) | 0x20, []).append((name, command))
+
+		out.write('%sswitch(name[0] | 0x20)\n%s{\n' % (indent, indent))
+		for key in sorted(groups):
+			out.write('%scase %s:\n' % (indent, c_char(key)))
+			for name, command in groups[key]:
+				out.write('%s\t/* %s */\n' % (indent, name))
+				out.write('%s\tif(%s)\n%s\t{\n%s\t\treturn %s;\n%s\t}\n\n'
+							% (indent, join_tests(compare(name, name[0].isalpha()), indent + '\t\t'),
+								indent, indent, self.target(command), indent))
+			out.write('%s\tbreak;\n' % indent)
+		out.write('%s}\n%sbreak;\n' % (indent, indent))
+
+	def write_matcher(self, out, label, children):
+		out.write('/*\n * Find %s.\n */\n' % label[0])
+		out.write('static const struct scpi_command*\n%s_match_%s(const char* name, '
+					'size_t length, unsigned long* suffix)\n{\n' % (self.name, label[1]))
+
+		lengths = {}
+		suffixed = []
+		for command in children:
+			for name in command.names():
+				lengths.setdefault(len(name), []).append((name, command))
+				if '#' in name:
+					suffixed.append((name, command))
+
+		out.write('\tswitch(length)\n\t{\n')
+		for length in sorted(lengths):
+			out.write('\tcase %d:\n' % length)
+			self.write_exact(out, lengths[length], '\t\t')
+		out.write('\t}\n\n')
+
+		for name, command in suffixed:
+			stem, _, tail = pattern(name)
+			tests = ['length >= %d' % (len(stem) + len(tail))]
+			if tail:
+				tests.append("name[length-1] == '?'")
+			tests += compare(stem)
+			tests.append('%s_suffix(name+%d, length-%d, suffix)'
+							% (self.name, len(stem), len(stem) + len(tail)))
+			out.write('\t/* %s */\n' % name)
+			out.write('\tif(%s)\n\t{\n\t\treturn %s;\n\t}\n\n'
+						% (join_tests(tests, '\t\t'), self.target(command)))
+
+		out.write('\treturn NULL;\n}\n\n')
+
+	def write_source(self, out):
+		out.write('/*\n * Generated by scpigen.py from %s.  Do not edit.\n */\n\n'
+					% os.path.basename(self.spec_path))
+		for include in self.includes:
+			out.write('#include %s\n' % include)
+		out.write('#include "%s.h"\n\n' % self.name)
+
+		self.write_names(out)
+		self.write_tree(out)
+
+		out.write('const char %s_listing[] SCPI_PROGMEM =\n' % self.name)
+		for line in self.listing().splitlines(True):
+			out.write('\t%s\n' % c_string(line))
+		out.write('\t;\n\n')
+
+		if self.uses_suffix:
+			out.write('/*\n * Read the numeric suffix of a mnemonic, which is 1 if there '
+						'are no digits.\n * The suffix is at most nine digits, so that it '
+						'cannot overflow.\n */\n')
+			out.write('static int\n%s_suffix(const char* digits, size_t length, '
+						'unsigned long* suffix)\n{\n' % self.name)
+			out.write('\tunsigned long value;\n\tsize_t i;\n\t\n'
+						'\tif(length > 9)\n\t{\n\t\treturn 0;\n\t}\n\t\n'
+						'\tvalue = 1;\n\tif(length > 0)\n\t{\n\t\tvalue = 0;\n'
+						'\t\tfor(i = 0; i < length; i++)\n\t\t{\n'
+						"\t\t\tif(digits[i] < '0' || digits[i] > '9')\n\t\t\t{\n"
+						'\t\t\t\treturn 0;\n\t\t\t}\n\t\t\t\n'
+						"\t\t\tvalue = value*10 + (digits[i]-'0');\n\t\t}\n\t}\n\t\n"
+						'\t*suffix = value;\n\treturn 1;\n}\n\n')
+
+		parents = [('a top-level command', '0', self.top)]
+		for command in self.nodes[1:]:
+			if command.children:
+				parents.append(('a child of ' + command.long_name, str(command.index),
+								command.children))
+		if self.common:
+			parents.append(('a common command', 'common', self.common))
+
+		for label, index, children in parents:
+			self.write_matcher(out, (label, index), children)
+
+		out.write('int\n%s_match(const struct scpi_command* parent, const char* name, '
+					'size_t length,\n\t\tconst struct scpi_command** command, '
+					'unsigned long* suffix)\n{\n' % self.name)
+		out.write('\tif(parent == NULL)\n\t{\n')
+		if self.common:
+			out.write('\t\t*command = %s_match_common(name, length, suffix);\n' % self.name)
+		else:
+			out.write('\t\t*command = NULL;\n')
+		out.write('\t\treturn 1;\n\t}\n\t\n')
+		out.write('\t/* Commands outside of the tree, such as SYSTem:ERRor, are searched. */\n')
+		out.write('\tif(parent < %s_tree || parent >= %s_tree + %d)\n\t{\n\t\treturn 0;\n\t}\n\t\n'
+					% (self.name, self.name, len(self.nodes)))
+		out.write('\tswitch(parent - %s_tree)\n\t{\n' % self.name)
+		for label, index, children in parents:
+			if index != 'common':
+				out.write('\tcase %s:\n\t\t*command = %s_match_%s(name, length, suffix);\n'
+							'\t\tbreak;\n\t\t\n' % (index, self.name, index))
+		out.write('\tdefault:\n\t\t*command = NULL;\n\t\tbreak;\n\t}\n\t\n\treturn 1;\n}\n\n')
+
+		out.write('void\n%s_init(struct scpi_parser_context* ctx)\n{\n' % self.name)
+		out.write('\tscpi_init_const(ctx, &%s_tree[0]);\n' % self.name)
+		out.write('\tscpi_set_command_matcher(ctx, %s_match);\n}\n\n' % self.name)
+		out.write('void\n%s_tree_init(struct scpi_tree* tree)\n{\n' % self.name)
+		out.write('\tscpi_tree_init_const(tree, &%s_tree[0]);\n' % self.name)
+		out.write('\tscpi_tree_set_command_matcher(tree, %s_match);\n}\n' % self.name)
+
+	def write_stubs(self, out):
+		order, callbacks, blocks = self.callbacks()
+
+		out.write('#include "%s.h"\n\n' % self.name)
+		for name in order:
+			if name in callbacks:
+				commands = callbacks[name]
+				params = commands[0][1].params
+				out.write('/*\n')
+				for header, command in commands:
+					out.write(' * %s%s\n' % (header, ''.join(' <%s>' % p for p in command.params)))
+				out.write(' */\nscpi_error_t\n%s(struct scpi_parser_context* ctx, '
+							'struct scpi_token* command)\n{\n' % name)
+				if params:
+					out.write('\tstruct scpi_parameter_iterator params;\n'
+								'\tstruct scpi_token arg;\n')
+					for i, param in enumerate(params):
+						if param == 'numeric':
+							out.write('\tstruct scpi_numeric value%d;\n' % (i+1))
+					out.write('\t\n\tscpi_parameter_iterator_init(&params, command->value, '
+								'command->length);\n')
+					for i, param in enumerate(params):
+						out.write('\t\n\t/* <%s> */\n' % param)
+						out.write('\tif(!scpi_next_parameter(&params, &arg)')
+						if param == 'block':
+							out.write(' || arg.type != SCPI_TT_BLOCK')
+						out.write(')\n\t{\n\t\treturn SCPI_SUCCESS;\n\t}\n')
+						if param == 'numeric':
+							out.write('\tvalue%d = scpi_parse_numeric(arg.value, arg.length, '
+										'0.0f, 0.0f, 0.0f);\n' % (i+1))
+					out.write('\t\n')
+				out.write('\treturn SCPI_SUCCESS;\n}\n\n')
+			if name in blocks:
+				out.write('/*\n')
+				for header, command in blocks[name]:
+					out.write(' * %s, block data\n' % header)
+				out.write(' */\nscpi_error_t\n%s(struct scpi_parser_context* ctx, '
+							'const char* data, size_t length)\n{\n'
+							'\treturn SCPI_SUCCESS;\n}\n\n' % name)
+
+def main(argv):
+	stubs = None
+	args = argv[1:]
+	if len(args) >= 2 and args[0] == '--stubs':
+		stubs = args[1]
+		args = args[2:]
+
+	if len(args) != 2:
+		sys.stderr.write('usage: %s [--stubs FILE] SPEC NAME\n' % argv[0])
+		return 2
+
+	spec_path, name = args
+	try:
+		includes, common, top = parse_spec(spec_path)
+	except SpecError as e:
+		sys.stderr.write('%s: %s\n' % (spec_path, e))
+		return 1
+
+	generator = Generator(os.path.basename(name), spec_path, includes, common, top)
+	with open(name + '.h', 'w') as out:
+		generator.write_header(out)
+	with open(name + '.cpp', 'w') as out:
+		generator.write_source(out)
+	if stubs is not None:
+		with open(stubs, 'w') as out:
+			generator.write_stubs(out)
+
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main(sys.argv))